@@ -1,5 +1,53 @@
 import bluetooth
 import logging
+import os
+import socket
+import struct
+import tempfile
+
+MUX_PATH = os.path.join(tempfile.gettempdir(), "librepods_aacp")
+HEAD_TRACKING_OPCODE = 0x17
+
+class MuxSocket:
+    """The AACP session of a running librepods, used like the L2CAP socket."""
+    SUBSCRIBE = 0x01
+    SEND      = 0x03
+    PACKET    = 0x81
+    LINK      = 0x82
+
+    def __init__(self, path=MUX_PATH, opcodes=(HEAD_TRACKING_OPCODE,)):
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.connect(path)
+        self.link_up = False
+        self._write(self.SUBSCRIBE, bytes(opcodes))
+
+    def _write(self, frame_type, body):
+        self.sock.sendall(struct.pack(">HB", len(body) + 1, frame_type) + body)
+
+    def _read_exact(self, size):
+        data = b""
+        while len(data) < size:
+            chunk = self.sock.recv(size - len(data))
+            if not chunk:
+                raise ConnectionError("librepods closed the connection")
+            data += chunk
+        return data
+
+    def send(self, data):
+        self._write(self.SEND, data)
+
+    def recv(self, bufsize):
+        # Returns one AACP packet, like a read from the L2CAP socket
+        while True:
+            size, frame_type = struct.unpack(">HB", self._read_exact(3))
+            body = self._read_exact(size - 1)
+            if frame_type == self.LINK:
+                self.link_up = body == b"\x01"
+            elif frame_type == self.PACKET:
+                return body[:bufsize]
+
+    def close(self):
+        self.sock.close()
 
 class ConnectionManager:
     INIT_CMD  = "00 00 04 00 01 00 02 00 00 00 00 00 00 00 00 00"
@@ -15,6 +63,15 @@ class ConnectionManager:
         self.started = False
 
     def connect(self):
+        # Share the app's connection when it is running, the handshake is already done
+        if os.path.exists(MUX_PATH):
+            try:
+                self.sock = MuxSocket()
+                self.connected = True
+                self.logger.info("Connected to AirPods through librepods.")
+                return self.connected
+            except OSError as e:
+                self.logger.info(f"librepods is not reachable ({e}), connecting directly.")
         self.logger.info(f"Connecting to {self.bt_addr} on PSM {self.psm:#04x}...")
         try:
             self.sock = bluetooth.BluetoothSocket(bluetooth.L2CAP)
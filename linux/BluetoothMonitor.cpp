@@ -1,5 +1,6 @@
 #include "BluetoothMonitor.h"
 #include "logger.h"
+#include "metrics.h"
 
 #include <QDebug>
 #include <QDBusObjectPath>
@@ -78,6 +79,7 @@ bool BluetoothMonitor::checkAlreadyConnectedDevices()
     QDBusArgument arg = firstArg.value<QDBusArgument>();
     ManagedObjectList managedObjects;
     arg >> managedObjects;
+    cacheDevicePaths(managedObjects);
 
     bool deviceFound = false;
 
@@ -146,6 +148,7 @@ void BluetoothMonitor::onPropertiesChanged(const QString &interface, const QVari
         }
         QString macAddress = addrReply.value().toString();
         QString deviceName = getDeviceName(path);
+        m_devicePaths.insert(macAddress, path);
 
         if (connected)
         {
@@ -158,4 +161,95 @@ void BluetoothMonitor::onPropertiesChanged(const QString &interface, const QVari
             LOG_DEBUG("AirPods device disconnected:" << macAddress << " Name:" << deviceName);
         }
     }
-}
\ No newline at end of file
+}
+void BluetoothMonitor::connectDevice(const QString &macAddress)
+{
+    callDevice(macAddress, "Connect");
+}
+
+void BluetoothMonitor::disconnectDevice(const QString &macAddress)
+{
+    callDevice(macAddress, "Disconnect");
+}
+
+void BluetoothMonitor::cacheDevicePaths(const ManagedObjectList &objects)
+{
+    for (auto it = objects.constBegin(); it != objects.constEnd(); ++it)
+    {
+        const QVariantMap device = it.value().value("org.bluez.Device1");
+        if (device.contains("Address"))
+        {
+            m_devicePaths.insert(device.value("Address").toString(), it.key().path());
+        }
+    }
+}
+
+void BluetoothMonitor::resolveDevicePath(const QString &macAddress, std::function<void(const QString &)> done)
+{
+    if (m_devicePaths.contains(macAddress))
+    {
+        done(m_devicePaths.value(macAddress));
+        return;
+    }
+
+    // Not seen yet, ask BlueZ for every device without waiting on the reply
+    QDBusMessage call = QDBusMessage::createMethodCall("org.bluez", "/", "org.freedesktop.DBus.ObjectManager", "GetManagedObjects");
+    auto *watcher = new QDBusPendingCallWatcher(m_dbus.asyncCall(call), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [this, watcher, macAddress, done]()
+    {
+        watcher->deleteLater();
+        QDBusPendingReply<ManagedObjectList> reply = *watcher;
+        if (reply.isError())
+        {
+            LOG_WARN("Failed to get managed objects: " << reply.error().message());
+        }
+        else
+        {
+            cacheDevicePaths(reply.value());
+        }
+        done(m_devicePaths.value(macAddress));
+    });
+}
+
+void BluetoothMonitor::callDevice(const QString &macAddress, const QString &method)
+{
+    auto finish = [this, macAddress, method](bool success, const QString &error)
+    {
+        Metrics::counter("librepods_bluez_calls_total", "Device1 calls made to BlueZ, by method and outcome",
+                         {{"method", method}, {"result", success ? "ok" : "error"}}).inc();
+        if (method == "Connect")
+        {
+            emit connectFinished(macAddress, success, error);
+        }
+        else
+        {
+            emit disconnectFinished(macAddress, success, error);
+        }
+    };
+
+    resolveDevicePath(macAddress, [this, finish, method, macAddress](const QString &path)
+    {
+        if (path.isEmpty())
+        {
+            LOG_WARN("BlueZ does not know " << macAddress << ", cannot call " << method);
+            finish(false, "Unknown device");
+            return;
+        }
+
+        // Connecting brings up every profile, which BlueZ may take a while to do
+        QDBusMessage call = QDBusMessage::createMethodCall("org.bluez", path, "org.bluez.Device1", method);
+        auto *watcher = new QDBusPendingCallWatcher(m_dbus.asyncCall(call, 30000), this);
+        connect(watcher, &QDBusPendingCallWatcher::finished, this, [watcher, finish, method, macAddress]()
+        {
+            watcher->deleteLater();
+            const QDBusError error = watcher->error();
+            // Already in the requested state is as good as done
+            const bool success = !error.isValid() || error.name() == "org.bluez.Error.AlreadyConnected";
+            if (!success)
+            {
+                LOG_WARN(method << " " << macAddress << " failed: " << error.name() << ", " << error.message());
+            }
+            finish(success, success ? QString() : error.message());
+        });
+    });
+}
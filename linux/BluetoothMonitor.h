@@ -3,6 +3,7 @@
 
 #include <QObject>
 #include <QtDBus/QtDBus>
+#include <functional>
 
 // Forward declarations for D-Bus types
 typedef QMap<QDBusObjectPath, QMap<QString, QVariantMap>> ManagedObjectList;
@@ -17,18 +18,31 @@ public:
 
     bool checkAlreadyConnectedDevices();
 
+    // org.bluez.Device1.Connect/Disconnect without waiting for the reply,
+    // the outcome arrives as connectFinished/disconnectFinished
+    void connectDevice(const QString &macAddress);
+    void disconnectDevice(const QString &macAddress);
+
 signals:
     void deviceConnected(const QString &macAddress, const QString &deviceName);
     void deviceDisconnected(const QString &macAddress, const QString &deviceName);
+    void connectFinished(const QString &macAddress, bool success, const QString &error);
+    void disconnectFinished(const QString &macAddress, bool success, const QString &error);
 
 private slots:
     void onPropertiesChanged(const QString &interface, const QVariantMap &changedProps, const QStringList &invalidatedProps);
 
 private:
     QDBusConnection m_dbus;
+    QHash<QString, QString> m_devicePaths; // Address to BlueZ object path
     void registerDBusService();
     bool isAirPodsDevice(const QString &devicePath);
     QString getDeviceName(const QString &devicePath);
+    // Records the object path of every device, nothing else
+    void cacheDevicePaths(const ManagedObjectList &objects);
+    // Calls done with the device's object path, or empty if BlueZ does not know it
+    void resolveDevicePath(const QString &macAddress, std::function<void(const QString &)> done);
+    void callDevice(const QString &macAddress, const QString &method);
 };
 
 #endif // BLUETOOTHMONITOR_H
\ No newline at end of file
@@ -40,6 +40,7 @@ Window {
                 width: Math.min(parent.width * 0.9, parent.height * 0.9)
                 height: width
                 fillMode: Image.PreserveAspectFit
+                sourceSize: Qt.size(width, height) // Rendered at this size instead of scaled
                 source: "image://qrcode/" + root.encKey + ";" + root.irk
 
                 BusyIndicator {
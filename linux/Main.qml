@@ -88,6 +88,14 @@ ApplicationWindow {
                     }
                 }
 
+                Label {
+                    anchors.horizontalCenter: parent.horizontalCenter
+                    visible: airPodsTrayApp.deviceInfo.stale
+                    text: "Last known state"
+                    opacity: 0.6
+                    font.pixelSize: 12
+                }
+
                 // Battery Indicator Row
                 Row {
                     anchors.horizontalCenter: parent.horizontalCenter
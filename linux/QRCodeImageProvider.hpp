@@ -1,18 +1,65 @@
 #include <QQuickImageProvider>
-#include <QPainter>
+#include <QCache>
+#include <QMutex>
+#include <QMutexLocker>
+#include <climits>
+#include <cstring>
+#include <vector>
 #include "thirdparty/QR-Code-generator/qrcodegen.hpp"
 
 class QRCodeImageProvider : public QQuickImageProvider
 {
 public:
-    QRCodeImageProvider() : QQuickImageProvider(QQuickImageProvider::Image) {}
+    QRCodeImageProvider() : QQuickImageProvider(QQuickImageProvider::Image), m_matrices(4), m_images(8) {}
 
     QImage requestImage(const QString &id, QSize *size, const QSize &requestedSize) override
     {
+        // Image providers can be called from QML's loader threads
+        QMutexLocker locker(&m_mutex);
+
+        const Matrix *matrix = this->matrix(id);
+        if (!matrix)
+            return QImage();
+
+        // Whole pixels per module keep the code sharp, fit it into the requested size
+        int scale = DefaultScale;
+        int requested = qMin(requestedSize.width() > 0 ? requestedSize.width() : INT_MAX,
+                             requestedSize.height() > 0 ? requestedSize.height() : INT_MAX);
+        if (requested != INT_MAX)
+            scale = qMax(1, requested / matrix->size);
+
+        const QString key = id + '@' + QString::number(scale);
+        QImage *image = m_images.object(key);
+        if (!image)
+        {
+            image = new QImage(render(*matrix, scale));
+            m_images.insert(key, image);
+        }
+
+        if (size)
+            *size = image->size();
+        return *image;
+    }
+
+private:
+    static constexpr int DefaultScale = 8;
+
+    // Dark modules, row by row
+    struct Matrix
+    {
+        int size = 0;
+        std::vector<bool> modules;
+    };
+
+    const Matrix *matrix(const QString &id)
+    {
+        if (const Matrix *cached = m_matrices.object(id))
+            return cached;
+
         // Parse the keys from id (format: "encKey;irk")
         QStringList keys = id.split(';');
         if (keys.size() != 2)
-            return QImage();
+            return nullptr;
 
         // Create URL format: librepods://add-magic-keys?enc_key=...&irk=...
         QString data = QString("librepods://add-magic-keys?enc_key=%1&irk=%2").arg(keys[0], keys[1]);
@@ -20,27 +67,43 @@ public:
         // Generate QR code using the existing qrcodegen library
         qrcodegen::QrCode qr = qrcodegen::QrCode::encodeText(data.toUtf8().constData(), qrcodegen::QrCode::Ecc::MEDIUM);
 
-        int scale = 8;
-        QImage image(qr.getSize() * scale, qr.getSize() * scale, QImage::Format_RGB32);
-        image.fill(Qt::white);
+        auto *matrix = new Matrix;
+        matrix->size = qr.getSize();
+        matrix->modules.resize(matrix->size * matrix->size);
+        for (int y = 0; y < matrix->size; y++)
+            for (int x = 0; x < matrix->size; x++)
+                matrix->modules[y * matrix->size + x] = qr.getModule(x, y);
 
-        QPainter painter(&image);
-        painter.setPen(Qt::NoPen);
-        painter.setBrush(Qt::black);
+        m_matrices.insert(id, matrix);
+        return matrix;
+    }
 
-        for (int y = 0; y < qr.getSize(); y++)
+    // Writes the bits of a 1-bit image directly: each module row is drawn once
+    // and then copied down for the remaining pixel rows of that module
+    static QImage render(const Matrix &matrix, int scale)
+    {
+        const int side = matrix.size * scale;
+        QImage image(side, side, QImage::Format_Mono);
+        image.setColorTable({qRgb(255, 255, 255), qRgb(0, 0, 0)});
+        image.fill(0);
+
+        for (int y = 0; y < matrix.size; y++)
         {
-            for (int x = 0; x < qr.getSize(); x++)
+            uchar *line = image.scanLine(y * scale);
+            for (int x = 0; x < matrix.size; x++)
             {
-                if (qr.getModule(x, y))
-                {
-                    painter.drawRect(x * scale, y * scale, scale, scale);
-                }
+                if (!matrix.modules[y * matrix.size + x])
+                    continue;
+                for (int px = x * scale; px < (x + 1) * scale; px++)
+                    line[px >> 3] |= 0x80 >> (px & 7);
             }
+            for (int row = 1; row < scale; row++)
+                std::memcpy(image.scanLine(y * scale + row), line, image.bytesPerLine());
         }
-
-        if (size)
-            *size = image.size();
         return image;
     }
-};
\ No newline at end of file
+
+    QMutex m_mutex;
+    QCache<QString, Matrix> m_matrices;
+    QCache<QString, QImage> m_images;
+};
@@ -0,0 +1,175 @@
+#include "aacpmux.h"
+#include "logger.h"
+#include "metrics.h"
+#include "trace.h"
+
+#include <QLocalServer>
+#include <QLocalSocket>
+
+AacpMux::AacpMux(QObject *parent)
+    : QObject(parent),
+      m_clientsGauge(Metrics::gauge("librepods_aacp_mux_clients", "Local tools connected to the AACP multiplexer")),
+      m_packetsToClients(Metrics::counter("librepods_aacp_mux_packets_total", "AACP packets passed through the multiplexer",
+                                          {{"direction", "to_client"}})),
+      m_packetsFromClients(Metrics::counter("librepods_aacp_mux_packets_total", "AACP packets passed through the multiplexer",
+                                            {{"direction", "from_client"}})),
+      m_dropped(Metrics::counter("librepods_aacp_mux_dropped_total", "AACP packets not passed to a multiplexer client that fell behind"))
+{
+}
+
+bool AacpMux::listen(const QString &name)
+{
+    if (!m_server)
+    {
+        m_server = new QLocalServer(this);
+        // Clients can write raw packets to the AirPods, so only this user may connect
+        m_server->setSocketOptions(QLocalServer::UserAccessOption);
+        connect(m_server, &QLocalServer::newConnection, this, &AacpMux::onNewConnection);
+    }
+    m_server->close();
+    QLocalServer::removeServer(name);
+    if (!m_server->listen(name))
+    {
+        LOG_ERROR("Unable to start the AACP multiplexer on " << name << ": " << m_server->errorString());
+        return false;
+    }
+    LOG_INFO("AACP multiplexer listening on " << m_server->fullServerName());
+    return true;
+}
+
+void AacpMux::dispatch(const QByteArray &packet)
+{
+    if (m_clients.isEmpty())
+    {
+        return;
+    }
+    // AACP packets carry their opcode after the 4-byte header
+    const int opcode = packet.size() > 4 ? quint8(packet[4]) : 0;
+    for (auto it = m_clients.begin(); it != m_clients.end(); ++it)
+    {
+        if (it->closed || !it->opcodes.test(opcode))
+        {
+            continue;
+        }
+        if (it.key()->bytesToWrite() > MaxPendingBytes)
+        {
+            m_dropped.inc();
+            continue;
+        }
+        write(it.key(), Packet, packet);
+        m_packetsToClients.inc();
+    }
+}
+
+void AacpMux::setLinkUp(bool up)
+{
+    if (m_linkUp == up)
+    {
+        return;
+    }
+    m_linkUp = up;
+    for (auto it = m_clients.cbegin(); it != m_clients.cend(); ++it)
+    {
+        if (!it->closed)
+        {
+            write(it.key(), Link, QByteArray(1, up ? 1 : 0));
+        }
+    }
+}
+
+void AacpMux::onNewConnection()
+{
+    while (QLocalSocket *socket = m_server->nextPendingConnection())
+    {
+        m_clients.insert(socket, Client());
+        m_clientsGauge.set(m_clients.size());
+        connect(socket, &QLocalSocket::readyRead, this, [this, socket]() { onReadyRead(socket); });
+        connect(socket, &QLocalSocket::disconnected, this, [this, socket]()
+        {
+            auto it = m_clients.find(socket);
+            if (it == m_clients.end() || it->closed)
+            {
+                return;
+            }
+            it->closed = true;
+            // Can fire from inside a write in dispatch() or setLinkUp(), the client is only
+            // removed once their loop is done with it
+            QMetaObject::invokeMethod(this, [this, socket]()
+            {
+                m_clients.remove(socket);
+                m_clientsGauge.set(m_clients.size());
+                socket->deleteLater();
+            }, Qt::QueuedConnection);
+        });
+        write(socket, Link, QByteArray(1, m_linkUp ? 1 : 0));
+    }
+}
+
+void AacpMux::onReadyRead(QLocalSocket *socket)
+{
+    auto it = m_clients.find(socket);
+    if (it == m_clients.end() || it->closed)
+    {
+        return;
+    }
+    Client &client = it.value();
+    client.readBuffer += socket->readAll();
+
+    int offset = 0;
+    while (client.readBuffer.size() - offset >= 2)
+    {
+        const int size = (quint8(client.readBuffer[offset]) << 8) | quint8(client.readBuffer[offset + 1]);
+        if (client.readBuffer.size() - offset - 2 < size)
+        {
+            break;
+        }
+        if (size > 0)
+        {
+            handleFrame(client, quint8(client.readBuffer[offset + 2]), client.readBuffer.mid(offset + 3, size - 1));
+        }
+        offset += 2 + size;
+    }
+    client.readBuffer.remove(0, offset);
+}
+
+void AacpMux::handleFrame(Client &client, quint8 type, const QByteArray &body)
+{
+    switch (type)
+    {
+    case Subscribe:
+    case Unsubscribe:
+    {
+        const bool subscribe = type == Subscribe;
+        if (body.isEmpty() && subscribe)
+        {
+            client.opcodes.set();
+        }
+        else if (body.isEmpty())
+        {
+            client.opcodes.reset();
+        }
+        for (const char opcode : body)
+        {
+            client.opcodes.set(quint8(opcode), subscribe);
+        }
+        LOG_DEBUG("Multiplexer client now receives " << client.opcodes.count() << " opcodes");
+        break;
+    }
+    case Send:
+        m_packetsFromClients.inc();
+        TRACE("Multiplexer client sent: {}", body);
+        emit sendRequested(body);
+        break;
+    default:
+        LOG_WARN("Unknown multiplexer frame type " << int(type));
+        break;
+    }
+}
+
+void AacpMux::write(QLocalSocket *socket, FrameType type, const QByteArray &body)
+{
+    const int size = body.size() + 1;
+    const char header[3] = {char((size >> 8) & 0xff), char(size & 0xff), char(type)};
+    socket->write(header, sizeof(header));
+    socket->write(body);
+}
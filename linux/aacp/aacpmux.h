@@ -0,0 +1,82 @@
+#pragma once
+
+#include <QObject>
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <bitset>
+
+class QLocalServer;
+class QLocalSocket;
+
+namespace Metrics
+{
+    class Counter;
+    class Gauge;
+}
+
+// Shares the live AACP session with local tools, such as the head tracking
+// scripts, so they do not open a second L2CAP link or redo the handshake.
+// Every frame is a big-endian 16-bit length, then a type byte and its body;
+// the length covers the type and the body:
+//
+//   -> 0x01 subscribe    opcodes to receive, one byte each, none for all
+//   -> 0x02 unsubscribe  opcodes to stop receiving, none for all
+//   -> 0x03 send         an AACP packet to write to the AirPods
+//   <- 0x81 packet       an AACP packet from the AirPods
+//   <- 0x82 link         one byte, 1 while the AirPods are connected
+//
+// A client gets the link state when it connects and whenever it changes.
+// Packets it sends go out through the session's own write path, in order
+// with the app's packets. A client that does not keep up loses packets
+// instead of holding up the session.
+class AacpMux : public QObject
+{
+    Q_OBJECT
+public:
+    static inline const QString ServerName = QStringLiteral("librepods_aacp");
+
+    explicit AacpMux(QObject *parent = nullptr);
+
+    bool listen(const QString &name = ServerName);
+    // A packet from the AirPods, passed on to the clients subscribed to its opcode
+    void dispatch(const QByteArray &packet);
+    void setLinkUp(bool up);
+
+signals:
+    void sendRequested(const QByteArray &packet);
+
+private:
+    enum FrameType : quint8
+    {
+        Subscribe = 0x01,
+        Unsubscribe = 0x02,
+        Send = 0x03,
+        Packet = 0x81,
+        Link = 0x82,
+    };
+
+    struct Client
+    {
+        QByteArray readBuffer;
+        std::bitset<256> opcodes;
+        bool closed = false; // Disconnected, waiting to be removed
+    };
+
+    void onNewConnection();
+    void onReadyRead(QLocalSocket *socket);
+    void handleFrame(Client &client, quint8 type, const QByteArray &body);
+    void write(QLocalSocket *socket, FrameType type, const QByteArray &body);
+
+    // Output queued for a client beyond this is dropped until it catches up
+    static constexpr qint64 MaxPendingBytes = 256 * 1024;
+
+    QLocalServer *m_server = nullptr;
+    QHash<QLocalSocket *, Client> m_clients;
+    bool m_linkUp = false;
+
+    Metrics::Gauge &m_clientsGauge;
+    Metrics::Counter &m_packetsToClients;
+    Metrics::Counter &m_packetsFromClients;
+    Metrics::Counter &m_dropped;
+};
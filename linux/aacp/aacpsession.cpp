@@ -0,0 +1,707 @@
+#include "aacpsession.h"
+#include "aacpmux.h"
+#include "airpods_packets.h"
+#include "logger.h"
+#include "metrics.h"
+#include "relayhub.h"
+#include "trace.h"
+
+#include <QBluetoothAddress>
+#include <QBluetoothSocket>
+#include <QBluetoothUuid>
+#include <QRandomGenerator>
+#include <QTimer>
+#include <algorithm>
+
+namespace
+{
+    const QBluetoothUuid AacpUuid("74ec2172-0bad-4d01-8f77-997b2be0722a");
+}
+
+AacpSession::AacpSession(QObject *parent)
+    : QObject(parent), m_relayHub(new RelayHub(this)), m_mux(new AacpMux(this)),
+      m_retryTimer(new QTimer(this)), m_bringUpTimer(new QTimer(this)),
+      m_battery(new Battery(this)), m_earDetection(new EarDetection(this)), m_stateTimer(new QTimer(this)),
+      m_parseErrors(Metrics::counter("librepods_aacp_parse_errors_total", "AACP packets that were recognized but failed to parse")),
+      m_unrecognizedPackets(Metrics::counter("librepods_aacp_unrecognized_packets_total", "AACP packets of an unknown format")),
+      m_reconnectAttempts(Metrics::counter("librepods_aacp_reconnect_attempts_total", "Attempts to reopen the AACP connection after an error")),
+      m_timeToReconnect(Metrics::Registry::instance().histogram("librepods_aacp_time_to_reconnect_ms",
+                                                                "Time from losing the AACP link, or waking up, until it is open again",
+                                                                {}, {100, 250, 500, 1000, 2500, 5000, 10000, 30000, 60000, 120000})),
+      m_firstStatusPipelined(Metrics::histogram("librepods_aacp_time_to_first_status_ms",
+                                                "Time from opening the AACP link to the first status packet", {{"bringup", "pipelined"}})),
+      m_firstStatusSerial(Metrics::histogram("librepods_aacp_time_to_first_status_ms",
+                                             "Time from opening the AACP link to the first status packet", {{"bringup", "serial"}})),
+      m_bringUpFallbacks(Metrics::counter("librepods_aacp_bringup_fallbacks_total",
+                                          "Pipelined bring-ups that fell back to the serial handshake")),
+      m_connectedGauge(Metrics::gauge("librepods_aacp_connected", "Whether the AACP connection to the AirPods is open")),
+      m_phoneConnectedGauge(Metrics::gauge("librepods_phone_connected", "Whether any relay peer is connected"))
+{
+    qRegisterMetaType<AacpSession::DeviceState>();
+    qRegisterMetaType<AacpSession::LinkState>();
+    m_retryTimer->setSingleShot(true);
+    connect(m_retryTimer, &QTimer::timeout, this, [this]() { openDeviceSocket(m_deviceAddress); });
+    m_bringUpTimer->setSingleShot(true);
+    m_bringUpTimer->setInterval(BringUpTimeoutMs);
+    connect(m_bringUpTimer, &QTimer::timeout, this, &AacpSession::onBringUpTimeout);
+    m_stateTimer->setSingleShot(true);
+    connect(m_stateTimer, &QTimer::timeout, this, &AacpSession::flushState);
+
+    connect(m_mux, &AacpMux::sendRequested, this, [this](const QByteArray &packet)
+    {
+        writeToDevice(packet, "Packet from multiplexer client written: ");
+    });
+    connect(m_relayHub, &RelayHub::packetReceived, this, &AacpSession::handlePhonePacket);
+    connect(m_relayHub, &RelayHub::connectedCountChanged, this, [this](int count) { setPhoneConnected(count > 0); });
+    m_relayHub->setSnapshotProvider([this]()
+    {
+        const QList<QByteArray> state = m_relayPolicy.snapshot();
+        for (const QByteArray &packet : state)
+        {
+            m_relayPolicy.countRelayed(packet);
+        }
+        return state;
+    });
+}
+
+// Thread-safe entry points, each one hops onto the session's thread
+
+void AacpSession::connectToDevice(const QString &address)
+{
+    QMetaObject::invokeMethod(this, [this, address]() { openDeviceSocket(address); });
+}
+
+void AacpSession::disconnectDevice()
+{
+    QMetaObject::invokeMethod(this, [this]()
+    {
+        m_retryTimer->stop();
+        m_attempt = 0;
+        m_linkLostClock.invalidate();
+        closeDeviceSocket();
+        setLinkState(LinkState::Idle);
+        writeToPhone(AirPodsPackets::Connection::AIRPODS_DISCONNECTED, "AIRPODS_DISCONNECTED packet written: ");
+    });
+}
+
+void AacpSession::sendPacket(const QByteArray &packet, const QString &logMessage)
+{
+    QMetaObject::invokeMethod(this, [this, packet, logMessage]() { writeToDevice(packet, logMessage); });
+}
+
+void AacpSession::setRetryAttempts(int attempts)
+{
+    QMetaObject::invokeMethod(this, [this, attempts]() { m_retryAttempts = attempts; });
+}
+
+void AacpSession::setPipelinedBringUp(bool enabled)
+{
+    QMetaObject::invokeMethod(this, [this, enabled]() { m_pipelinedBringUpEnabled = enabled; });
+}
+
+void AacpSession::listenMultiplexer()
+{
+    QMetaObject::invokeMethod(this, [this]() { m_mux->listen(); });
+}
+
+void AacpSession::suspend()
+{
+    QMetaObject::invokeMethod(this, [this]()
+    {
+        m_retryTimer->stop();
+        m_linkLostClock.invalidate();
+        if (m_linkState == LinkState::Idle || m_linkState == LinkState::Suspended)
+        {
+            return;
+        }
+        LOG_INFO("Suspending the AirPods connection");
+        closeDeviceSocket();
+        setLinkState(LinkState::Suspended);
+    });
+}
+
+void AacpSession::resume()
+{
+    QMetaObject::invokeMethod(this, [this]()
+    {
+        if (m_linkState != LinkState::Suspended || m_deviceAddress.isEmpty())
+        {
+            return;
+        }
+        // BlueZ still holds the link, so the first attempt goes out without a delay
+        LOG_INFO("Resuming the AirPods connection");
+        m_attempt = 0;
+        m_linkLostClock.start();
+        openDeviceSocket(m_deviceAddress);
+    });
+}
+
+void AacpSession::setCrossDeviceEnabled(bool enabled)
+{
+    QMetaObject::invokeMethod(this, [this, enabled]() { m_crossDeviceEnabled = enabled; });
+}
+
+void AacpSession::setPhoneAddress(const QString &address)
+{
+    QMetaObject::invokeMethod(this, [this, address]()
+    {
+        m_phoneAddress = address;
+        updateRelayPeers();
+    });
+}
+
+void AacpSession::setRelayPeers(const QStringList &addresses)
+{
+    QMetaObject::invokeMethod(this, [this, addresses]()
+    {
+        m_relayPeers = addresses;
+        updateRelayPeers();
+    });
+}
+
+void AacpSession::listenLocalRelay(const QString &name)
+{
+    QMetaObject::invokeMethod(this, [this, name]() { m_relayHub->listenLocal(name); });
+}
+
+void AacpSession::connectToPhone()
+{
+    QMetaObject::invokeMethod(this, [this]()
+    {
+        if (m_crossDeviceEnabled)
+        {
+            m_relayHub->connectPeers();
+        }
+    });
+}
+
+void AacpSession::notifyPhone()
+{
+    QMetaObject::invokeMethod(this, [this]()
+    {
+        if (m_crossDeviceEnabled)
+        {
+            writeToPhone(AirPodsPackets::Phone::NOTIFICATION, "Sent notification packet to Android: ");
+        }
+    });
+}
+
+void AacpSession::sendDisconnectRequestToPhone()
+{
+    QMetaObject::invokeMethod(this, [this]()
+    {
+        if (m_crossDeviceEnabled)
+        {
+            writeToPhone(AirPodsPackets::Phone::DISCONNECT_REQUEST, "Sent disconnect request to Android: ");
+        }
+    });
+}
+
+// AirPods connection
+
+void AacpSession::openDeviceSocket(const QString &address)
+{
+    if (address == m_deviceAddress && (m_linkState == LinkState::Connecting || m_linkState == LinkState::Connected))
+    {
+        LOG_INFO("Already connected to the device: " << address);
+        return;
+    }
+
+    closeDeviceSocket();
+    m_retryTimer->stop();
+    if (address != m_deviceAddress)
+    {
+        // Retry state belongs to one device
+        m_attempt = 0;
+        m_linkLostClock.invalidate();
+        m_deviceAddress = address;
+    }
+    setLinkState(LinkState::Connecting);
+
+    m_socket = new QBluetoothSocket(QBluetoothServiceInfo::L2capProtocol, this);
+    connect(m_socket, &QBluetoothSocket::connected, this, [this]()
+    {
+        LOG_INFO("Connected to device, sending initial packets");
+        if (m_linkLostClock.isValid())
+        {
+            m_timeToReconnect.observe(m_linkLostClock.nsecsElapsed() / 1e6);
+            m_linkLostClock.invalidate();
+        }
+        m_attempt = 0;
+        setConnected(true);
+        setLinkState(LinkState::Connected);
+        startBringUp();
+    });
+    connect(m_socket, &QBluetoothSocket::readyRead, this, &AacpSession::onDeviceData);
+    connect(m_socket, &QBluetoothSocket::errorOccurred, this, &AacpSession::onDeviceError);
+    connect(m_socket, &QBluetoothSocket::disconnected, this, &AacpSession::onLinkLost);
+
+    m_socket->connectToService(QBluetoothAddress(address), AacpUuid);
+}
+
+void AacpSession::closeDeviceSocket()
+{
+    setConnected(false);
+    if (m_socket)
+    {
+        m_socket->disconnect(this);
+        m_socket->close();
+        m_socket->deleteLater();
+        m_socket = nullptr;
+    }
+
+    m_battery->reset();
+    m_earDetection->reset();
+    m_state = DeviceState();
+    m_lastBatteryPacket.clear();
+    m_relayPolicy.reset();
+    m_pendingFields = 0;
+    m_stateTimer->stop();
+    m_bringUpTimer->stop();
+    m_bringUpClock.invalidate();
+}
+
+void AacpSession::onDeviceData()
+{
+    // Parse and relay straight from the socket, no extra trip through the event loop
+    QByteArray data = m_socket->readAll();
+    parseData(data);
+    relayPacketToPhone(data);
+    m_mux->dispatch(data);
+}
+
+void AacpSession::onDeviceError()
+{
+    LOG_ERROR("Socket error: " << m_socket->error() << ", " << m_socket->errorString());
+    onLinkLost();
+}
+
+void AacpSession::onLinkLost()
+{
+    // An error is usually followed by disconnected(), only the first one counts
+    if (m_linkState != LinkState::Connecting && m_linkState != LinkState::Connected)
+    {
+        return;
+    }
+    if (m_linkState == LinkState::Connected)
+    {
+        m_linkLostClock.start();
+        if (m_pipelined && m_bringUpTimer->isActive())
+        {
+            // Dropped before the features were acknowledged, the firmware may not take the pipelined requests
+            LOG_WARN("Link lost during pipelined bring-up, using the serial handshake for " << m_deviceAddress);
+            m_serialBringUpDevices.insert(m_deviceAddress);
+            m_bringUpFallbacks.inc();
+        }
+    }
+    setConnected(false);
+    scheduleReconnect();
+}
+
+void AacpSession::scheduleReconnect()
+{
+    if (m_attempt >= m_retryAttempts)
+    {
+        LOG_ERROR("Failed to connect after " << m_retryAttempts << " attempts");
+        m_attempt = 0;
+        m_linkLostClock.invalidate();
+        setLinkState(LinkState::Idle);
+        return;
+    }
+
+    ++m_attempt;
+    m_reconnectAttempts.inc();
+    const int delay = backoffDelay(m_attempt);
+    LOG_INFO("Retrying connection in " << delay << " ms (attempt " << m_attempt << " of " << m_retryAttempts << ")");
+    setLinkState(LinkState::WaitingToRetry);
+    m_retryTimer->start(delay);
+}
+
+void AacpSession::startBringUp()
+{
+    m_pipelined = m_pipelinedBringUpEnabled && !m_serialBringUpDevices.contains(m_deviceAddress);
+    m_bringUpClock.start();
+    writeToDevice(AirPodsPackets::Connection::HANDSHAKE, "Handshake packet written: ");
+    if (m_pipelined)
+    {
+        // The acknowledgements are checked as they arrive, the timer catches a device that ignores them
+        writeToDevice(AirPodsPackets::Connection::SET_SPECIFIC_FEATURES, "Set specific features packet written: ");
+        writeToDevice(AirPodsPackets::Connection::REQUEST_NOTIFICATIONS, "Request notifications packet written: ");
+        m_bringUpTimer->start();
+    }
+}
+
+void AacpSession::onBringUpTimeout()
+{
+    if (!m_pipelined || !m_bringUpClock.isValid())
+    {
+        return;
+    }
+    LOG_WARN("No answer to the pipelined bring-up after " << BringUpTimeoutMs << " ms, falling back to the serial handshake");
+    m_serialBringUpDevices.insert(m_deviceAddress);
+    m_bringUpFallbacks.inc();
+    m_pipelined = false;
+    writeToDevice(AirPodsPackets::Connection::HANDSHAKE, "Handshake packet written: ");
+}
+
+int AacpSession::backoffDelay(int attempt) const
+{
+    // Half of the doubled delay is fixed, the other half random, so several
+    // clients coming back at once do not retry in lockstep
+    const int ceiling = std::min(RetryMaxDelayMs, RetryBaseDelayMs << std::min(attempt - 1, 16));
+    return ceiling / 2 + QRandomGenerator::global()->bounded(ceiling / 2 + 1);
+}
+
+void AacpSession::setLinkState(LinkState state)
+{
+    if (m_linkState != state)
+    {
+        m_linkState = state;
+        emit linkStateChanged(state);
+    }
+}
+
+bool AacpSession::writeToDevice(const QByteArray &packet, const QString &logMessage)
+{
+    if (m_socket && m_socket->isOpen())
+    {
+        m_socket->write(packet);
+        countPacket(m_packetsOut, "out", packet);
+        LOG_DEBUG(logMessage << packet.toHex());
+        return true;
+    }
+
+    LOG_ERROR("Socket is not open, cannot write packet");
+    return false;
+}
+
+void AacpSession::parseData(const QByteArray &data)
+{
+    TRACE("Received: {}", data);
+    countPacket(m_packetsIn, "in", data);
+
+    if (data.startsWith(AirPodsPackets::Parse::HANDSHAKE_ACK))
+    {
+        if (!m_pipelined)
+        {
+            writeToDevice(AirPodsPackets::Connection::SET_SPECIFIC_FEATURES, "Set specific features packet written: ");
+        }
+    }
+    else if (data.startsWith(AirPodsPackets::Parse::FEATURES_ACK))
+    {
+        if (m_pipelined)
+        {
+            // Features were taken, so the notification request sent with them was too
+            m_bringUpTimer->stop();
+        }
+        else
+        {
+            writeToDevice(AirPodsPackets::Connection::REQUEST_NOTIFICATIONS, "Request notifications packet written: ");
+        }
+
+        QTimer::singleShot(2000, this, [this]()
+        {
+            if (m_lastBatteryPacket.isEmpty())
+            {
+                writeToDevice(AirPodsPackets::Connection::REQUEST_NOTIFICATIONS, "Request notifications packet written: ");
+            }
+        });
+    }
+    // Magic Cloud Keys Response
+    else if (data.startsWith(AirPodsPackets::MagicPairing::MAGIC_CLOUD_KEYS_HEADER))
+    {
+        auto keys = AirPodsPackets::MagicPairing::parseMagicCloudKeysPacket(data);
+        LOG_INFO("Received Magic Cloud Keys:");
+        LOG_INFO("MagicAccIRK: " << keys.magicAccIRK.toHex());
+        LOG_INFO("MagicAccEncKey: " << keys.magicAccEncKey.toHex());
+        emit magicKeysReceived(keys.magicAccIRK, keys.magicAccEncKey);
+    }
+    // Get CA state
+    else if (data.startsWith(AirPodsPackets::ConversationalAwareness::HEADER))
+    {
+        if (auto result = AirPodsPackets::ConversationalAwareness::parseState(data))
+        {
+            m_state.conversationalAwareness = result.value();
+            LOG_INFO("Conversational awareness state received: " << m_state.conversationalAwareness);
+            publishState(DeviceState::ConversationalAwarenessField);
+        }
+        else
+        {
+            m_parseErrors.inc();
+        }
+    }
+    // Noise Control Mode
+    else if (data.size() == 11 && data.startsWith(AirPodsPackets::NoiseControl::HEADER))
+    {
+        if (auto value = AirPodsPackets::NoiseControl::parseMode(data))
+        {
+            m_state.noiseControlMode = value.value();
+            LOG_INFO("Noise control mode received: " << m_state.noiseControlMode);
+            publishState(DeviceState::NoiseControlField);
+        }
+        else
+        {
+            m_parseErrors.inc();
+        }
+    }
+    // Ear Detection
+    else if (data.size() == 8 && data.startsWith(AirPodsPackets::Parse::EAR_DETECTION))
+    {
+        if (!m_earDetection->parseData(data))
+        {
+            m_parseErrors.inc();
+        }
+        m_state.primaryEar = m_earDetection->getprimaryStatus();
+        m_state.secondaryEar = m_earDetection->getsecondaryStatus();
+        emit earDetectionChanged(m_state.primaryEar, m_state.secondaryEar);
+        publishState(DeviceState::EarDetectionField);
+    }
+    // Battery Status
+    else if (data.size() == 22 && data.startsWith(AirPodsPackets::Parse::BATTERY_STATUS))
+    {
+        m_lastBatteryPacket = data;
+        if (!m_battery->parsePacket(data))
+        {
+            m_parseErrors.inc();
+        }
+        m_state.battery = m_battery->snapshot();
+        LOG_INFO("Battery status: Left: " << m_battery->getLeftPodLevel() << "%, Right: "
+                 << m_battery->getRightPodLevel() << "%, Case: " << m_battery->getCaseLevel() << "%");
+        publishState(DeviceState::BatteryField);
+    }
+    // Conversational Awareness Data
+    else if (data.size() == 10 && data.startsWith(AirPodsPackets::ConversationalAwareness::DATA_HEADER))
+    {
+        LOG_INFO("Received conversational awareness data");
+        emit conversationalAwarenessData(data);
+    }
+    else if (data.startsWith(AirPodsPackets::Parse::METADATA))
+    {
+        parseMetadata(data);
+        writeToDevice(AirPodsPackets::MagicPairing::REQUEST_MAGIC_CLOUD_KEYS, "Magic Pairing packet written: ");
+    }
+    else if (data.startsWith(AirPodsPackets::OneBudANCMode::HEADER))
+    {
+        if (auto value = AirPodsPackets::OneBudANCMode::parseState(data))
+        {
+            m_state.oneBudANCMode = value.value();
+            LOG_INFO("One Bud ANC mode received: " << m_state.oneBudANCMode);
+            publishState(DeviceState::OneBudANCField);
+        }
+        else
+        {
+            m_parseErrors.inc();
+        }
+    }
+    else
+    {
+        m_unrecognizedPackets.inc();
+        TRACE("Unrecognized packet format: {}", data);
+    }
+}
+
+void AacpSession::parseMetadata(const QByteArray &data)
+{
+    int pos = AirPodsPackets::Parse::METADATA.size(); // Start after the header
+
+    // Check if there is enough data to skip the initial bytes (based on example structure)
+    if (data.size() < pos + 6)
+    {
+        LOG_ERROR("Metadata packet too short to parse initial bytes");
+        m_parseErrors.inc();
+        return;
+    }
+    pos += 6; // Skip 6 bytes after the header as per example structure
+
+    auto extractString = [&data, &pos]() -> QString
+    {
+        if (pos >= data.size())
+        {
+            return QString();
+        }
+        int start = pos;
+        while (pos < data.size() && data.at(pos) != '\0')
+        {
+            ++pos;
+        }
+        QString str = QString::fromUtf8(data.mid(start, pos - start));
+        if (pos < data.size())
+        {
+            ++pos; // Move past the null terminator
+        }
+        return str;
+    };
+
+    QString deviceName = extractString();
+    QString modelNumber = extractString();
+    QString manufacturer = extractString();
+
+    LOG_INFO("Parsed AirPods metadata:");
+    LOG_INFO("Device Name: " << deviceName);
+    LOG_INFO("Model Number: " << modelNumber);
+    LOG_INFO("Manufacturer: " << manufacturer);
+    emit metadataReceived(deviceName, modelNumber, manufacturer);
+}
+
+// Relay to the phone and other peers
+
+void AacpSession::updateRelayPeers()
+{
+    // The phone keeps its connection when only the other peers change, and the other way around
+    QStringList addresses = m_relayPeers;
+    addresses.prepend(m_phoneAddress);
+    m_relayHub->setBluetoothPeers(addresses);
+}
+
+void AacpSession::writeToPhone(const QByteArray &packet, const QString &logMessage)
+{
+    if (m_relayHub->connectedCount() > 0)
+    {
+        m_relayHub->broadcast(packet);
+        LOG_DEBUG(logMessage << packet.toHex());
+    }
+}
+
+void AacpSession::relayPacketToPhone(const QByteArray &packet)
+{
+    // Runs even without a peer, so the state snapshot for the next one stays current
+    if (!m_relayPolicy.shouldRelay(packet) || !m_crossDeviceEnabled)
+    {
+        return;
+    }
+    const int peers = m_relayHub->relay(packet);
+    m_relayPolicy.countRelayed(packet, peers);
+    if (m_relayHub->hasUnconnectedBluetoothPeer())
+    {
+        m_relayHub->connectPeers();
+        if (peers == 0)
+        {
+            LOG_WARN("No relay peer is connected, cannot relay packet");
+        }
+    }
+}
+
+void AacpSession::handlePhonePacket(int peer, const QByteArray &packet)
+{
+    if (packet.startsWith(AirPodsPackets::Phone::NOTIFICATION))
+    {
+        // Hot path, traced instead of going through writeToDevice()'s debug log
+        if (m_socket && m_socket->isOpen())
+        {
+            const QByteArray payload = QByteArray::fromRawData(packet.constData() + 4, packet.size() - 4);
+            m_socket->write(payload);
+            countPacket(m_packetsOut, "out", payload);
+            TRACE("Relayed packet to AirPods: {}", payload);
+        }
+        else
+        {
+            LOG_ERROR("Socket is not open, cannot relay packet from phone");
+        }
+    }
+    else if (packet.startsWith(AirPodsPackets::Phone::CONNECTED))
+    {
+        LOG_INFO("AirPods connected to the phone");
+    }
+    else if (packet.startsWith(AirPodsPackets::Phone::DISCONNECTED))
+    {
+        LOG_INFO("AirPods disconnected from the phone");
+    }
+    else if (packet.startsWith(AirPodsPackets::Phone::STATUS_REQUEST))
+    {
+        LOG_INFO("Connection status request received");
+        QByteArray response = isConnected() ? AirPodsPackets::Phone::CONNECTED
+                                            : AirPodsPackets::Phone::DISCONNECTED;
+        m_relayHub->send(peer, response);
+        LOG_DEBUG("Sent connection status response: " << response.toHex());
+    }
+    else if (packet.startsWith(AirPodsPackets::Phone::DISCONNECT_REQUEST))
+    {
+        LOG_INFO("Disconnect request received");
+        if (m_socket && m_socket->isOpen())
+        {
+            // Handed over on purpose, so the link is not retried
+            m_retryTimer->stop();
+            m_attempt = 0;
+            m_linkLostClock.invalidate();
+            setLinkState(LinkState::Idle);
+            m_socket->close();
+            setConnected(false);
+            LOG_INFO("Disconnected from AirPods");
+            emit deviceReleased(m_deviceAddress);
+        }
+    }
+    else
+    {
+        writeToDevice(packet, "Relayed packet to AirPods: ");
+    }
+}
+
+// State handoff to the GUI thread
+
+void AacpSession::setConnected(bool connected)
+{
+    m_connected.store(connected, std::memory_order_release);
+    m_connectedGauge.set(connected ? 1 : 0);
+    m_mux->setLinkUp(connected);
+}
+
+void AacpSession::setPhoneConnected(bool connected)
+{
+    m_phoneConnected.store(connected, std::memory_order_release);
+    m_phoneConnectedGauge.set(connected ? 1 : 0);
+}
+
+void AacpSession::countPacket(OpcodeCounters &counters, const char *direction, const QByteArray &packet)
+{
+    // AACP packets carry their opcode after the 4-byte header
+    const int opcode = packet.size() > 4 ? quint8(packet[4]) : 0;
+    Metrics::Counter *&counter = counters[opcode];
+    if (!counter)
+    {
+        counter = &Metrics::counter("librepods_aacp_packets_total", "AACP packets exchanged with the AirPods, by opcode",
+                                    {{"direction", direction}, {"opcode", QString::asprintf("0x%02x", opcode)}});
+    }
+    counter->inc();
+}
+
+void AacpSession::publishState(int fields)
+{
+    if (m_bringUpClock.isValid())
+    {
+        const double elapsed = m_bringUpClock.nsecsElapsed() / 1e6;
+        m_bringUpClock.invalidate();
+        m_bringUpTimer->stop();
+        (m_pipelined ? m_firstStatusPipelined : m_firstStatusSerial).observe(elapsed);
+        LOG_INFO("First status " << elapsed << " ms after connecting (" << (m_pipelined ? "pipelined" : "serial") << " bring-up)");
+    }
+
+    m_pendingFields |= fields;
+    if (m_stateTimer->isActive())
+    {
+        return; // Folded into the snapshot that is already scheduled
+    }
+
+    qint64 wait = m_lastPublish.isValid() ? StateIntervalMs - m_lastPublish.elapsed() : 0;
+    if (wait <= 0)
+    {
+        flushState();
+    }
+    else
+    {
+        m_stateTimer->start(static_cast<int>(wait));
+    }
+}
+
+void AacpSession::flushState()
+{
+    if (m_pendingFields == 0)
+    {
+        return;
+    }
+
+    DeviceState state = m_state;
+    state.changed = m_pendingFields;
+    m_pendingFields = 0;
+    m_lastPublish.start();
+    emit stateChanged(state);
+}
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <QObject>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QMetaType>
+#include <QSet>
+#include <QStringList>
+#include <array>
+#include <atomic>
+
+#include "battery.hpp"
+#include "eardetection.hpp"
+#include "enums.h"
+#include "relaypolicy.h"
+
+class QBluetoothSocket;
+class AacpMux;
+class QTimer;
+class RelayHub;
+
+namespace Metrics
+{
+    class Counter;
+    class Gauge;
+    class Histogram;
+}
+
+// The AACP connection to the AirPods and the relay to its peers. Lives on its
+// own I/O thread: framing, parsing and relaying never wait for the GUI thread,
+// which only receives immutable DeviceState snapshots (at a bounded rate) and
+// a few discrete events. The public methods may be called from any thread.
+class AacpSession : public QObject
+{
+    Q_OBJECT
+public:
+    struct DeviceState
+    {
+        enum Field
+        {
+            BatteryField = 0x01,
+            EarDetectionField = 0x02,
+            NoiseControlField = 0x04,
+            ConversationalAwarenessField = 0x08,
+            OneBudANCField = 0x10,
+        };
+
+        int changed = 0; // Fields that changed since the previous snapshot
+        Battery::Snapshot battery;
+        EarDetection::EarDetectionStatus primaryEar = EarDetection::EarDetectionStatus::Disconnected;
+        EarDetection::EarDetectionStatus secondaryEar = EarDetection::EarDetectionStatus::Disconnected;
+        AirpodsTrayApp::Enums::NoiseControlMode noiseControlMode = AirpodsTrayApp::Enums::NoiseControlMode::Off;
+        bool conversationalAwareness = false;
+        bool oneBudANCMode = false;
+    };
+
+    // Lifecycle of the AirPods link. A lost link is retried with exponential
+    // backoff and jitter until retryAttempts is used up; an explicit disconnect
+    // or a suspend cancels any pending retry.
+    enum class LinkState
+    {
+        Idle,
+        Connecting,
+        Connected,
+        WaitingToRetry,
+        Suspended,
+    };
+    Q_ENUM(LinkState)
+
+    explicit AacpSession(QObject *parent = nullptr);
+
+    bool isConnected() const { return m_connected.load(std::memory_order_acquire); }
+    // Whether any relay peer, the phone or another one, is connected
+    bool isPhoneConnected() const { return m_phoneConnected.load(std::memory_order_acquire); }
+
+    void connectToDevice(const QString &address);
+    void disconnectDevice();
+    void sendPacket(const QByteArray &packet, const QString &logMessage);
+    void setRetryAttempts(int attempts);
+    // Sends the handshake, feature and notification requests back to back
+    // instead of waiting for each acknowledgement. Devices that do not answer
+    // that way fall back to the serial bring-up for the rest of the run.
+    void setPipelinedBringUp(bool enabled);
+    // Lets local tools share this connection, see AacpMux
+    void listenMultiplexer();
+    // Around system sleep: drop the link and stop retrying, then on wake
+    // reconnect at once without waiting out a backoff delay
+    void suspend();
+    void resume();
+
+    void setCrossDeviceEnabled(bool enabled);
+    // Drops the current phone connection, connectToPhone() opens a new one
+    void setPhoneAddress(const QString &address);
+    // Further Bluetooth peers that get the relay alongside the phone
+    void setRelayPeers(const QStringList &addresses);
+    // Accepts relay peers on a local socket as well
+    void listenLocalRelay(const QString &name);
+    // Opens every relay peer that is not connected yet
+    void connectToPhone();
+    void notifyPhone();
+    void sendDisconnectRequestToPhone();
+
+signals:
+    void linkStateChanged(AacpSession::LinkState state);
+    void stateChanged(const AacpSession::DeviceState &state);
+    // Delivered right away, these drive media actions
+    void earDetectionChanged(EarDetection::EarDetectionStatus primary, EarDetection::EarDetectionStatus secondary);
+    void conversationalAwarenessData(const QByteArray &data);
+    void metadataReceived(const QString &deviceName, const QString &modelNumber, const QString &manufacturer);
+    void magicKeysReceived(const QByteArray &irk, const QByteArray &encKey);
+    // The phone took the AirPods over, the Bluetooth link should be dropped too
+    void deviceReleased(const QString &address);
+
+private:
+    // Everything below runs on the session's thread only
+    void openDeviceSocket(const QString &address);
+    void closeDeviceSocket();
+    void onDeviceData();
+    void onDeviceError();
+    void onLinkLost();
+    void startBringUp();
+    void onBringUpTimeout();
+    void scheduleReconnect();
+    int backoffDelay(int attempt) const;
+    void setLinkState(LinkState state);
+    bool writeToDevice(const QByteArray &packet, const QString &logMessage);
+    void parseData(const QByteArray &data);
+    void parseMetadata(const QByteArray &data);
+
+    void updateRelayPeers();
+    void writeToPhone(const QByteArray &packet, const QString &logMessage);
+    void relayPacketToPhone(const QByteArray &packet);
+    void handlePhonePacket(int peer, const QByteArray &packet);
+
+    void publishState(int fields);
+    void flushState();
+
+    void setConnected(bool connected);
+    void setPhoneConnected(bool connected);
+
+    // Packets are counted per opcode, the counters are looked up on first use
+    using OpcodeCounters = std::array<Metrics::Counter *, 256>;
+    void countPacket(OpcodeCounters &counters, const char *direction, const QByteArray &packet);
+
+    static constexpr int StateIntervalMs = 33;
+    static constexpr int RetryBaseDelayMs = 250;
+    static constexpr int RetryMaxDelayMs = 30000;
+    static constexpr int BringUpTimeoutMs = 1500;
+
+    QBluetoothSocket *m_socket = nullptr;
+    RelayHub *m_relayHub;
+    AacpMux *m_mux;
+    QString m_deviceAddress;
+    QString m_phoneAddress;
+    QStringList m_relayPeers;
+    std::atomic<bool> m_connected{false};
+    std::atomic<bool> m_phoneConnected{false};
+    bool m_crossDeviceEnabled = false;
+    int m_retryAttempts = 3;
+    LinkState m_linkState = LinkState::Idle;
+    int m_attempt = 0;
+    QTimer *m_retryTimer;
+    QElapsedTimer m_linkLostClock; // Valid while a lost link is being brought back
+
+    bool m_pipelinedBringUpEnabled = true;
+    bool m_pipelined = false; // How the current connection is being brought up
+    QSet<QString> m_serialBringUpDevices;
+    QTimer *m_bringUpTimer;
+    QElapsedTimer m_bringUpClock; // Valid until the first status packet arrives
+
+    Battery *m_battery;
+    EarDetection *m_earDetection;
+    DeviceState m_state;
+    QByteArray m_lastBatteryPacket;
+    RelayPolicy m_relayPolicy;
+
+    int m_pendingFields = 0;
+    QTimer *m_stateTimer;
+    QElapsedTimer m_lastPublish;
+
+    OpcodeCounters m_packetsIn{};
+    OpcodeCounters m_packetsOut{};
+    Metrics::Counter &m_parseErrors;
+    Metrics::Counter &m_unrecognizedPackets;
+    Metrics::Counter &m_reconnectAttempts;
+    Metrics::Histogram &m_timeToReconnect;
+    Metrics::Histogram &m_firstStatusPipelined;
+    Metrics::Histogram &m_firstStatusSerial;
+    Metrics::Counter &m_bringUpFallbacks;
+    Metrics::Gauge &m_connectedGauge;
+    Metrics::Gauge &m_phoneConnectedGauge;
+};
+
+Q_DECLARE_METATYPE(AacpSession::DeviceState)
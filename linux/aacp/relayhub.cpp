@@ -0,0 +1,357 @@
+#include "relayhub.h"
+#include "airpods_packets.h"
+#include "logger.h"
+#include "metrics.h"
+#include "relaywriter.h"
+#include "trace.h"
+
+#include <QBluetoothAddress>
+#include <QBluetoothSocket>
+#include <QBluetoothUuid>
+#include <QLocalServer>
+#include <QLocalSocket>
+
+namespace
+{
+    const QBluetoothUuid PhoneRelayUuid("1abbb9a4-10e4-4000-a75c-8953c5471342");
+}
+
+RelayHub::RelayHub(QObject *parent)
+    : QObject(parent),
+      m_connectedGauge(Metrics::gauge("librepods_relay_peers_connected", "Relay peers currently connected"))
+{
+}
+
+RelayHub::~RelayHub()
+{
+    // Writers and sockets are children, only the bookkeeping is ours
+    qDeleteAll(m_peers);
+}
+
+void RelayHub::setBluetoothPeers(const QStringList &addresses)
+{
+    QStringList wanted;
+    for (const QString &address : addresses)
+    {
+        const QString normalized = address.trimmed().toUpper();
+        if (!normalized.isEmpty() && !wanted.contains(normalized))
+        {
+            wanted.append(normalized);
+        }
+    }
+
+    const QStringList current = m_bluetoothPeers.keys();
+    for (const QString &address : current)
+    {
+        if (!wanted.contains(address))
+        {
+            LOG_INFO("Removing relay peer " << address);
+            removePeer(m_bluetoothPeers.take(address));
+        }
+    }
+    for (const QString &address : wanted)
+    {
+        if (!m_bluetoothPeers.contains(address))
+        {
+            m_bluetoothPeers.insert(address, addPeer(address, false).id);
+        }
+    }
+}
+
+bool RelayHub::listenLocal(const QString &name)
+{
+    if (!m_localServer)
+    {
+        m_localServer = new QLocalServer(this);
+        // Peers receive the AirPods state and can send control packets, so only this user may connect
+        m_localServer->setSocketOptions(QLocalServer::UserAccessOption);
+        connect(m_localServer, &QLocalServer::newConnection, this, [this]()
+        {
+            while (QLocalSocket *socket = m_localServer->nextPendingConnection())
+            {
+                Peer &peer = addPeer(QString(), true);
+                peer.device = socket;
+                socket->setParent(this);
+                Peer *p = &peer;
+                connect(socket, &QLocalSocket::readyRead, this, [this, p]() { onPeerData(*p); });
+                connect(socket, &QLocalSocket::bytesWritten, this, [this, p]() { onBytesWritten(*p); });
+                connect(socket, &QLocalSocket::disconnected, this, [this, p]()
+                {
+                    LOG_INFO("Local relay peer " << p->id << " disconnected");
+                    setPeerConnected(*p, false);
+                    // Can fire from inside a write, the peer is only dropped once that has returned
+                    QMetaObject::invokeMethod(this, [this, id = p->id]() { removePeer(id); }, Qt::QueuedConnection);
+                });
+                LOG_INFO("Local relay peer " << peer.id << " connected");
+                setPeerConnected(peer, true);
+            }
+        });
+    }
+    m_localServer->close();
+    QLocalServer::removeServer(name);
+    if (!m_localServer->listen(name))
+    {
+        LOG_ERROR("Unable to listen for local relay peers on " << name << ": " << m_localServer->errorString());
+        return false;
+    }
+    LOG_INFO("Listening for local relay peers on " << m_localServer->fullServerName());
+    return true;
+}
+
+void RelayHub::connectPeers()
+{
+    for (int id : std::as_const(m_bluetoothPeers))
+    {
+        Peer &peer = *m_peers.value(id);
+        auto *socket = static_cast<QBluetoothSocket *>(peer.device);
+        if (!socket || socket->state() == QBluetoothSocket::SocketState::UnconnectedState)
+        {
+            openBluetoothPeer(peer);
+        }
+    }
+}
+
+bool RelayHub::hasUnconnectedBluetoothPeer() const
+{
+    for (int id : m_bluetoothPeers)
+    {
+        if (!m_peers.value(id)->connected)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+int RelayHub::relay(const QByteArray &packet)
+{
+    int relayed = 0;
+    for (Peer *peer : std::as_const(m_peers))
+    {
+        if (peer->connected && admit(*peer))
+        {
+            // The payload is the buffer read from the AirPods, only the header differs per peer
+            peer->writer->send(peer->local ? lengthPrefix(4 + packet.size()) + AirPodsPackets::Phone::NOTIFICATION
+                                           : AirPodsPackets::Phone::NOTIFICATION,
+                               packet);
+            ++relayed;
+        }
+    }
+    if (relayed > 0)
+    {
+        TRACE("Relayed packet to {} peers: {}", relayed, packet);
+    }
+    return relayed;
+}
+
+void RelayHub::broadcast(const QByteArray &packet)
+{
+    for (Peer *peer : std::as_const(m_peers))
+    {
+        if (peer->connected)
+        {
+            send(peer->id, packet);
+        }
+    }
+}
+
+void RelayHub::send(int id, const QByteArray &packet)
+{
+    Peer *peer = m_peers.value(id);
+    if (!peer || !peer->connected)
+    {
+        return;
+    }
+    // Control packets go out right away, behind anything the peer already has queued
+    peer->writer->send(peer->local ? lengthPrefix(packet.size()) : QByteArray(), packet);
+    peer->writer->flush();
+}
+
+RelayHub::Peer &RelayHub::addPeer(const QString &name, bool local)
+{
+    auto *peer = new Peer;
+    peer->id = m_nextId++;
+    // Local peers have no address, the id keeps their metrics apart
+    peer->name = local ? QStringLiteral("local-%1").arg(peer->id) : name;
+    peer->local = local;
+    peer->writer = new RelayWriter(peer->name, this);
+    peer->dropped = &Metrics::counter("librepods_relay_dropped_total",
+                                      "AirPods packets not sent to a peer because its backlog was full", {{"peer", peer->name}});
+    m_peers.insert(peer->id, peer);
+    return *peer;
+}
+
+void RelayHub::removePeer(int id)
+{
+    Peer *peer = m_peers.take(id);
+    if (!peer)
+    {
+        return;
+    }
+    peer->writer->setDevice(nullptr);
+    peer->writer->deleteLater();
+    if (peer->device)
+    {
+        peer->device->disconnect(this);
+        peer->device->close();
+        peer->device->deleteLater();
+    }
+    delete peer;
+    updateConnectedCount();
+}
+
+void RelayHub::openBluetoothPeer(Peer &peer)
+{
+    if (peer.device)
+    {
+        peer.writer->setDevice(nullptr);
+        peer.device->disconnect(this);
+        peer.device->deleteLater();
+    }
+
+    auto *socket = new QBluetoothSocket(QBluetoothServiceInfo::L2capProtocol, this);
+    peer.device = socket;
+    Peer *p = &peer;
+    connect(socket, &QBluetoothSocket::connected, this, [this, p, socket]()
+    {
+        LOG_INFO("Connected to relay peer " << p->name);
+        p->writer->setDevice(socket, socket->socketDescriptor());
+        setPeerConnected(*p, true);
+    });
+    connect(socket, &QBluetoothSocket::disconnected, this, [this, p]()
+    {
+        LOG_INFO("Relay peer " << p->name << " disconnected");
+        setPeerConnected(*p, false);
+    });
+    connect(socket, &QBluetoothSocket::errorOccurred, this, [this, p, socket](QBluetoothSocket::SocketError error)
+    {
+        LOG_ERROR("Relay peer " << p->name << " socket error: " << error << ", " << socket->errorString());
+        setPeerConnected(*p, false);
+    });
+    connect(socket, &QBluetoothSocket::readyRead, this, [this, p]() { onPeerData(*p); });
+    connect(socket, &QBluetoothSocket::bytesWritten, this, [this, p]() { onBytesWritten(*p); });
+
+    socket->connectToService(QBluetoothAddress(peer.name), PhoneRelayUuid);
+}
+
+void RelayHub::setPeerConnected(Peer &peer, bool connected)
+{
+    if (peer.connected == connected)
+    {
+        return;
+    }
+    peer.connected = connected;
+    peer.lagging = false;
+    peer.readBuffer.clear();
+    if (connected)
+    {
+        if (peer.local)
+        {
+            peer.writer->setDevice(peer.device);
+        }
+        sendSnapshot(peer);
+    }
+    else
+    {
+        peer.writer->setDevice(nullptr);
+    }
+    updateConnectedCount();
+}
+
+void RelayHub::onPeerData(Peer &peer)
+{
+    if (!peer.local)
+    {
+        // L2CAP keeps packet boundaries, one read is one packet
+        const QByteArray data = peer.device->readAll();
+        TRACE("Data received from relay peer {}: {}", peer.id, data);
+        emit packetReceived(peer.id, data);
+        return;
+    }
+
+    peer.readBuffer += peer.device->readAll();
+    const int id = peer.id;
+    int offset = 0;
+    while (peer.readBuffer.size() - offset >= 2)
+    {
+        const int size = (quint8(peer.readBuffer[offset]) << 8) | quint8(peer.readBuffer[offset + 1]);
+        if (peer.readBuffer.size() - offset - 2 < size)
+        {
+            break;
+        }
+        const QByteArray packet = peer.readBuffer.mid(offset + 2, size);
+        offset += 2 + size;
+        TRACE("Data received from local relay peer {}: {}", id, packet);
+        emit packetReceived(id, packet);
+        if (!m_peers.contains(id))
+        {
+            return; // Dropped while handling the packet
+        }
+    }
+    peer.readBuffer.remove(0, offset);
+}
+
+void RelayHub::onBytesWritten(Peer &peer)
+{
+    if (peer.lagging && peer.device->bytesToWrite() < ResumeBacklog)
+    {
+        // Whatever was dropped meanwhile is covered by the snapshot
+        LOG_INFO("Relay peer " << peer.name << " caught up, resuming");
+        peer.lagging = false;
+        sendSnapshot(peer);
+    }
+}
+
+bool RelayHub::admit(Peer &peer)
+{
+    if (!peer.lagging && peer.device->bytesToWrite() > MaxBacklog)
+    {
+        LOG_WARN("Relay peer " << peer.name << " is not keeping up, pausing it");
+        peer.lagging = true;
+    }
+    if (peer.lagging)
+    {
+        peer.dropped->inc();
+        return false;
+    }
+    return true;
+}
+
+void RelayHub::sendSnapshot(Peer &peer)
+{
+    if (!m_snapshot)
+    {
+        return;
+    }
+    // Brought up to date in one batch instead of replaying the traffic it missed
+    const QList<QByteArray> state = m_snapshot();
+    for (const QByteArray &packet : state)
+    {
+        peer.writer->send(peer.local ? lengthPrefix(4 + packet.size()) + AirPodsPackets::Phone::NOTIFICATION
+                                     : AirPodsPackets::Phone::NOTIFICATION,
+                          packet);
+    }
+    peer.writer->flush();
+    LOG_INFO("Sent current state to relay peer " << peer.name << " in " << state.size() << " packets");
+}
+
+void RelayHub::updateConnectedCount()
+{
+    int count = 0;
+    for (const Peer *peer : std::as_const(m_peers))
+    {
+        count += peer->connected ? 1 : 0;
+    }
+    if (count != m_connectedCount)
+    {
+        m_connectedCount = count;
+        m_connectedGauge.set(count);
+        emit connectedCountChanged(count);
+    }
+}
+
+QByteArray RelayHub::lengthPrefix(int size)
+{
+    const char prefix[2] = {char((size >> 8) & 0xff), char(size & 0xff)};
+    return QByteArray(prefix, 2);
+}
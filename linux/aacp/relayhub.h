@@ -0,0 +1,93 @@
+#pragma once
+
+#include <QObject>
+#include <QByteArray>
+#include <QHash>
+#include <QStringList>
+#include <functional>
+
+class QIODevice;
+class QLocalServer;
+class RelayWriter;
+
+namespace Metrics
+{
+    class Counter;
+    class Gauge;
+}
+
+// Fans AirPods state out to any number of peers: phones and other desktops
+// over L2CAP, and local clients on a QLocalServer (for machines without a
+// second radio, and for simulating peers). Every peer has its own writer and
+// queue. A peer whose backlog passes MaxBacklog stops getting packets until
+// it has drained below ResumeBacklog and is then resynced with a snapshot,
+// so a slow peer costs memory up to its limit but never holds up the
+// AirPods session or the other peers.
+//
+// Local peers use the same packets as L2CAP ones, each prefixed with its
+// length as a big-endian 16-bit value, since a local socket is a stream.
+class RelayHub : public QObject
+{
+    Q_OBJECT
+public:
+    explicit RelayHub(QObject *parent = nullptr);
+    ~RelayHub() override;
+
+    // Peers keep their connection if their address stays in the list
+    void setBluetoothPeers(const QStringList &addresses);
+    bool listenLocal(const QString &name);
+    // Opens every Bluetooth peer that is not connected or connecting
+    void connectPeers();
+    // Packets that bring a newly connected or recovered peer up to date
+    void setSnapshotProvider(std::function<QList<QByteArray>()> provider) { m_snapshot = std::move(provider); }
+
+    int connectedCount() const { return m_connectedCount; }
+    bool hasUnconnectedBluetoothPeer() const;
+
+    // An AirPods packet, sent with the relay header. Returns the number of peers that took it.
+    int relay(const QByteArray &packet);
+    // A control packet, written as is
+    void broadcast(const QByteArray &packet);
+    void send(int peer, const QByteArray &packet);
+
+signals:
+    void packetReceived(int peer, const QByteArray &packet);
+    void connectedCountChanged(int count);
+
+private:
+    struct Peer
+    {
+        int id = 0;
+        QString name;
+        bool local = false;
+        QIODevice *device = nullptr;
+        RelayWriter *writer = nullptr;
+        bool connected = false;
+        bool lagging = false;
+        QByteArray readBuffer;
+        Metrics::Counter *dropped = nullptr;
+    };
+
+    // name is the Bluetooth address, local peers are named after their id
+    Peer &addPeer(const QString &name, bool local);
+    void removePeer(int id);
+    void openBluetoothPeer(Peer &peer);
+    void setPeerConnected(Peer &peer, bool connected);
+    void onPeerData(Peer &peer);
+    void onBytesWritten(Peer &peer);
+    bool admit(Peer &peer);
+    void sendSnapshot(Peer &peer);
+    void updateConnectedCount();
+    static QByteArray lengthPrefix(int size);
+
+    static constexpr qint64 MaxBacklog = 64 * 1024;
+    static constexpr qint64 ResumeBacklog = 8 * 1024;
+
+    QHash<int, Peer *> m_peers;
+    QHash<QString, int> m_bluetoothPeers; // Address to peer id
+    QLocalServer *m_localServer = nullptr;
+    int m_nextId = 1;
+    int m_connectedCount = 0;
+    std::function<QList<QByteArray>()> m_snapshot;
+    Metrics::Gauge &m_connectedGauge;
+};
@@ -0,0 +1,102 @@
+#include "relaypolicy.h"
+#include "metrics.h"
+
+namespace
+{
+    // AACP opcodes, the byte after the 4-byte header
+    constexpr int BatteryOpcode = 0x04;
+    constexpr int EarDetectionOpcode = 0x06;
+    constexpr int ControlCommandOpcode = 0x09;
+    constexpr int HeadTrackingOpcode = 0x17;
+    constexpr int MetadataOpcode = 0x1d;
+    constexpr int ConversationalAwarenessDataOpcode = 0x4b;
+}
+
+RelayPolicy::RelayPolicy()
+    : m_duplicates(Metrics::counter("librepods_relay_suppressed_total", "AirPods packets not relayed", {{"reason", "duplicate"}})),
+      m_rateLimited(Metrics::counter("librepods_relay_suppressed_total", "AirPods packets not relayed", {{"reason", "rate_limited"}}))
+{
+    m_lastStreamRelay.fill(-1);
+    m_clock.start();
+}
+
+bool RelayPolicy::shouldRelay(const QByteArray &packet)
+{
+    const int code = opcode(packet);
+    bytesCounter(m_bytesReceived, "received", code).inc(packet.size());
+
+    switch (kind(code))
+    {
+    case Kind::State:
+    {
+        // Control commands share an opcode, the command id tells them apart
+        const int key = code == ControlCommandOpcode && packet.size() > 6 ? (code << 8) | quint8(packet[6]) : code << 8;
+        auto it = m_latest.find(key);
+        if (it != m_latest.end() && *it == packet)
+        {
+            m_duplicates.inc();
+            return false;
+        }
+        m_latest.insert(key, packet);
+        return true;
+    }
+    case Kind::Stream:
+    {
+        const qint64 now = m_clock.elapsed();
+        if (m_lastStreamRelay[code] >= 0 && now - m_lastStreamRelay[code] < StreamIntervalMs)
+        {
+            m_rateLimited.inc();
+            return false;
+        }
+        m_lastStreamRelay[code] = now;
+        return true;
+    }
+    case Kind::Event:
+        break;
+    }
+    return true;
+}
+
+void RelayPolicy::countRelayed(const QByteArray &packet, int peers)
+{
+    bytesCounter(m_bytesRelayed, "relayed", opcode(packet)).inc(packet.size() * peers);
+}
+
+void RelayPolicy::reset()
+{
+    m_latest.clear();
+    m_lastStreamRelay.fill(-1);
+}
+
+int RelayPolicy::opcode(const QByteArray &packet)
+{
+    return packet.size() > 4 ? quint8(packet[4]) : 0;
+}
+
+RelayPolicy::Kind RelayPolicy::kind(int opcode)
+{
+    switch (opcode)
+    {
+    case BatteryOpcode:
+    case EarDetectionOpcode:
+    case ControlCommandOpcode:
+    case MetadataOpcode:
+        return Kind::State;
+    case HeadTrackingOpcode:
+    case ConversationalAwarenessDataOpcode:
+        return Kind::Stream;
+    default:
+        return Kind::Event;
+    }
+}
+
+Metrics::Counter &RelayPolicy::bytesCounter(std::array<Metrics::Counter *, 256> &counters, const char *direction, int opcode)
+{
+    Metrics::Counter *&counter = counters[opcode];
+    if (!counter)
+    {
+        counter = &Metrics::counter("librepods_relay_opcode_bytes_total", "AirPods bytes received and relayed to peers, by opcode",
+                                    {{"direction", direction}, {"opcode", QString::asprintf("0x%02x", opcode)}});
+    }
+    return *counter;
+}
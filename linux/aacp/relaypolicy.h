@@ -0,0 +1,55 @@
+#pragma once
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QList>
+#include <QMap>
+#include <array>
+
+namespace Metrics
+{
+    class Counter;
+}
+
+// Decides which AirPods packets are worth relaying to a peer. State packets
+// (battery, ear detection, control commands, metadata) are only relayed when
+// they differ from the last one of their kind, streams (head tracking,
+// conversational awareness levels) at most once per StreamIntervalMs, and
+// everything else, such as gestures, always. The latest state packets are
+// kept so a peer that (re)connects can be brought up to date at once.
+class RelayPolicy
+{
+public:
+    RelayPolicy();
+
+    // Records the packet and returns whether it should be relayed
+    bool shouldRelay(const QByteArray &packet);
+    // Counts a packet that was actually written to the given number of peers
+    void countRelayed(const QByteArray &packet, int peers = 1);
+    // Latest packet of every state, in a stable order
+    QList<QByteArray> snapshot() const { return m_latest.values(); }
+    void reset();
+
+private:
+    enum class Kind
+    {
+        State,
+        Stream,
+        Event,
+    };
+
+    static int opcode(const QByteArray &packet);
+    static Kind kind(int opcode);
+    Metrics::Counter &bytesCounter(std::array<Metrics::Counter *, 256> &counters, const char *direction, int opcode);
+
+    static constexpr int StreamIntervalMs = 100;
+
+    QMap<int, QByteArray> m_latest; // Keyed by opcode, and by command for control commands
+    std::array<qint64, 256> m_lastStreamRelay{};
+    QElapsedTimer m_clock;
+
+    std::array<Metrics::Counter *, 256> m_bytesReceived{};
+    std::array<Metrics::Counter *, 256> m_bytesRelayed{};
+    Metrics::Counter &m_duplicates;
+    Metrics::Counter &m_rateLimited;
+};
@@ -0,0 +1,114 @@
+#include "relaywriter.h"
+#include "logger.h"
+#include "metrics.h"
+
+#include <QIODevice>
+#include <cerrno>
+#include <cstring>
+
+RelayWriter::RelayWriter(const QString &peer, QObject *parent)
+    : QObject(parent),
+      m_packets(Metrics::counter("librepods_relay_packets_total", "Packets relayed to a peer", {{"peer", peer}})),
+      m_bytes(Metrics::counter("librepods_relay_bytes_total", "Bytes relayed to a peer, headers included", {{"peer", peer}})),
+      m_writes(Metrics::counter("librepods_relay_writes_total", "Write calls made to relay packets to a peer", {{"peer", peer}})),
+      m_latency(Metrics::Registry::instance().histogram("librepods_relay_latency_ms",
+                                                        "Time a relayed packet waited before it was written",
+                                                        {{"peer", peer}}, {0.05, 0.1, 0.25, 0.5, 1, 2, 5, 10, 25}))
+{
+    m_batchTimer.setSingleShot(true);
+    m_batchTimer.setTimerType(Qt::PreciseTimer);
+    m_batchTimer.setInterval(BatchDelayMs);
+    connect(&m_batchTimer, &QTimer::timeout, this, &RelayWriter::flush);
+    m_clock.start();
+}
+
+void RelayWriter::setDevice(QIODevice *device, int descriptor)
+{
+    clear();
+    m_device = device;
+    m_descriptor = descriptor;
+}
+
+void RelayWriter::send(const QByteArray &header, const QByteArray &payload)
+{
+    if (!m_device)
+    {
+        return;
+    }
+    // Copies of the QByteArrays only share the data
+    m_pending[m_pendingCount++] = {header, payload, m_clock.nsecsElapsed()};
+    if (m_pendingCount == MaxBatch)
+    {
+        flush();
+    }
+    else if (!m_batchTimer.isActive())
+    {
+        m_batchTimer.start();
+    }
+}
+
+void RelayWriter::flush()
+{
+    m_batchTimer.stop();
+    if (m_pendingCount == 0)
+    {
+        return;
+    }
+
+    int sent = 0;
+    if (m_descriptor >= 0 && m_device->bytesToWrite() == 0)
+    {
+        sent = sendBatch();
+    }
+    // Whatever sendmmsg() did not take goes through the device's own buffer, in order
+    for (int i = sent; i < m_pendingCount; ++i)
+    {
+        m_device->write(m_pending[i].header + m_pending[i].payload);
+        m_writes.inc();
+    }
+
+    const qint64 now = m_clock.nsecsElapsed();
+    for (int i = 0; i < m_pendingCount; ++i)
+    {
+        m_packets.inc();
+        m_bytes.inc(m_pending[i].header.size() + m_pending[i].payload.size());
+        m_latency.observe((now - m_pending[i].queuedAt) / 1e6);
+        m_pending[i] = {};
+    }
+    m_pendingCount = 0;
+}
+
+void RelayWriter::clear()
+{
+    m_batchTimer.stop();
+    for (int i = 0; i < m_pendingCount; ++i)
+    {
+        m_pending[i] = {};
+    }
+    m_pendingCount = 0;
+}
+
+int RelayWriter::sendBatch()
+{
+    for (int i = 0; i < m_pendingCount; ++i)
+    {
+        iovec *vector = &m_vectors[2 * i];
+        vector[0] = {const_cast<char *>(m_pending[i].header.constData()), size_t(m_pending[i].header.size())};
+        vector[1] = {const_cast<char *>(m_pending[i].payload.constData()), size_t(m_pending[i].payload.size())};
+        m_messages[i] = {};
+        m_messages[i].msg_hdr.msg_iov = vector;
+        m_messages[i].msg_hdr.msg_iovlen = 2;
+    }
+
+    const int sent = ::sendmmsg(m_descriptor, m_messages.data(), m_pendingCount, MSG_DONTWAIT | MSG_NOSIGNAL);
+    m_writes.inc();
+    if (sent < 0)
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            LOG_WARN("Relay sendmmsg failed: " << strerror(errno));
+        }
+        return 0;
+    }
+    return sent;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <QObject>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <array>
+#include <sys/socket.h>
+
+class QIODevice;
+
+namespace Metrics
+{
+    class Counter;
+    class Histogram;
+}
+
+// Outbound half of a relay link. Packets are queued as a header plus the
+// payload buffer they arrived in, nothing is concatenated. Packets that come
+// in within BatchDelayMs go out together in one sendmmsg() call, one message
+// per packet so an L2CAP peer still sees packet boundaries. Without a socket
+// descriptor, or while the device still has buffered data, packets are
+// written through the QIODevice instead.
+class RelayWriter : public QObject
+{
+    Q_OBJECT
+public:
+    explicit RelayWriter(const QString &peer, QObject *parent = nullptr);
+
+    // descriptor is the device's socket, or -1 to always write through the device
+    void setDevice(QIODevice *device, int descriptor = -1);
+    void send(const QByteArray &header, const QByteArray &payload);
+    // Sends everything queued now, keeps ordering with direct writes to the device
+    void flush();
+    void clear();
+
+private:
+    struct Pending
+    {
+        QByteArray header;
+        QByteArray payload;
+        qint64 queuedAt;
+    };
+
+    int sendBatch();
+
+    static constexpr int MaxBatch = 16;
+    static constexpr int BatchDelayMs = 2;
+
+    QIODevice *m_device = nullptr;
+    int m_descriptor = -1;
+    std::array<Pending, MaxBatch> m_pending;
+    int m_pendingCount = 0;
+    std::array<mmsghdr, MaxBatch> m_messages{};
+    std::array<iovec, 2 * MaxBatch> m_vectors{};
+    QTimer m_batchTimer;
+    QElapsedTimer m_clock;
+
+    Metrics::Counter &m_packets;
+    Metrics::Counter &m_bytes;
+    Metrics::Counter &m_writes;
+    Metrics::Histogram &m_latency;
+};
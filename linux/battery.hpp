@@ -1,9 +1,11 @@
 #pragma once
 
 #include <QByteArray>
-#include <QMap>
 #include <QString>
 #include <QObject>
+#include <QTimer>
+#include <array>
+#include <atomic>
 #include <climits>
 
 #include "airpods_packets.h"
@@ -13,29 +15,31 @@ class Battery : public QObject
 {
     Q_OBJECT
 
-    Q_PROPERTY(quint8 leftPodLevel READ getLeftPodLevel NOTIFY batteryStatusChanged)
-    Q_PROPERTY(bool leftPodCharging READ isLeftPodCharging NOTIFY batteryStatusChanged)
-    Q_PROPERTY(bool leftPodAvailable READ isLeftPodAvailable NOTIFY batteryStatusChanged)
-    Q_PROPERTY(quint8 rightPodLevel READ getRightPodLevel NOTIFY batteryStatusChanged)
-    Q_PROPERTY(bool rightPodCharging READ isRightPodCharging NOTIFY batteryStatusChanged)
-    Q_PROPERTY(bool rightPodAvailable READ isRightPodAvailable NOTIFY batteryStatusChanged)
-    Q_PROPERTY(quint8 caseLevel READ getCaseLevel NOTIFY batteryStatusChanged)
-    Q_PROPERTY(bool caseCharging READ isCaseCharging NOTIFY batteryStatusChanged)
-    Q_PROPERTY(bool caseAvailable READ isCaseAvailable NOTIFY batteryStatusChanged)
+    Q_PROPERTY(quint8 leftPodLevel READ getLeftPodLevel NOTIFY leftPodLevelChanged)
+    Q_PROPERTY(bool leftPodCharging READ isLeftPodCharging NOTIFY leftPodChargingChanged)
+    Q_PROPERTY(bool leftPodAvailable READ isLeftPodAvailable NOTIFY leftPodAvailableChanged)
+    Q_PROPERTY(quint8 rightPodLevel READ getRightPodLevel NOTIFY rightPodLevelChanged)
+    Q_PROPERTY(bool rightPodCharging READ isRightPodCharging NOTIFY rightPodChargingChanged)
+    Q_PROPERTY(bool rightPodAvailable READ isRightPodAvailable NOTIFY rightPodAvailableChanged)
+    Q_PROPERTY(quint8 caseLevel READ getCaseLevel NOTIFY caseLevelChanged)
+    Q_PROPERTY(bool caseCharging READ isCaseCharging NOTIFY caseChargingChanged)
+    Q_PROPERTY(bool caseAvailable READ isCaseAvailable NOTIFY caseAvailableChanged)
 
 public:
-    explicit Battery(QObject *parent = nullptr) : QObject(parent)
+    explicit Battery(QObject *parent = nullptr) : QObject(parent), m_notifyTimer(new QTimer(this))
     {
+        // Packets often arrive in bursts, notify at most once per display frame
+        m_notifyTimer->setSingleShot(true);
+        m_notifyTimer->setInterval(16);
+        connect(m_notifyTimer, &QTimer::timeout, this, &Battery::publishChanges);
         reset();
     }
 
     void reset()
     {
         // Initialize all components to unknown state
-        states[Component::Left] = {};
-        states[Component::Right] = {};
-        states[Component::Case] = {};
-        emit batteryStatusChanged();
+        states.fill({});
+        commit();
     }
 
     // Enum for AirPods components
@@ -60,8 +64,29 @@ public:
     {
         quint8 level = 0; // Battery level (0-100), 0 if unknown
         BatteryStatus status = BatteryStatus::Disconnected;
+
+        bool operator==(const BatteryState &other) const { return level == other.level && status == other.status; }
+        bool operator!=(const BatteryState &other) const { return !(*this == other); }
     };
 
+    // States are stored by a dense index instead of the sparse component value
+    static constexpr int ComponentCount = 3;
+    using States = std::array<BatteryState, ComponentCount>;
+
+    static constexpr int componentIndex(Component comp)
+    {
+        switch (comp)
+        {
+        case Component::Right:
+            return 0;
+        case Component::Left:
+            return 1;
+        case Component::Case:
+            return 2;
+        }
+        return -1;
+    }
+
     // Parse the battery status packet and detect primary/secondary pods
     bool parsePacket(const QByteArray &packet)
     {
@@ -77,64 +102,65 @@ public:
             return false; // Invalid count or size mismatch
         }
 
-        QMap<Component, BatteryState> newStates = states;
-
-        // Track pods to determine primary and secondary based on order
-        QList<Component> podsInPacket;
-        podsInPacket.reserve(2);
+        const char *data = packet.constData();
 
+        // Verify spacer and end bytes before touching any state
         for (quint8 i = 0; i < batteryCount; ++i)
         {
             int offset = 7 + (5 * i);
-            quint8 type = static_cast<quint8>(packet[offset]);
-
-            // Verify spacer and end bytes
-            if (static_cast<quint8>(packet[offset + 1]) != 0x01 ||
-                static_cast<quint8>(packet[offset + 4]) != 0x01)
+            if (static_cast<quint8>(data[offset + 1]) != 0x01 ||
+                static_cast<quint8>(data[offset + 4]) != 0x01)
             {
                 return false;
             }
+        }
 
-            Component comp = static_cast<Component>(type);
-            auto level = static_cast<quint8>(packet[offset + 2]);
-            auto status = static_cast<BatteryStatus>(packet[offset + 3]);
+        // Track pods to determine primary and secondary based on order
+        std::array<Component, 2> podsInPacket;
+        int podCount = 0;
 
+        for (quint8 i = 0; i < batteryCount; ++i)
+        {
+            int offset = 7 + (5 * i);
+            Component comp = static_cast<Component>(static_cast<quint8>(data[offset]));
+            int index = componentIndex(comp);
+            if (index < 0)
+            {
+                continue; // Not a component we know about
+            }
+
+            auto level = static_cast<quint8>(data[offset + 2]);
+            auto status = static_cast<BatteryStatus>(static_cast<quint8>(data[offset + 3]));
             if (status != BatteryStatus::Disconnected)
             {
-                newStates[comp] = {level, status};
+                states[index] = {level, status};
             }
 
             // If this is a pod (Left or Right), add it to the list
-            if (comp == Component::Left || comp == Component::Right)
+            if (comp != Component::Case && podCount < 2)
             {
-                podsInPacket.append(comp);
+                podsInPacket[podCount++] = comp;
             }
         }
 
-        // Update states
-        states = newStates;
-
         // Set primary and secondary pods based on order
-        if (!podsInPacket.isEmpty())
+        Component oldPrimary = primaryPod;
+        if (podCount >= 1)
         {
-            Component newPrimaryPod = podsInPacket[0]; // First pod is primary
-            if (newPrimaryPod != primaryPod)
-            {
-                primaryPod = newPrimaryPod;
-                emit primaryChanged();
-            }
+            primaryPod = podsInPacket[0]; // First pod is primary
         }
-        if (podsInPacket.size() >= 2)
+        if (podCount >= 2)
         {
             secondaryPod = podsInPacket[1]; // Second pod is secondary
         }
 
-        // Emit signal to notify about battery status change
-        emit batteryStatusChanged();
+        commit();
 
-        // Log which is left and right pod
-        LOG_INFO("Primary Pod:" << primaryPod);
-        LOG_INFO("Secondary Pod:" << secondaryPod);
+        if (primaryPod != oldPrimary)
+        {
+            LOG_INFO("Primary Pod:" << primaryPod);
+            LOG_INFO("Secondary Pod:" << secondaryPod);
+        }
 
         return true;
     }
@@ -161,39 +187,68 @@ public:
         auto [isRightCharging, rawRightBattery] = formatBattery(rawRightBatteryByte);
         auto [isCaseCharging, rawCaseBattery] = formatBattery(rawCaseBatteryByte);
 
+        BatteryState &left = state(Component::Left);
+        BatteryState &right = state(Component::Right);
+        BatteryState &caseState = state(Component::Case);
+
         if (rawLeftBattery == CHAR_MAX) {
-            rawLeftBattery = states.value(Component::Left).level; // Use last valid level
-            isLeftCharging = states.value(Component::Left).status == BatteryStatus::Charging;
+            rawLeftBattery = left.level; // Use last valid level
+            isLeftCharging = left.status == BatteryStatus::Charging;
         }
 
         if (rawRightBattery == CHAR_MAX) {
-            rawRightBattery = states.value(Component::Right).level; // Use last valid level
-            isRightCharging = states.value(Component::Right).status == BatteryStatus::Charging;
+            rawRightBattery = right.level; // Use last valid level
+            isRightCharging = right.status == BatteryStatus::Charging;
         }
 
         if (rawCaseBattery == CHAR_MAX) {
-            rawCaseBattery = states.value(Component::Case).level; // Use last valid level
-            isCaseCharging = states.value(Component::Case).status == BatteryStatus::Charging;
+            rawCaseBattery = caseState.level; // Use last valid level
+            isCaseCharging = caseState.status == BatteryStatus::Charging;
         }
 
         // Update states
-        states[Component::Left] = {static_cast<quint8>(rawLeftBattery), isLeftCharging ? BatteryStatus::Charging : BatteryStatus::Discharging};
-        states[Component::Right] = {static_cast<quint8>(rawRightBattery), isRightCharging ? BatteryStatus::Charging : BatteryStatus::Discharging};
+        left = {static_cast<quint8>(rawLeftBattery), isLeftCharging ? BatteryStatus::Charging : BatteryStatus::Discharging};
+        right = {static_cast<quint8>(rawRightBattery), isRightCharging ? BatteryStatus::Charging : BatteryStatus::Discharging};
         if (podInCase) {
-            states[Component::Case] = {static_cast<quint8>(rawCaseBattery), isCaseCharging ? BatteryStatus::Charging : BatteryStatus::Discharging};
+            caseState = {static_cast<quint8>(rawCaseBattery), isCaseCharging ? BatteryStatus::Charging : BatteryStatus::Discharging};
         }
         primaryPod = isLeftPodPrimary ? Component::Left : Component::Right;
         secondaryPod = isLeftPodPrimary ? Component::Right : Component::Left;
-        emit batteryStatusChanged();
-        emit primaryChanged();
+        commit();
 
         return true;
     }
 
+    // Copy of the full state, used to hand battery state between threads
+    struct Snapshot
+    {
+        States states{};
+        Component primary = Component::Left;
+        Component secondary = Component::Right;
+
+        BatteryState state(Component comp) const
+        {
+            int index = componentIndex(comp);
+            return index < 0 ? BatteryState{} : states[index];
+        }
+    };
+
+    // Safe to call from any thread, reads the last committed state without locking
+    Snapshot snapshot() const { return unpack(m_packed.load(std::memory_order_acquire)); }
+
+    void applySnapshot(const Snapshot &snapshot)
+    {
+        states = snapshot.states;
+        primaryPod = snapshot.primary;
+        secondaryPod = snapshot.secondary;
+        commit();
+    }
+
     // Get the raw state for a component
     BatteryState getState(Component comp) const
     {
-        return states.value(comp, {});
+        int index = componentIndex(comp);
+        return index < 0 ? BatteryState{} : states[index];
     }
 
     // Get a formatted status string including charging state
@@ -227,24 +282,124 @@ public:
     Component getPrimaryPod() const { return primaryPod; }
     Component getSecondaryPod() const { return secondaryPod; }
 
-    quint8 getLeftPodLevel() const { return states.value(Component::Left).level; }
+    quint8 getLeftPodLevel() const { return getState(Component::Left).level; }
     bool isLeftPodCharging() const { return isStatus(Component::Left, BatteryStatus::Charging); }
     bool isLeftPodAvailable() const { return !isStatus(Component::Left, BatteryStatus::Disconnected); }
-    quint8 getRightPodLevel() const { return states.value(Component::Right).level; }
+    quint8 getRightPodLevel() const { return getState(Component::Right).level; }
     bool isRightPodCharging() const { return isStatus(Component::Right, BatteryStatus::Charging); }
     bool isRightPodAvailable() const { return !isStatus(Component::Right, BatteryStatus::Disconnected); }
-    quint8 getCaseLevel() const { return states.value(Component::Case).level; }
+    quint8 getCaseLevel() const { return getState(Component::Case).level; }
     bool isCaseCharging() const { return isStatus(Component::Case, BatteryStatus::Charging); }
     bool isCaseAvailable() const { return !isStatus(Component::Case, BatteryStatus::Disconnected); }
 
 signals:
+    // Emitted once per coalesced update in which anything changed
     void batteryStatusChanged();
     void primaryChanged();
 
+    void leftPodLevelChanged();
+    void leftPodChargingChanged();
+    void leftPodAvailableChanged();
+    void rightPodLevelChanged();
+    void rightPodChargingChanged();
+    void rightPodAvailableChanged();
+    void caseLevelChanged();
+    void caseChargingChanged();
+    void caseAvailableChanged();
+
 private:
+    using Notifier = void (Battery::*)();
+
+    BatteryState &state(Component comp) { return states[componentIndex(comp)]; }
+
+    // The whole state fits in one 64-bit word: level and status per component,
+    // then the primary and secondary pod. Publishing it is a single atomic store.
+    static quint64 pack(const States &states, Component primary, Component secondary)
+    {
+        quint64 word = 0;
+        for (int i = 0; i < ComponentCount; ++i)
+        {
+            word |= quint64(states[i].level) << (16 * i);
+            word |= quint64(static_cast<quint8>(states[i].status)) << (16 * i + 8);
+        }
+        word |= quint64(static_cast<quint8>(primary)) << 48;
+        word |= quint64(static_cast<quint8>(secondary)) << 56;
+        return word;
+    }
+
+    static Snapshot unpack(quint64 word)
+    {
+        Snapshot snapshot;
+        for (int i = 0; i < ComponentCount; ++i)
+        {
+            snapshot.states[i].level = static_cast<quint8>(word >> (16 * i));
+            snapshot.states[i].status = static_cast<BatteryStatus>(static_cast<quint8>(word >> (16 * i + 8)));
+        }
+        snapshot.primary = static_cast<Component>(static_cast<quint8>(word >> 48));
+        snapshot.secondary = static_cast<Component>(static_cast<quint8>(word >> 56));
+        return snapshot;
+    }
+
+    void commit()
+    {
+        m_packed.store(pack(states, primaryPod, secondaryPod), std::memory_order_release);
+        scheduleNotify();
+    }
+
+    void scheduleNotify()
+    {
+        if (!m_notifyTimer->isActive())
+        {
+            m_notifyTimer->start();
+        }
+    }
+
+    // Diffs the current state against what was last announced and only
+    // notifies the fields that actually changed
+    void publishChanges()
+    {
+        bool changed = false;
+        changed |= publishComponent(Component::Left, &Battery::leftPodLevelChanged,
+                                    &Battery::leftPodChargingChanged, &Battery::leftPodAvailableChanged);
+        changed |= publishComponent(Component::Right, &Battery::rightPodLevelChanged,
+                                    &Battery::rightPodChargingChanged, &Battery::rightPodAvailableChanged);
+        changed |= publishComponent(Component::Case, &Battery::caseLevelChanged,
+                                    &Battery::caseChargingChanged, &Battery::caseAvailableChanged);
+        m_published = states;
+
+        if (primaryPod != m_publishedPrimary)
+        {
+            m_publishedPrimary = primaryPod;
+            emit primaryChanged();
+        }
+        if (changed)
+        {
+            emit batteryStatusChanged();
+        }
+    }
+
+    bool publishComponent(Component comp, Notifier levelChanged, Notifier chargingChanged, Notifier availableChanged)
+    {
+        BatteryState now = getState(comp);
+        BatteryState before = m_published[componentIndex(comp)];
+        if (now.level != before.level)
+        {
+            emit (this->*levelChanged)();
+        }
+        if ((now.status == BatteryStatus::Charging) != (before.status == BatteryStatus::Charging))
+        {
+            emit (this->*chargingChanged)();
+        }
+        if ((now.status == BatteryStatus::Disconnected) != (before.status == BatteryStatus::Disconnected))
+        {
+            emit (this->*availableChanged)();
+        }
+        return now != before;
+    }
+
     bool isStatus(Component component, BatteryStatus status) const
     {
-        return states.value(component).status == status;
+        return getState(component).status == status;
     }
 
     std::pair<bool, int> formatBattery(unsigned char byteVal)
@@ -254,7 +409,13 @@ private:
         return std::make_pair(charging, level);
     }
 
-    QMap<Component, BatteryState> states;
-    Component primaryPod;
-    Component secondaryPod;
+    States states{};
+    Component primaryPod = Component::Left;
+    Component secondaryPod = Component::Right;
+    std::atomic<quint64> m_packed{0};
+    static_assert(std::atomic<quint64>::is_always_lock_free, "battery snapshots rely on a lock-free 64-bit atomic");
+
+    QTimer *m_notifyTimer;
+    States m_published{};
+    Component m_publishedPrimary = Component::Left;
 };
\ No newline at end of file
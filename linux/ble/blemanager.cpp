@@ -3,6 +3,7 @@
 #include <QDebug>
 #include <QTimer>
 #include "logger.h"
+#include "metrics.h"
 #include <QMap>
 
 AirpodsTrayApp::Enums::AirPodsModel getModelName(quint16 modelId)
@@ -82,7 +83,10 @@ QString getConnectionStateName(BleInfo::ConnectionState state)
     }
 }
 
-BleManager::BleManager(QObject *parent) : QObject(parent)
+BleManager::BleManager(QObject *parent)
+    : QObject(parent),
+      m_advertsSeen(Metrics::counter("librepods_ble_adverts_seen_total", "Apple proximity pairing adverts received")),
+      m_advertsDeduplicated(Metrics::counter("librepods_ble_adverts_deduplicated_total", "Adverts dropped because they repeat the previous one from the same address"))
 {
     discoveryAgent = new QBluetoothDeviceDiscoveryAgent(this);
     discoveryAgent->setLowEnergyDiscoveryTimeout(0); // Continuous scanning
@@ -127,6 +131,19 @@ void BleManager::onDeviceDiscovered(const QBluetoothDeviceInfo &info)
         if (data.size() >= 10 && data[0] == 0x07)
         {
             QString address = info.address().toString();
+            m_advertsSeen.inc();
+            auto last = m_lastAdvert.constFind(address);
+            if (last != m_lastAdvert.constEnd() && *last == data)
+            {
+                m_advertsDeduplicated.inc();
+                return;
+            }
+            if (m_lastAdvert.size() >= 256)
+            {
+                m_lastAdvert.clear(); // Addresses rotate, do not keep every one ever seen
+            }
+            m_lastAdvert.insert(address, data);
+
             BleInfo deviceInfo;
             deviceInfo.name = info.name().isEmpty() ? "AirPods" : info.name();
             deviceInfo.address = address;
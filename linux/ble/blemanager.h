@@ -3,6 +3,7 @@
 
 #include <QObject>
 #include <QBluetoothDeviceDiscoveryAgent>
+#include <QHash>
 #include <QMap>
 #include <QString>
 #include <QDateTime>
@@ -63,6 +64,11 @@ public:
     QDateTime lastSeen; // Timestamp of last detection
 };
 
+namespace Metrics
+{
+    class Counter;
+}
+
 class BleManager : public QObject
 {
     Q_OBJECT
@@ -84,6 +90,10 @@ signals:
 
 private:
     QBluetoothDeviceDiscoveryAgent *discoveryAgent;
+    // Last proximity payload per address, repeats are not reported again
+    QHash<QString, QByteArray> m_lastAdvert;
+    Metrics::Counter &m_advertsSeen;
+    Metrics::Counter &m_advertsDeduplicated;
 };
 
 #endif // BLEMANAGER_H
\ No newline at end of file
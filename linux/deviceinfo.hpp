@@ -2,10 +2,10 @@
 
 #include <QObject>
 #include <QByteArray>
-#include <QSettings>
 #include "battery.hpp"
 #include "enums.h"
 #include "eardetection.hpp"
+#include "settingsstore.h"
 
 using namespace AirpodsTrayApp::Enums;
 
@@ -28,10 +28,26 @@ class DeviceInfo : public QObject
     Q_PROPERTY(QString bluetoothAddress READ bluetoothAddress WRITE setBluetoothAddress NOTIFY bluetoothAddressChanged)
     Q_PROPERTY(QString magicAccIRK READ magicAccIRKHex CONSTANT)
     Q_PROPERTY(QString magicAccEncKey READ magicAccEncKeyHex CONSTANT)
+    Q_PROPERTY(bool stale READ isStale NOTIFY staleChanged)
 
 public:
     explicit DeviceInfo(QObject *parent = nullptr) : QObject(parent), m_battery(new Battery(this)), m_earDetection(new EarDetection(this)) {
         connect(getEarDetection(), &EarDetection::statusChanged, this, &DeviceInfo::primaryChanged);
+        connect(m_battery, &Battery::primaryChanged, this, &DeviceInfo::primaryChanged);
+        // The status string only follows coalesced battery updates
+        connect(m_battery, &Battery::batteryStatusChanged, this, &DeviceInfo::updateBatteryStatus);
+
+        // One signal for observers that publish the whole state, so they cannot miss a source
+        connect(m_battery, &Battery::batteryStatusChanged, this, &DeviceInfo::stateChanged);
+        connect(getEarDetection(), &EarDetection::statusChanged, this, &DeviceInfo::stateChanged);
+        connect(this, &DeviceInfo::noiseControlModeChanged, this, &DeviceInfo::stateChanged);
+        connect(this, &DeviceInfo::conversationalAwarenessChanged, this, &DeviceInfo::stateChanged);
+        connect(this, &DeviceInfo::adaptiveNoiseLevelChanged, this, &DeviceInfo::stateChanged);
+        connect(this, &DeviceInfo::deviceNameChanged, this, &DeviceInfo::stateChanged);
+        connect(this, &DeviceInfo::primaryChanged, this, &DeviceInfo::stateChanged);
+        connect(this, &DeviceInfo::oneBudANCModeChanged, this, &DeviceInfo::stateChanged);
+        connect(this, &DeviceInfo::modelChanged, this, &DeviceInfo::stateChanged);
+        connect(this, &DeviceInfo::bluetoothAddressChanged, this, &DeviceInfo::stateChanged);
     }
 
     QString batteryStatus() const { return m_batteryStatus; }
@@ -150,8 +166,21 @@ public:
 
     EarDetection *getEarDetection() const { return m_earDetection; }
 
+    // True while the state shown is the last known one from a previous run
+    bool isStale() const { return m_stale; }
+    void setStale(bool stale)
+    {
+        if (m_stale != stale)
+        {
+            m_stale = stale;
+            updateBatteryStatus();
+            emit staleChanged(stale);
+        }
+    }
+
     void reset()
     {
+        setStale(false);
         setDeviceName("");
         setModel(AirPodsModel::Unknown);
         m_battery->reset();
@@ -161,16 +190,14 @@ public:
         getEarDetection()->reset();
     }
 
-    void saveToSettings(QSettings &settings)
+    void saveToSettings(SettingsStore &settings)
     {
-        settings.beginGroup("DeviceInfo");
-        settings.setValue("deviceName", deviceName());
-        settings.setValue("model", static_cast<int>(model()));
-        settings.setValue("magicAccIRK", magicAccIRK());
-        settings.setValue("magicAccEncKey", magicAccEncKey());
-        settings.endGroup();
-    }
-    void loadFromSettings(const QSettings &settings)
+        settings.setValue("DeviceInfo/deviceName", deviceName());
+        settings.setValue("DeviceInfo/model", static_cast<int>(model()));
+        settings.setValue("DeviceInfo/magicAccIRK", magicAccIRK());
+        settings.setValue("DeviceInfo/magicAccEncKey", magicAccEncKey());
+    }
+    void loadFromSettings(const SettingsStore &settings)
     {
         setDeviceName(settings.value("DeviceInfo/deviceName", "").toString());
         setModel(static_cast<AirPodsModel>(settings.value("DeviceInfo/model", (int)(AirPodsModel::Unknown)).toInt()));
@@ -180,10 +207,16 @@ public:
 
     void updateBatteryStatus()
     {
+        if (!getBattery()->isLeftPodAvailable() && !getBattery()->isRightPodAvailable() && !getBattery()->isCaseAvailable())
+        {
+            setBatteryStatus(""); // Nothing reported yet, or reset after a disconnect
+            return;
+        }
         int leftLevel = getBattery()->getState(Battery::Component::Left).level;
         int rightLevel = getBattery()->getState(Battery::Component::Right).level;
         int caseLevel = getBattery()->getState(Battery::Component::Case).level;
-        setBatteryStatus(QString("Left: %1%, Right: %2%, Case: %3%").arg(leftLevel).arg(rightLevel).arg(caseLevel));
+        setBatteryStatus(QString("Left: %1%, Right: %2%, Case: %3%%4").arg(leftLevel).arg(rightLevel).arg(caseLevel)
+                             .arg(m_stale ? " (last known)" : ""));
     }
 
 signals:
@@ -197,6 +230,9 @@ signals:
     void oneBudANCModeChanged(bool enabled);
     void modelChanged();
     void bluetoothAddressChanged(const QString &address);
+    void staleChanged(bool stale);
+    // Any of the above except staleChanged, possibly several times per update
+    void stateChanged();
 
 private:
     QString m_batteryStatus;
@@ -213,4 +249,5 @@ private:
     QString m_manufacturer;
     QString m_bluetoothAddress;
     EarDetection *m_earDetection;
+    bool m_stale = false;
 };
\ No newline at end of file
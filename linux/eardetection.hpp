@@ -4,6 +4,7 @@
 #include <QByteArray>
 #include <QPair>
 #include "logger.h"
+#include "trace.h"
 
 class EarDetection : public QObject
 {
@@ -40,18 +41,25 @@ public:
 
         auto [newprimaryStatus, newsecondaryStatus] = parseStatusBytes(data);
 
-        primaryStatus = newprimaryStatus;
-        secondaryStatus = newsecondaryStatus;
-        LOG_DEBUG("Parsed Ear Detection Status: Primary - " << primaryStatus
-                  << ", Secondary - " << secondaryStatus);
-        emit statusChanged();
+        TRACE("Parsed Ear Detection Status: Primary - {}, Secondary - {} (InEar, NotInEar, InCase, Disconnected)", newprimaryStatus, newsecondaryStatus);
+        setStatus(newprimaryStatus, newsecondaryStatus);
 
         return true;
     }
     void overrideEarDetectionStatus(bool primaryInEar, bool secondaryInEar)
     {
-        primaryStatus = primaryInEar ? EarDetectionStatus::InEar : EarDetectionStatus::NotInEar;
-        secondaryStatus = secondaryInEar ? EarDetectionStatus::InEar : EarDetectionStatus::NotInEar;
+        setStatus(primaryInEar ? EarDetectionStatus::InEar : EarDetectionStatus::NotInEar,
+                  secondaryInEar ? EarDetectionStatus::InEar : EarDetectionStatus::NotInEar);
+    }
+
+    void setStatus(EarDetectionStatus primary, EarDetectionStatus secondary)
+    {
+        if (primary == primaryStatus && secondary == secondaryStatus)
+        {
+            return;
+        }
+        primaryStatus = primary;
+        secondaryStatus = secondary;
         emit statusChanged();
     }
 
@@ -0,0 +1,187 @@
+#include "dbusservice.h"
+#include "deviceinfo.hpp"
+#include "ipcprotocol.h"
+#include "logger.h"
+
+#include <QDBusConnection>
+#include <QDBusError>
+#include <QDBusMessage>
+#include <QDBusServiceWatcher>
+#include <QMetaEnum>
+#include <QMetaProperty>
+
+using namespace AirpodsTrayApp::Enums;
+
+DBusService::DBusService(DeviceInfo *deviceInfo, QObject *parent)
+    : QObject(parent), m_deviceInfo(deviceInfo)
+{
+    m_notifyTimer.setSingleShot(true);
+    m_notifyTimer.setInterval(NotifyIntervalMs);
+    connect(&m_notifyTimer, &QTimer::timeout, this, &DBusService::emitPropertiesChanged);
+
+    connect(m_deviceInfo, &DeviceInfo::stateChanged, this, &DBusService::schedulePropertiesChanged);
+
+    m_published = properties();
+}
+
+bool DBusService::registerService()
+{
+    QDBusConnection bus = QDBusConnection::sessionBus();
+    if (!bus.isConnected())
+    {
+        LOG_WARN("No session bus, the D-Bus service is not available");
+        return false;
+    }
+    if (!bus.registerObject(ObjectPath, this, QDBusConnection::ExportAllProperties | QDBusConnection::ExportScriptableSlots))
+    {
+        LOG_WARN("Cannot export " << ObjectPath << ": " << bus.lastError().message());
+        return false;
+    }
+    m_registered = true;
+    if (!bus.registerService(ServiceName))
+    {
+        // A headless instance handing over may still own the name for a moment
+        LOG_WARN("Cannot claim " << ServiceName << " yet: " << bus.lastError().message());
+        auto *watcher = new QDBusServiceWatcher(ServiceName, bus, QDBusServiceWatcher::WatchForUnregistration, this);
+        connect(watcher, &QDBusServiceWatcher::serviceUnregistered, this, [watcher]()
+        {
+            if (QDBusConnection::sessionBus().registerService(ServiceName))
+            {
+                LOG_INFO("Claimed " << ServiceName);
+                watcher->deleteLater();
+            }
+        });
+    }
+    return true;
+}
+
+void DBusService::setConnected(bool connected)
+{
+    if (m_connected != connected)
+    {
+        m_connected = connected;
+        schedulePropertiesChanged();
+    }
+}
+
+QString DBusService::deviceName() const { return m_deviceInfo->deviceName(); }
+
+QString DBusService::model() const
+{
+    return QString::fromLatin1(QMetaEnum::fromType<AirPodsModel>().valueToKey(static_cast<int>(m_deviceInfo->model())));
+}
+
+QString DBusService::bluetoothAddress() const { return m_deviceInfo->bluetoothAddress(); }
+
+QString DBusService::noiseControlMode() const
+{
+    return Ipc::noiseModeNames().value(m_deviceInfo->noiseControlModeInt());
+}
+
+bool DBusService::conversationalAwareness() const { return m_deviceInfo->conversationalAwareness(); }
+int DBusService::adaptiveNoiseLevel() const { return m_deviceInfo->adaptiveNoiseLevel(); }
+bool DBusService::oneBudANCMode() const { return m_deviceInfo->oneBudANCMode(); }
+int DBusService::leftPodLevel() const { return m_deviceInfo->getBattery()->getLeftPodLevel(); }
+bool DBusService::leftPodCharging() const { return m_deviceInfo->getBattery()->isLeftPodCharging(); }
+bool DBusService::leftPodAvailable() const { return m_deviceInfo->getBattery()->isLeftPodAvailable(); }
+int DBusService::rightPodLevel() const { return m_deviceInfo->getBattery()->getRightPodLevel(); }
+bool DBusService::rightPodCharging() const { return m_deviceInfo->getBattery()->isRightPodCharging(); }
+bool DBusService::rightPodAvailable() const { return m_deviceInfo->getBattery()->isRightPodAvailable(); }
+int DBusService::caseLevel() const { return m_deviceInfo->getBattery()->getCaseLevel(); }
+bool DBusService::caseCharging() const { return m_deviceInfo->getBattery()->isCaseCharging(); }
+bool DBusService::caseAvailable() const { return m_deviceInfo->getBattery()->isCaseAvailable(); }
+
+QString DBusService::primaryPod() const
+{
+    return m_deviceInfo->getBattery()->getPrimaryPod() == Battery::Component::Left ? "left" : "right";
+}
+
+bool DBusService::leftPodInEar() const { return m_deviceInfo->isLeftPodInEar(); }
+bool DBusService::rightPodInEar() const { return m_deviceInfo->isRightPodInEar(); }
+
+void DBusService::SetNoiseControlMode(const QString &mode)
+{
+    const int value = Ipc::noiseModeFromString(mode);
+    if (value < 0)
+    {
+        sendErrorReply(QDBusError::InvalidArgs, "Unknown noise control mode, expected one of " + Ipc::noiseModeNames().join(", "));
+        return;
+    }
+    if (checkConnected())
+    {
+        emit noiseControlModeRequested(static_cast<NoiseControlMode>(value));
+    }
+}
+
+void DBusService::SetConversationalAwareness(bool enabled)
+{
+    if (checkConnected())
+    {
+        emit conversationalAwarenessRequested(enabled);
+    }
+}
+
+void DBusService::SetAdaptiveNoiseLevel(int level)
+{
+    if (level < 0 || level > 100)
+    {
+        sendErrorReply(QDBusError::InvalidArgs, "Adaptive noise level must be between 0 and 100");
+        return;
+    }
+    if (checkConnected())
+    {
+        emit adaptiveNoiseLevelRequested(level);
+    }
+}
+
+bool DBusService::checkConnected()
+{
+    if (!m_connected)
+    {
+        sendErrorReply(QDBusError::Failed, "AirPods are not connected");
+    }
+    return m_connected;
+}
+
+QVariantMap DBusService::properties() const
+{
+    // Every exported property, read through the meta-object so the list cannot drift
+    QVariantMap values;
+    const QMetaObject *meta = metaObject();
+    for (int i = meta->propertyOffset(); i < meta->propertyCount(); ++i)
+    {
+        const QMetaProperty property = meta->property(i);
+        values.insert(QString::fromLatin1(property.name()), property.read(this));
+    }
+    return values;
+}
+
+void DBusService::schedulePropertiesChanged()
+{
+    if (!m_notifyTimer.isActive())
+    {
+        m_notifyTimer.start();
+    }
+}
+
+void DBusService::emitPropertiesChanged()
+{
+    const QVariantMap current = properties();
+    QVariantMap changed;
+    for (auto it = current.constBegin(); it != current.constEnd(); ++it)
+    {
+        if (m_published.value(it.key()) != it.value())
+        {
+            changed.insert(it.key(), it.value());
+        }
+    }
+    m_published = current;
+    if (changed.isEmpty() || !m_registered)
+    {
+        return;
+    }
+
+    QDBusMessage signal = QDBusMessage::createSignal(ObjectPath, "org.freedesktop.DBus.Properties", "PropertiesChanged");
+    signal << QString(InterfaceName) << changed << QStringList();
+    QDBusConnection::sessionBus().send(signal);
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <QObject>
+#include <QDBusContext>
+#include <QTimer>
+#include <QVariantMap>
+
+#include "enums.h"
+
+class DeviceInfo;
+
+// Device state on the session bus as me.kavishdevar.librepods at
+// /me/kavishdevar/librepods. Properties mirror DeviceInfo, Battery and
+// EarDetection. PropertiesChanged is sent once per burst of updates and only
+// lists properties whose value actually changed.
+class DBusService : public QObject, protected QDBusContext
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "me.kavishdevar.librepods.Device")
+    Q_PROPERTY(bool Connected READ connected)
+    Q_PROPERTY(QString DeviceName READ deviceName)
+    Q_PROPERTY(QString Model READ model)
+    Q_PROPERTY(QString BluetoothAddress READ bluetoothAddress)
+    Q_PROPERTY(QString NoiseControlMode READ noiseControlMode)
+    Q_PROPERTY(bool ConversationalAwareness READ conversationalAwareness)
+    Q_PROPERTY(int AdaptiveNoiseLevel READ adaptiveNoiseLevel)
+    Q_PROPERTY(bool OneBudANCMode READ oneBudANCMode)
+    Q_PROPERTY(int LeftPodLevel READ leftPodLevel)
+    Q_PROPERTY(bool LeftPodCharging READ leftPodCharging)
+    Q_PROPERTY(bool LeftPodAvailable READ leftPodAvailable)
+    Q_PROPERTY(int RightPodLevel READ rightPodLevel)
+    Q_PROPERTY(bool RightPodCharging READ rightPodCharging)
+    Q_PROPERTY(bool RightPodAvailable READ rightPodAvailable)
+    Q_PROPERTY(int CaseLevel READ caseLevel)
+    Q_PROPERTY(bool CaseCharging READ caseCharging)
+    Q_PROPERTY(bool CaseAvailable READ caseAvailable)
+    Q_PROPERTY(QString PrimaryPod READ primaryPod)
+    Q_PROPERTY(bool LeftPodInEar READ leftPodInEar)
+    Q_PROPERTY(bool RightPodInEar READ rightPodInEar)
+
+public:
+    static constexpr const char *ServiceName = "me.kavishdevar.librepods";
+    static constexpr const char *ObjectPath = "/me/kavishdevar/librepods";
+    static constexpr const char *InterfaceName = "me.kavishdevar.librepods.Device";
+
+    explicit DBusService(DeviceInfo *deviceInfo, QObject *parent = nullptr);
+
+    // Claims the service name and exports the object, false if the bus is unavailable
+    bool registerService();
+    void setConnected(bool connected);
+
+    bool connected() const { return m_connected; }
+    QString deviceName() const;
+    QString model() const;
+    QString bluetoothAddress() const;
+    QString noiseControlMode() const;
+    bool conversationalAwareness() const;
+    int adaptiveNoiseLevel() const;
+    bool oneBudANCMode() const;
+    int leftPodLevel() const;
+    bool leftPodCharging() const;
+    bool leftPodAvailable() const;
+    int rightPodLevel() const;
+    bool rightPodCharging() const;
+    bool rightPodAvailable() const;
+    int caseLevel() const;
+    bool caseCharging() const;
+    bool caseAvailable() const;
+    QString primaryPod() const;
+    bool leftPodInEar() const;
+    bool rightPodInEar() const;
+
+public slots:
+    Q_SCRIPTABLE void SetNoiseControlMode(const QString &mode);
+    Q_SCRIPTABLE void SetConversationalAwareness(bool enabled);
+    Q_SCRIPTABLE void SetAdaptiveNoiseLevel(int level);
+
+signals:
+    void noiseControlModeRequested(AirpodsTrayApp::Enums::NoiseControlMode mode);
+    void conversationalAwarenessRequested(bool enabled);
+    void adaptiveNoiseLevelRequested(int level);
+
+private:
+    QVariantMap properties() const;
+    void schedulePropertiesChanged();
+    void emitPropertiesChanged();
+    bool checkConnected();
+
+    static constexpr int NotifyIntervalMs = 16;
+
+    DeviceInfo *m_deviceInfo;
+    bool m_connected = false;
+    bool m_registered = false;
+    QVariantMap m_published;
+    QTimer m_notifyTimer;
+};
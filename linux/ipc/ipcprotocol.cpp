@@ -0,0 +1,64 @@
+#include "ipcprotocol.h"
+
+#include <QJsonDocument>
+#include <QJsonParseError>
+
+namespace Ipc
+{
+    QByteArray encode(const QJsonObject &frame)
+    {
+        return QJsonDocument(frame).toJson(QJsonDocument::Compact) + '\n';
+    }
+
+    bool FrameReader::next(QJsonObject &frame, QString &error)
+    {
+        error.clear();
+        const qsizetype end = m_buffer.indexOf('\n');
+        if (end < 0)
+        {
+            if (m_buffer.size() > MaxFrameSize)
+            {
+                m_buffer.clear();
+                error = QStringLiteral("frame too large");
+                return true;
+            }
+            return false;
+        }
+
+        const QByteArray line = m_buffer.left(end).trimmed();
+        m_buffer.remove(0, end + 1);
+
+        QJsonParseError parseError;
+        const QJsonDocument document = QJsonDocument::fromJson(line, &parseError);
+        if (!document.isObject())
+        {
+            error = parseError.error != QJsonParseError::NoError ? parseError.errorString() : QStringLiteral("expected a JSON object");
+            return true;
+        }
+        frame = document.object();
+        return true;
+    }
+
+    const QStringList &noiseModeNames()
+    {
+        static const QStringList names = {"off", "noise-cancellation", "transparency", "adaptive"};
+        return names;
+    }
+
+    int noiseModeFromString(const QString &mode)
+    {
+        const QString name = mode.trimmed().toLower();
+        if (name == "anc")
+        {
+            return noiseModeNames().indexOf("noise-cancellation");
+        }
+
+        bool isNumber = false;
+        const int value = name.toInt(&isNumber);
+        if (isNumber)
+        {
+            return value >= 0 && value < noiseModeNames().size() ? value : -1;
+        }
+        return noiseModeNames().indexOf(name);
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <QByteArray>
+#include <QJsonObject>
+#include <QString>
+#include <QStringList>
+
+// Command protocol of the app_server local socket, shared by the app and
+// librepodsctl. Every frame is one compact JSON object followed by '\n':
+//
+//   -> {"id": 1, "cmd": "get-state"}
+//   <- {"id": 1, "ok": true, "state": {...}}
+//   -> {"id": 2, "cmd": "subscribe"}
+//   <- {"id": 2, "ok": true, "state": {...}}
+//   <- {"event": "state", "changed": {"noiseControlMode": "adaptive"}}
+//
+// Commands: get-state, subscribe, unsubscribe, set-noise-mode {"mode"},
+// set-conversational-awareness {"enabled"}, reopen, metrics {"format"}.
+// Failed commands answer {"id", "ok": false, "error"}. A connection stays
+// open until the client closes it. reopen fails on a headless instance.
+//
+// Clients that write a bare word without a newline ("reopen", "metrics")
+// are answered in plain text and disconnected, as before. A bare "reopen"
+// makes a headless instance answer "handoff" and exit, which is how a
+// starting UI instance takes over.
+namespace Ipc
+{
+    const QString ServerName = QStringLiteral("app_server");
+
+    QByteArray encode(const QJsonObject &frame);
+
+    // Splits a byte stream into frames
+    class FrameReader
+    {
+    public:
+        void append(const QByteArray &data) { m_buffer += data; }
+        // False once no complete frame is buffered, error is set for a frame that is not a JSON object
+        bool next(QJsonObject &frame, QString &error);
+        bool isEmpty() const { return m_buffer.isEmpty(); }
+        const QByteArray &buffer() const { return m_buffer; }
+
+        static constexpr int MaxFrameSize = 64 * 1024;
+
+    private:
+        QByteArray m_buffer;
+    };
+
+    // Noise control modes by their value in AirpodsTrayApp::Enums::NoiseControlMode
+    const QStringList &noiseModeNames();
+    // Accepts a name or a number, -1 if neither matches
+    int noiseModeFromString(const QString &mode);
+}
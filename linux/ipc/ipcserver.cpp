@@ -0,0 +1,336 @@
+#include "ipcserver.h"
+#include "deviceinfo.hpp"
+#include "logger.h"
+#include "metrics.h"
+
+#include <QJsonDocument>
+#include <QLocalServer>
+#include <QLocalSocket>
+
+using namespace AirpodsTrayApp::Enums;
+
+namespace
+{
+    QJsonObject batteryJson(const Battery::BatteryState &state)
+    {
+        return QJsonObject{
+            {"level", state.level},
+            {"charging", state.status == Battery::BatteryStatus::Charging},
+            {"available", state.status != Battery::BatteryStatus::Disconnected},
+        };
+    }
+
+    QJsonObject reply(const QJsonObject &request, bool ok)
+    {
+        QJsonObject frame{{"ok", ok}};
+        if (request.contains("id"))
+        {
+            frame.insert("id", request.value("id"));
+        }
+        return frame;
+    }
+
+    QJsonObject errorReply(const QJsonObject &request, const QString &error)
+    {
+        QJsonObject frame = reply(request, false);
+        frame.insert("error", error);
+        return frame;
+    }
+}
+
+IpcServer::IpcServer(DeviceInfo *deviceInfo, QObject *parent)
+    : QObject(parent), m_deviceInfo(deviceInfo), m_server(new QLocalServer(this))
+{
+    connect(m_server, &QLocalServer::newConnection, this, &IpcServer::onNewConnection);
+
+    // Many signals fire for one packet, subscribers get one delta per burst
+    m_pushTimer.setSingleShot(true);
+    m_pushTimer.setInterval(PushIntervalMs);
+    connect(&m_pushTimer, &QTimer::timeout, this, &IpcServer::pushState);
+
+    connect(m_deviceInfo, &DeviceInfo::stateChanged, this, &IpcServer::scheduleStatePush);
+
+    m_publishedState = state();
+}
+
+bool IpcServer::listen()
+{
+    QLocalServer::removeServer(Ipc::ServerName);
+    return m_server->listen(Ipc::ServerName);
+}
+
+QString IpcServer::errorString() const
+{
+    return m_server->errorString();
+}
+
+void IpcServer::setConnected(bool connected)
+{
+    if (m_connected != connected)
+    {
+        m_connected = connected;
+        scheduleStatePush();
+    }
+}
+
+QJsonObject IpcServer::state() const
+{
+    const Battery::Snapshot battery = m_deviceInfo->getBattery()->snapshot();
+    const int noiseMode = m_deviceInfo->noiseControlModeInt();
+    return QJsonObject{
+        {"connected", m_connected},
+        {"deviceName", m_deviceInfo->deviceName()},
+        {"bluetoothAddress", m_deviceInfo->bluetoothAddress()},
+        {"model", static_cast<int>(m_deviceInfo->model())},
+        {"noiseControlMode", Ipc::noiseModeNames().value(noiseMode, QString::number(noiseMode))},
+        {"conversationalAwareness", m_deviceInfo->conversationalAwareness()},
+        {"adaptiveNoiseLevel", m_deviceInfo->adaptiveNoiseLevel()},
+        {"oneBudANCMode", m_deviceInfo->oneBudANCMode()},
+        {"battery", QJsonObject{
+            {"left", batteryJson(battery.state(Battery::Component::Left))},
+            {"right", batteryJson(battery.state(Battery::Component::Right))},
+            {"case", batteryJson(battery.state(Battery::Component::Case))},
+        }},
+        {"primaryPod", battery.primary == Battery::Component::Left ? "left" : "right"},
+        {"leftInEar", m_deviceInfo->isLeftPodInEar()},
+        {"rightInEar", m_deviceInfo->isRightPodInEar()},
+    };
+}
+
+void IpcServer::onNewConnection()
+{
+    while (QLocalSocket *socket = m_server->nextPendingConnection())
+    {
+        m_clients.insert(socket, Client());
+        connect(socket, &QLocalSocket::readyRead, this, [this, socket]() { onReadyRead(socket); });
+        connect(socket, &QLocalSocket::disconnected, this, [this, socket]()
+        {
+            m_clients.remove(socket);
+            socket->deleteLater();
+        });
+    }
+}
+
+void IpcServer::onReadyRead(QLocalSocket *socket)
+{
+    auto it = m_clients.find(socket);
+    if (it == m_clients.end())
+    {
+        return;
+    }
+    Client &client = it.value();
+    client.reader.append(socket->readAll());
+
+    if (client.mode == Client::Mode::Unknown)
+    {
+        // Frames are JSON objects, anything else is an old style one-word message
+        const QByteArray start = client.reader.buffer().trimmed();
+        if (start.isEmpty())
+        {
+            return;
+        }
+        client.mode = start.startsWith('{') ? Client::Mode::Framed : Client::Mode::Legacy;
+    }
+
+    if (client.mode == Client::Mode::Legacy)
+    {
+        const QByteArray message = client.reader.buffer().trimmed();
+        m_clients.erase(it);
+        handleLegacy(socket, message);
+        return;
+    }
+
+    QJsonObject frame;
+    QString error;
+    while (client.reader.next(frame, error))
+    {
+        if (!error.isEmpty())
+        {
+            send(socket, QJsonObject{{"ok", false}, {"error", error}});
+        }
+        else
+        {
+            handleFrame(socket, client, frame);
+        }
+        if (client.dropped)
+        {
+            return; // Stopped reading its replies, the rest of its input is ignored
+        }
+    }
+}
+
+void IpcServer::handleFrame(QLocalSocket *socket, Client &client, const QJsonObject &frame)
+{
+    const QString command = frame.value("cmd").toString();
+
+    if (command == "get-state")
+    {
+        QJsonObject response = reply(frame, true);
+        response.insert("state", state());
+        send(socket, response);
+    }
+    else if (command == "subscribe")
+    {
+        // Bring the other subscribers up to date first, so the snapshot and
+        // the deltas that follow it line up
+        if (m_pushTimer.isActive())
+        {
+            m_pushTimer.stop();
+            pushState();
+        }
+        client.subscribed = true;
+        QJsonObject response = reply(frame, true);
+        response.insert("state", m_publishedState);
+        send(socket, response);
+    }
+    else if (command == "unsubscribe")
+    {
+        client.subscribed = false;
+        send(socket, reply(frame, true));
+    }
+    else if (command == "set-noise-mode")
+    {
+        const QJsonValue value = frame.value("mode");
+        const int mode = Ipc::noiseModeFromString(value.isDouble() ? QString::number(value.toInt()) : value.toString());
+        if (mode < 0)
+        {
+            send(socket, errorReply(frame, "unknown noise control mode, expected one of " + Ipc::noiseModeNames().join(", ")));
+        }
+        else if (!m_connected)
+        {
+            send(socket, errorReply(frame, "AirPods are not connected"));
+        }
+        else
+        {
+            emit noiseControlModeRequested(static_cast<NoiseControlMode>(mode));
+            send(socket, reply(frame, true));
+        }
+    }
+    else if (command == "set-conversational-awareness")
+    {
+        if (!frame.value("enabled").isBool())
+        {
+            send(socket, errorReply(frame, "\"enabled\" must be true or false"));
+        }
+        else if (!m_connected)
+        {
+            send(socket, errorReply(frame, "AirPods are not connected"));
+        }
+        else
+        {
+            emit conversationalAwarenessRequested(frame.value("enabled").toBool());
+            send(socket, reply(frame, true));
+        }
+    }
+    else if (command == "reopen")
+    {
+        // Never the headless handoff, that is only for the launcher's bare "reopen"
+        if (m_openWindowHandler && m_openWindowHandler())
+        {
+            send(socket, reply(frame, true));
+        }
+        else
+        {
+            send(socket, errorReply(frame, "no window to open in a headless instance"));
+        }
+    }
+    else if (command == "metrics")
+    {
+        QJsonObject response = reply(frame, true);
+        if (frame.value("format").toString() == "json")
+        {
+            response.insert("metrics", QJsonDocument::fromJson(Metrics::Registry::instance().json()).object());
+        }
+        else
+        {
+            response.insert("metrics", QString::fromUtf8(Metrics::Registry::instance().prometheusText()));
+        }
+        send(socket, response);
+    }
+    else
+    {
+        send(socket, errorReply(frame, "unknown command: " + command));
+    }
+}
+
+void IpcServer::handleLegacy(QLocalSocket *socket, const QByteArray &message)
+{
+    if (message == "reopen")
+    {
+        socket->write(m_reopenHandler ? m_reopenHandler() : QByteArray("ok"));
+    }
+    else if (message == "metrics" || message == "metrics json")
+    {
+        // Snapshot for monitoring, Prometheus text format unless JSON is asked for
+        socket->write(message == "metrics" ? Metrics::Registry::instance().prometheusText()
+                                           : Metrics::Registry::instance().json());
+    }
+    else
+    {
+        LOG_ERROR("Unknown message received: " << message);
+    }
+    socket->flush();
+    socket->disconnectFromServer();
+}
+
+void IpcServer::send(QLocalSocket *socket, const QJsonObject &frame)
+{
+    auto it = m_clients.find(socket);
+    if (it == m_clients.end() || it->dropped)
+    {
+        return;
+    }
+    if (socket->bytesToWrite() > MaxPendingBytes)
+    {
+        // Callers may still hold the client, it is only removed once they have returned
+        LOG_WARN("IPC client is not reading its messages, disconnecting it");
+        it->dropped = true;
+        QMetaObject::invokeMethod(this, [this, socket]()
+        {
+            if (m_clients.remove(socket))
+            {
+                socket->abort();
+                socket->deleteLater();
+            }
+        }, Qt::QueuedConnection);
+        return;
+    }
+    socket->write(Ipc::encode(frame));
+}
+
+void IpcServer::scheduleStatePush()
+{
+    if (!m_pushTimer.isActive())
+    {
+        m_pushTimer.start();
+    }
+}
+
+void IpcServer::pushState()
+{
+    const QJsonObject current = state();
+    QJsonObject changed;
+    for (auto it = current.constBegin(); it != current.constEnd(); ++it)
+    {
+        if (m_publishedState.value(it.key()) != it.value())
+        {
+            changed.insert(it.key(), it.value());
+        }
+    }
+    m_publishedState = current;
+    if (changed.isEmpty())
+    {
+        return;
+    }
+
+    const QJsonObject event{{"event", "state"}, {"changed", changed}};
+    const QList<QLocalSocket *> sockets = m_clients.keys();
+    for (QLocalSocket *socket : sockets)
+    {
+        auto it = m_clients.constFind(socket);
+        if (it != m_clients.constEnd() && it->subscribed)
+        {
+            send(socket, event);
+        }
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <QObject>
+#include <QHash>
+#include <QJsonObject>
+#include <QTimer>
+#include <functional>
+
+#include "enums.h"
+#include "ipcprotocol.h"
+
+class DeviceInfo;
+class QLocalServer;
+class QLocalSocket;
+
+// The app_server local socket. Besides the single-instance handshake it serves
+// the command protocol in ipcprotocol.h to any number of concurrent clients,
+// and pushes state changes to subscribers instead of having them poll.
+class IpcServer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit IpcServer(DeviceInfo *deviceInfo, QObject *parent = nullptr);
+
+    bool listen();
+    QString errorString() const;
+
+    // Called for the launcher's bare "reopen", returns the reply for the launching instance
+    void setReopenHandler(std::function<QByteArray()> handler) { m_reopenHandler = std::move(handler); }
+    // Called for the "reopen" command, false if there is no window to open
+    void setOpenWindowHandler(std::function<bool()> handler) { m_openWindowHandler = std::move(handler); }
+    void setConnected(bool connected);
+
+    QJsonObject state() const;
+
+signals:
+    void noiseControlModeRequested(AirpodsTrayApp::Enums::NoiseControlMode mode);
+    void conversationalAwarenessRequested(bool enabled);
+
+private:
+    struct Client
+    {
+        enum class Mode
+        {
+            Unknown,
+            Framed,
+            Legacy,
+        };
+
+        Mode mode = Mode::Unknown;
+        Ipc::FrameReader reader;
+        bool subscribed = false;
+        bool dropped = false; // Fell too far behind, removed on the next event loop pass
+    };
+
+    void onNewConnection();
+    void onReadyRead(QLocalSocket *socket);
+    void handleFrame(QLocalSocket *socket, Client &client, const QJsonObject &frame);
+    void handleLegacy(QLocalSocket *socket, const QByteArray &message);
+    void send(QLocalSocket *socket, const QJsonObject &frame);
+    void scheduleStatePush();
+    void pushState();
+
+    // A client that stops reading is dropped once this much output is queued for it
+    static constexpr qint64 MaxPendingBytes = 1024 * 1024;
+    static constexpr int PushIntervalMs = 16;
+
+    DeviceInfo *m_deviceInfo;
+    QLocalServer *m_server;
+    QHash<QLocalSocket *, Client> m_clients;
+    std::function<QByteArray()> m_reopenHandler;
+    std::function<bool()> m_openWindowHandler;
+    bool m_connected = false;
+    QJsonObject m_publishedState;
+    QTimer m_pushTimer;
+};
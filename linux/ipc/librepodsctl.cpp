@@ -0,0 +1,150 @@
+// librepodsctl: command line client for a running librepods instance, for
+// scripts, hotkeys and status bars. Speaks the protocol in ipcprotocol.h.
+//
+//   librepodsctl state
+//   librepodsctl noise adaptive
+//   librepodsctl ca on
+//   librepodsctl watch        (prints one JSON line per state change)
+//   librepodsctl metrics [json]
+
+#include "ipcprotocol.h"
+
+#include <QCoreApplication>
+#include <QJsonDocument>
+#include <QLocalSocket>
+#include <QTextStream>
+#include <cstdio>
+
+namespace
+{
+    void usage()
+    {
+        QTextStream(stderr) << "Usage: librepodsctl state | noise <" << Ipc::noiseModeNames().join('|')
+                            << "> | ca <on|off> | watch | metrics [json]\n";
+    }
+
+    void print(const QJsonObject &object)
+    {
+        std::fputs(QJsonDocument(object).toJson(QJsonDocument::Compact).constData(), stdout);
+        std::fputc('\n', stdout);
+        std::fflush(stdout); // Status bars read line by line
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    const QStringList args = app.arguments().mid(1);
+    if (args.isEmpty())
+    {
+        usage();
+        return 2;
+    }
+
+    QJsonObject request{{"id", 1}};
+    const QString command = args[0];
+    bool watch = false;
+    if (command == "state")
+    {
+        request.insert("cmd", "get-state");
+    }
+    else if (command == "noise" && args.size() == 2)
+    {
+        request.insert("cmd", "set-noise-mode");
+        request.insert("mode", args[1]);
+    }
+    else if (command == "ca" && args.size() == 2 && (args[1] == "on" || args[1] == "off"))
+    {
+        request.insert("cmd", "set-conversational-awareness");
+        request.insert("enabled", args[1] == "on");
+    }
+    else if (command == "watch")
+    {
+        request.insert("cmd", "subscribe");
+        watch = true;
+    }
+    else if (command == "metrics")
+    {
+        request.insert("cmd", "metrics");
+        request.insert("format", args.value(1) == "json" ? "json" : "text");
+    }
+    else
+    {
+        usage();
+        return 2;
+    }
+
+    QLocalSocket socket;
+    socket.connectToServer(Ipc::ServerName);
+    if (!socket.waitForConnected(1000))
+    {
+        QTextStream(stderr) << "librepods is not running: " << socket.errorString() << '\n';
+        return 1;
+    }
+
+    int exitCode = 0;
+    Ipc::FrameReader reader;
+    QObject::connect(&socket, &QLocalSocket::readyRead, &app, [&]()
+    {
+        reader.append(socket.readAll());
+        QJsonObject frame;
+        QString error;
+        while (reader.next(frame, error))
+        {
+            if (!error.isEmpty())
+            {
+                QTextStream(stderr) << "Bad reply: " << error << '\n';
+                exitCode = 1;
+                app.quit();
+                return;
+            }
+
+            if (frame.contains("event"))
+            {
+                print(frame.value("changed").toObject());
+                continue;
+            }
+
+            if (!frame.value("ok").toBool())
+            {
+                QTextStream(stderr) << frame.value("error").toString() << '\n';
+                exitCode = 1;
+                app.quit();
+                return;
+            }
+
+            if (frame.contains("state"))
+            {
+                print(frame.value("state").toObject());
+            }
+            else if (frame.value("metrics").isString())
+            {
+                std::fputs(frame.value("metrics").toString().toUtf8().constData(), stdout);
+            }
+            else if (frame.value("metrics").isObject())
+            {
+                print(frame.value("metrics").toObject());
+            }
+
+            if (!watch)
+            {
+                app.quit();
+                return;
+            }
+        }
+    });
+    QObject::connect(&socket, &QLocalSocket::disconnected, &app, [&]()
+    {
+        if (watch)
+        {
+            QTextStream(stderr) << "librepods exited\n";
+            exitCode = 1;
+        }
+        app.quit();
+    });
+
+    socket.write(Ipc::encode(request));
+    socket.flush();
+    app.exec();
+    return exitCode;
+}
@@ -1,20 +1,26 @@
-#include <QSettings>
-#include <QLocalServer>
 #include <QLocalSocket>
+#include <QDBusServiceWatcher>
+#include <QEventLoop>
 #include <QApplication>
 #include <QQmlApplicationEngine>
 #include <QQmlContext>
 #include <QBluetoothLocalDevice>
-#include <QBluetoothSocket>
 #include <QQuickWindow>
 #include <QLoggingCategory>
 #include <QThread>
 #include <QTimer>
-#include <QProcess>
 #include <QRegularExpression>
+#include <QElapsedTimer>
+#include <QFile>
+#include <memory>
+#include <sys/resource.h>
+#include <unistd.h>
 
 #include "airpods_packets.h"
 #include "logger.h"
+#include "metrics.h"
+#include "trace.h"
+#include "aacp/aacpsession.h"
 #include "media/mediacontroller.h"
 #include "trayiconmanager.h"
 #include "enums.h"
@@ -24,13 +30,48 @@
 #include "deviceinfo.hpp"
 #include "ble/blemanager.h"
 #include "ble/bleutils.h"
+#include "ipc/dbusservice.h"
+#include "ipc/ipcserver.h"
 #include "QRCodeImageProvider.hpp"
 #include "systemsleepmonitor.hpp"
+#include "settingsstore.h"
+#include "statesnapshot.h"
 
 using namespace AirpodsTrayApp::Enums;
 
 Q_LOGGING_CATEGORY(librepods, "librepods")
 
+namespace
+{
+    // Resident set size of this process in kB, -1 if unknown
+    qint64 residentSetSizeKb()
+    {
+        QFile statm("/proc/self/statm");
+        if (!statm.open(QIODevice::ReadOnly))
+        {
+            return -1;
+        }
+        const QList<QByteArray> fields = statm.readAll().split(' ');
+        if (fields.size() < 2)
+        {
+            return -1;
+        }
+        return fields.at(1).toLongLong() * (sysconf(_SC_PAGESIZE) / 1024);
+    }
+
+    // User plus system CPU time used by this process so far
+    qint64 cpuTimeMs()
+    {
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0)
+        {
+            return -1;
+        }
+        return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000
+               + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000;
+    }
+}
+
 class AirPodsTrayApp : public QObject {
     Q_OBJECT
     Q_PROPERTY(bool airpodsConnected READ areAirpodsConnected NOTIFY airPodsStatusChanged)
@@ -44,37 +85,66 @@ class AirPodsTrayApp : public QObject {
     Q_PROPERTY(QString phoneMacStatus READ phoneMacStatus NOTIFY phoneMacStatusChanged)
 
 public:
-    AirPodsTrayApp(bool debugMode, bool hideOnStart, QQmlApplicationEngine *parent = nullptr)
-        : QObject(parent), debugMode(debugMode), m_settings(new QSettings("AirPodsTrayApp", "AirPodsTrayApp"))
-        , m_autoStartManager(new AutoStartManager(this)), m_hideOnStart(hideOnStart), parent(parent)
+    AirPodsTrayApp(bool debugMode, bool hideOnStart, bool headless, QObject *parent = nullptr)
+        : QObject(parent), debugMode(debugMode), m_headless(headless), m_settings(new SettingsStore("AirPodsTrayApp", "AirPodsTrayApp", this))
+        , m_autoStartManager(new AutoStartManager(this)), m_hideOnStart(hideOnStart)
         , m_deviceInfo(new DeviceInfo(this)), m_bleManager(new BleManager(this))
         , m_systemSleepMonitor(new SystemSleepMonitor(this))
     {
         QLoggingCategory::setFilterRules(QString("librepods.debug=%1").arg(debugMode ? "true" : "false"));
         LOG_INFO("Initializing LibrePods");
 
-        // Initialize tray icon and connect signals
-        trayManager = new TrayIconManager(this);
-        trayManager->setNotificationsEnabled(loadNotificationsEnabled());
-        connect(trayManager, &TrayIconManager::trayClicked, this, &AirPodsTrayApp::onTrayIconActivated);
-        connect(trayManager, &TrayIconManager::openApp, this, &AirPodsTrayApp::onOpenApp);
-        connect(trayManager, &TrayIconManager::openSettings, this, &AirPodsTrayApp::onOpenSettings);
-        connect(trayManager, &TrayIconManager::noiseControlChanged, this, &AirPodsTrayApp::setNoiseControlMode);
-        connect(trayManager, &TrayIconManager::conversationalAwarenessToggled, this, &AirPodsTrayApp::setConversationalAwareness);
-        connect(m_deviceInfo, &DeviceInfo::batteryStatusChanged, trayManager, &TrayIconManager::updateBatteryStatus);
-        connect(m_deviceInfo, &DeviceInfo::noiseControlModeChanged, trayManager, &TrayIconManager::updateNoiseControlState);
-        connect(m_deviceInfo, &DeviceInfo::conversationalAwarenessChanged, trayManager, &TrayIconManager::updateConversationalAwareness);
-        connect(trayManager, &TrayIconManager::notificationsEnabledChanged, this, &AirPodsTrayApp::saveNotificationsEnabled);
-        connect(trayManager, &TrayIconManager::notificationsEnabledChanged, this, &AirPodsTrayApp::notificationsEnabledChanged);
+        // Initialize tray icon and connect signals, there is no tray without a UI
+        if (!isHeadless())
+        {
+            if (hideOnStart)
+            {
+                // Tray only until the window is first opened
+                m_unloadedClock.start();
+                m_unloadedCpuMs = cpuTimeMs();
+            }
+
+            trayManager = new TrayIconManager(this);
+            trayManager->setNotificationsEnabled(loadNotificationsEnabled());
+            connect(trayManager, &TrayIconManager::trayClicked, this, &AirPodsTrayApp::onTrayIconActivated);
+            connect(trayManager, &TrayIconManager::openApp, this, &AirPodsTrayApp::onOpenApp);
+            connect(trayManager, &TrayIconManager::openSettings, this, &AirPodsTrayApp::onOpenSettings);
+            connect(trayManager, &TrayIconManager::noiseControlChanged, this, &AirPodsTrayApp::setNoiseControlMode);
+            connect(trayManager, &TrayIconManager::conversationalAwarenessToggled, this, &AirPodsTrayApp::setConversationalAwareness);
+            connect(m_deviceInfo, &DeviceInfo::batteryStatusChanged, trayManager, &TrayIconManager::updateBatteryStatus);
+            connect(m_deviceInfo->getBattery(), &Battery::batteryStatusChanged, trayManager, [this]()
+                    { trayManager->updateBattery(m_deviceInfo->getBattery()->snapshot()); });
+            connect(m_deviceInfo, &DeviceInfo::noiseControlModeChanged, trayManager, &TrayIconManager::updateNoiseControlState);
+            connect(m_deviceInfo, &DeviceInfo::conversationalAwarenessChanged, trayManager, &TrayIconManager::updateConversationalAwareness);
+            connect(trayManager, &TrayIconManager::notificationsEnabledChanged, this, &AirPodsTrayApp::saveNotificationsEnabled);
+            connect(trayManager, &TrayIconManager::notificationsEnabledChanged, this, &AirPodsTrayApp::notificationsEnabledChanged);
+        }
 
         // Initialize MediaController and connect signals
         mediaController = new MediaController(this);
         connect(mediaController, &MediaController::mediaStateChanged, this, &AirPodsTrayApp::handleMediaStateChange);
         mediaController->followMediaChanges();
 
+        // The AACP connection lives on its own I/O thread, the GUI only gets state snapshots
+        m_ioThread = new QThread(this);
+        m_ioThread->setObjectName("aacp-io");
+        m_session = new AacpSession();
+        m_session->moveToThread(m_ioThread);
+        connect(m_ioThread, &QThread::finished, m_session, &QObject::deleteLater);
+        connect(m_session, &AacpSession::stateChanged, this, &AirPodsTrayApp::onSessionStateChanged);
+        connect(m_session, &AacpSession::earDetectionChanged, this, &AirPodsTrayApp::onSessionEarDetectionChanged);
+        connect(m_session, &AacpSession::conversationalAwarenessData, mediaController, &MediaController::handleConversationalAwareness);
+        connect(m_session, &AacpSession::metadataReceived, this, &AirPodsTrayApp::onMetadataReceived);
+        connect(m_session, &AacpSession::magicKeysReceived, this, &AirPodsTrayApp::onMagicKeysReceived);
+        connect(m_session, &AacpSession::linkStateChanged, this, &AirPodsTrayApp::onSessionLinkStateChanged);
+        m_ioThread->start();
+
         monitor = new BluetoothMonitor(this);
         connect(monitor, &BluetoothMonitor::deviceConnected, this, &AirPodsTrayApp::bluezDeviceConnected);
         connect(monitor, &BluetoothMonitor::deviceDisconnected, this, &AirPodsTrayApp::bluezDeviceDisconnected);
+        connect(monitor, &BluetoothMonitor::connectFinished, this, &AirPodsTrayApp::onBluezConnectFinished);
+        connect(m_session, &AacpSession::deviceReleased, monitor, &BluetoothMonitor::disconnectDevice);
+        connect(mediaController, &MediaController::a2dpProfileActivated, this, &AirPodsTrayApp::onAudioRouted);
 
         connect(m_bleManager, &BleManager::deviceFound, this, &AirPodsTrayApp::bleDeviceFound);
         connect(m_deviceInfo->getBattery(), &Battery::primaryChanged, this, &AirPodsTrayApp::primaryChanged);
@@ -83,8 +153,42 @@ public:
 
         // Load settings
         CrossDevice.isEnabled = loadCrossDeviceEnabled();
+        m_session->setCrossDeviceEnabled(CrossDevice.isEnabled);
+        m_session->setPhoneAddress(qEnvironmentVariable("PHONE_MAC_ADDRESS"));
+        m_session->setRelayPeers(m_settings->value("crossdevice/peers").toStringList());
+        if (const QString localRelay = m_settings->value("crossdevice/localRelaySocket").toString(); !localRelay.isEmpty())
+        {
+            m_session->listenLocalRelay(localRelay);
+        }
         setEarDetectionBehavior(loadEarDetectionSettings());
         setRetryAttempts(loadRetryAttempts());
+        m_session->setPipelinedBringUp(m_settings->value("bluetooth/pipelinedBringUp", true).toBool());
+        if (m_settings->value("bluetooth/aacpMultiplexer", true).toBool())
+        {
+            m_session->listenMultiplexer();
+        }
+        mediaController->setConversationalAwarenessDucking(
+            m_settings->value("conversationalAwareness/duckFactor", 0.2).toDouble(),
+            m_settings->value("conversationalAwareness/attackMs", 150).toInt(),
+            m_settings->value("conversationalAwareness/releaseMs", 600).toInt());
+        {
+            EarDetectionDebouncer::Config debounce;
+            debounce.insertDelayMs = m_settings->value("earDetection/insertDelayMs", debounce.insertDelayMs).toInt();
+            debounce.removeDelayMs = m_settings->value("earDetection/removeDelayMs", debounce.removeDelayMs).toInt();
+            debounce.profileOnDelayMs = m_settings->value("earDetection/profileOnDelayMs", debounce.profileOnDelayMs).toInt();
+            debounce.profileOffDelayMs = m_settings->value("earDetection/profileOffDelayMs", debounce.profileOffDelayMs).toInt();
+            mediaController->setEarDetectionDebounce(debounce);
+        }
+        mediaController->setAutomaticHeadsetProfile(
+            m_settings->value("audio/autoHeadsetProfile", false).toBool(),
+            m_settings->value("audio/headsetReturnDelayMs", 1500).toInt());
+
+        // Show the last known state right away, it is marked stale until the AirPods answer
+        m_stateSnapshot = new StateSnapshot(m_deviceInfo, this);
+        if (m_stateSnapshot->restore())
+        {
+            mediaController->setKnownAudioCard(m_deviceInfo->bluetoothAddress().replace(":", "_"), m_stateSnapshot->audioCard());
+        }
 
         monitor->checkAlreadyConnectedDevices();
         LOG_INFO("AirPodsTrayApp initialized");
@@ -95,16 +199,8 @@ public:
         for (const QBluetoothAddress &address : connectedDevices) {
             QBluetoothDeviceInfo device(address, "", 0);
             if (isAirPodsDevice(device)) {
+                // The A2DP profile is activated once the session reports the link
                 connectToDevice(device);
-
-                // On startup after reboot, activate A2DP profile for already connected AirPods
-                QTimer::singleShot(2000, this, [this, address]()
-                {
-                    QString formattedAddress = address.toString().replace(":", "_");
-                    mediaController->setConnectedDeviceMacAddress(formattedAddress);
-                    mediaController->activateA2dpProfile();
-                    LOG_INFO("A2DP profile activation attempted for AirPods found on startup");
-                });
                 return;
             }
         }
@@ -116,17 +212,30 @@ public:
     ~AirPodsTrayApp() {
         saveCrossDeviceEnabled();
         saveEarDetectionSettings();
+        m_settings->flush();
+        m_stateSnapshot->save();
 
-        delete socket;
-        delete phoneSocket;
+        // Bindings must not outlive the object they read from
+        delete m_engine;
+
+        m_ioThread->quit();
+        m_ioThread->wait();
     }
 
-    bool areAirpodsConnected() const { return socket && socket->isOpen() && socket->state() == QBluetoothSocket::SocketState::ConnectedState; }
+    bool areAirpodsConnected() const { return m_session->isConnected(); }
     int earDetectionBehavior() const { return mediaController->getEarDetectionBehavior(); }
     bool crossDeviceEnabled() const { return CrossDevice.isEnabled; }
     AutoStartManager *autoStartManager() const { return m_autoStartManager; }
-    bool notificationsEnabled() const { return trayManager->notificationsEnabled(); }
-    void setNotificationsEnabled(bool enabled) { trayManager->setNotificationsEnabled(enabled); }
+    bool notificationsEnabled() const { return trayManager ? trayManager->notificationsEnabled() : loadNotificationsEnabled(); }
+    void setNotificationsEnabled(bool enabled)
+    {
+        if (trayManager)
+        {
+            trayManager->setNotificationsEnabled(enabled);
+        }
+    }
+    // Running without QML engine and tray, see --headless
+    bool isHeadless() const { return m_headless; }
     int retryAttempts() const { return m_retryAttempts; }
     bool hideOnStart() const { return m_hideOnStart; }
     DeviceInfo *deviceInfo() const { return m_deviceInfo; }
@@ -134,9 +243,13 @@ public:
 
 private:
     bool debugMode;
-    bool isConnectedLocally = false;
+    bool m_headless = false;
 
-    QQmlApplicationEngine *parent = nullptr;
+    // Created on the first request to show the window, see loadMainModule()
+    QQmlApplicationEngine *m_engine = nullptr;
+    QTimer *m_unloadTimer = nullptr;
+    QElapsedTimer m_unloadedClock;
+    qint64 m_unloadedCpuMs = -1;
 
     struct {
         bool isAvailable = true;
@@ -156,10 +269,9 @@ private:
             return;
         }
 
-        if (phoneSocket && phoneSocket->isOpen())
+        if (m_session->isPhoneConnected())
         {
-            phoneSocket->write(AirPodsPackets::Phone::NOTIFICATION);
-            LOG_DEBUG("Sent notification packet to Android: " << AirPodsPackets::Phone::NOTIFICATION.toHex());
+            m_session->notifyPhone();
         }
         else
         {
@@ -238,6 +350,7 @@ public slots:
         {
             LOG_DEBUG("Setting retry attempts to: " << attempts);
             m_retryAttempts = attempts;
+            m_session->setRetryAttempts(attempts);
             emit retryAttemptsChanged(attempts);
             saveRetryAttempts(attempts);
         }
@@ -245,7 +358,7 @@ public slots:
 
     void initiateMagicPairing()
     {
-        if (!socket || !socket->isOpen())
+        if (!areAirpodsConnected())
         {
             LOG_ERROR("Socket nicht offen, Magic Pairing kann nicht gestartet werden");
             return;
@@ -317,6 +430,7 @@ public slots:
         }
 
         CrossDevice.isEnabled = enabled;
+        m_session->setCrossDeviceEnabled(enabled);
         saveCrossDeviceEnabled();
         connectToPhone();
         emit crossDeviceEnabledChanged(enabled);
@@ -348,16 +462,12 @@ public slots:
         emit phoneMacStatusChanged();
 
         // Update QML context property so UI placeholders reflect the new value
-        if (parent) {
-            parent->rootContext()->setContextProperty("PHONE_MAC_ADDRESS", mac);
+        if (m_engine) {
+            m_engine->rootContext()->setContextProperty("PHONE_MAC_ADDRESS", mac);
         }
 
-        // If a phone socket exists, restart connection using the new MAC
-        if (phoneSocket && phoneSocket->isOpen()) {
-            phoneSocket->close();
-            phoneSocket->deleteLater();
-            phoneSocket = nullptr;
-        }
+        // Restart the phone connection using the new MAC
+        m_session->setPhoneAddress(mac);
         connectToPhone();
     }
 
@@ -369,10 +479,9 @@ public slots:
 
     bool writePacketToSocket(const QByteArray &packet, const QString &logMessage)
     {
-        if (socket && socket->isOpen())
+        if (areAirpodsConnected())
         {
-            socket->write(packet);
-            LOG_DEBUG(logMessage << packet.toHex());
+            m_session->sendPacket(packet, logMessage);
             return true;
         }
         else
@@ -396,6 +505,10 @@ public slots:
 
     void onSystemGoingToSleep()
     {
+        // Pending changes must not be lost if the machine never wakes up
+        m_settings->flush();
+        m_stateSnapshot->save();
+        m_session->suspend();
         if (m_bleManager->isScanning())
         {
             LOG_INFO("Stopping BLE scan before going to sleep");
@@ -407,18 +520,13 @@ public slots:
         LOG_INFO("System is waking up, starting ble scan");
         m_bleManager->startScan();
 
-        // Check if AirPods are already connected and activate A2DP profile
-        if (areAirpodsConnected() && m_deviceInfo && !m_deviceInfo->bluetoothAddress().isEmpty())
+        // Fast path: the AirPods kept their BlueZ link through the sleep, so the
+        // session reconnects at once and re-activates A2DP when it is up
+        const QString address = m_deviceInfo->bluetoothAddress();
+        if (!address.isEmpty() && QBluetoothLocalDevice().connectedDevices().contains(QBluetoothAddress(address)))
         {
-            LOG_INFO("AirPods already connected after wake-up, re-activating A2DP profile");
-            mediaController->setConnectedDeviceMacAddress(m_deviceInfo->bluetoothAddress().replace(":", "_"));
-
-            // Always activate A2DP profile after system wake since the profile might have been lost
-            QTimer::singleShot(1000, this, [this]()
-            {
-                mediaController->activateA2dpProfile();
-                LOG_INFO("A2DP profile activation attempted after system wake-up");
-            });
+            LOG_INFO("AirPods still connected after wake-up, resuming the session");
+            m_session->resume();
         }
 
         // Also check for already connected devices via BlueZ
@@ -428,79 +536,83 @@ public slots:
 private slots:
     void onTrayIconActivated()
     {
-        QQuickWindow *window = qobject_cast<QQuickWindow *>(
-            QGuiApplication::topLevelWindows().constFirst());
-        if (window)
-        {
-            window->show();
-            window->raise();
-            window->requestActivate();
-        }
+        openWindow("app");
     }
 
     void onOpenApp()
     {
-        QObject *rootObject = parent->rootObjects().first();
-        if (rootObject) {
-            QMetaObject::invokeMethod(rootObject, "reopen", Q_ARG(QVariant, "app"));
-        }
-        else
-        {
-            loadMainModule();
-        }
+        openWindow("app");
     }
 
     void onOpenSettings()
     {
-        QObject *rootObject = parent->rootObjects().first();
-        if (rootObject) {
-            QMetaObject::invokeMethod(rootObject, "reopen", Q_ARG(QVariant, "settings"));
-        }
-        else
-        {
-            loadMainModule();
-        }
-    }
-
-    void sendHandshake() {
-        LOG_INFO("Connected to device, sending initial packets");
-        writePacketToSocket(AirPodsPackets::Connection::HANDSHAKE, "Handshake packet written: ");
+        openWindow("settings");
     }
 
     void bluezDeviceConnected(const QString &address, const QString &name)
     {
         QBluetoothDeviceInfo device(QBluetoothAddress(address), name, 0);
         connectToDevice(device);
+    }
 
-        // After system reboot, AirPods might be connected but A2DP profile not active
-        // Attempt to activate A2DP profile after a delay to ensure connection is established
-        QTimer::singleShot(2000, this, [this, address]()
+    void onBluezConnectFinished(const QString &address, bool success, const QString &error)
+    {
+        if (!success)
         {
-            if (!address.isEmpty())
-            {
-                QString formattedAddress = address;
-                formattedAddress = formattedAddress.replace(":", "_");
-                mediaController->setConnectedDeviceMacAddress(formattedAddress);
-                mediaController->activateA2dpProfile();
-                LOG_INFO("A2DP profile activation attempted for newly connected device");
-            }
-        });
+            LOG_WARN("Could not connect to " << address << ": " << error);
+            m_handoffClock.invalidate();
+            return;
+        }
+        // The AACP session follows straight away instead of waiting for BlueZ's property change
+        connectToDevice(address);
     }
 
-    void onDeviceDisconnected(const QBluetoothAddress &address)
+    void onAudioRouted()
     {
-        LOG_INFO("Device disconnected: " << address.toString());
-        if (socket)
+        // The card may only have shown up after the link, remember it now
+        m_stateSnapshot->setAudioCard(mediaController->audioCardName());
+        if (!m_handoffClock.isValid())
         {
-            LOG_WARN("Socket is still open, closing it");
-            socket->close();
-            socket = nullptr;
+            return;
         }
-        if (phoneSocket && phoneSocket->isOpen())
+        static Metrics::Histogram &handoffLatency = Metrics::Registry::instance().histogram(
+            "librepods_audio_handoff_latency_ms", "Time from media starting to play to audio being routed to the AirPods",
+            {}, {250, 500, 1000, 2000, 3000, 5000, 7500, 10000, 20000});
+        const qint64 elapsed = m_handoffClock.elapsed();
+        m_handoffClock.invalidate();
+        handoffLatency.observe(elapsed);
+        LOG_INFO("Audio handed over to the AirPods in " << elapsed << " ms");
+    }
+
+    void onSessionLinkStateChanged(AacpSession::LinkState state)
+    {
+        emit airPodsStatusChanged();
+        if (state != AacpSession::LinkState::Connected)
         {
-            phoneSocket->write(AirPodsPackets::Connection::AIRPODS_DISCONNECTED);
-            LOG_DEBUG("AIRPODS_DISCONNECTED packet written: " << AirPodsPackets::Connection::AIRPODS_DISCONNECTED.toHex());
+            return;
+        }
+
+        m_deviceInfo->setStale(false);
+
+        // After a reboot, wake-up or reconnect the AirPods may be connected
+        // without the A2DP profile, so it is activated whenever the link comes up.
+        // The card often appears a moment later, MediaController waits for it.
+        const QString address = m_deviceInfo->bluetoothAddress();
+        if (!address.isEmpty())
+        {
+            mediaController->setConnectedDeviceMacAddress(QString(address).replace(":", "_"));
+            mediaController->activateA2dpProfile();
+            m_stateSnapshot->setAudioCard(mediaController->audioCardName());
+            LOG_INFO("A2DP profile activation requested for the connected AirPods");
         }
+    }
+
+    void onDeviceDisconnected(const QBluetoothAddress &address)
+    {
+        LOG_INFO("Device disconnected: " << address.toString());
+        m_session->disconnectDevice();
+
+        mediaController->handleDeviceDisconnected();
 
         // Clear the device name and model
         m_deviceInfo->reset();
@@ -508,10 +620,13 @@ private slots:
         emit airPodsStatusChanged();
 
         // Show system notification
-        trayManager->showNotification(
-            tr("AirPods Disconnected"),
-            tr("Your AirPods have been disconnected"));
-        trayManager->resetTrayIcon();
+        if (trayManager)
+        {
+            trayManager->showNotification(
+                tr("AirPods Disconnected"),
+                tr("Your AirPods have been disconnected"));
+            trayManager->resetTrayIcon();
+        }
     }
 
     void bluezDeviceDisconnected(const QString &address, const QString &name)
@@ -524,335 +639,85 @@ private slots:
         }
     }
 
-    void parseMetadata(const QByteArray &data)
+    void onMetadataReceived(const QString &deviceName, const QString &modelNumber, const QString &manufacturer)
     {
-        // Verify the data starts with the METADATA header
-        if (!data.startsWith(AirPodsPackets::Parse::METADATA))
-        {
-            LOG_ERROR("Invalid metadata packet: Incorrect header");
-            return;
-        }
-
-        int pos = AirPodsPackets::Parse::METADATA.size(); // Start after the header
-
-        // Check if there is enough data to skip the initial bytes (based on example structure)
-        if (data.size() < pos + 6)
-        {
-            LOG_ERROR("Metadata packet too short to parse initial bytes");
-            return;
-        }
-        pos += 6; // Skip 6 bytes after the header as per example structure
-
-        auto extractString = [&data, &pos]() -> QString
-        {
-            if (pos >= data.size())
-            {
-                return QString();
-            }
-            int start = pos;
-            while (pos < data.size() && data.at(pos) != '\0')
-            {
-                ++pos;
-            }
-            QString str = QString::fromUtf8(data.mid(start, pos - start));
-            if (pos < data.size())
-            {
-                ++pos; // Move past the null terminator
-            }
-            return str;
-        };
-
-        m_deviceInfo->setDeviceName(extractString());
-        m_deviceInfo->setModelNumber(extractString());
-        m_deviceInfo->setManufacturer(extractString());
+        m_deviceInfo->setDeviceName(deviceName);
+        m_deviceInfo->setModelNumber(modelNumber);
+        m_deviceInfo->setManufacturer(manufacturer);
 
         m_deviceInfo->setModel(parseModelNumber(m_deviceInfo->modelNumber()));
         emit modelChanged();
 
-        // Log extracted metadata
-        LOG_INFO("Parsed AirPods metadata:");
-        LOG_INFO("Device Name: " << m_deviceInfo->deviceName());
-        LOG_INFO("Model Number: " << m_deviceInfo->modelNumber());
-        LOG_INFO("Manufacturer: " << m_deviceInfo->manufacturer());
+        mediaController->setConnectedDeviceMacAddress(m_deviceInfo->bluetoothAddress().replace(":", "_"));
+        if (m_deviceInfo->getEarDetection()->oneOrMorePodsInEar()) // AirPods get added as output device only after this
+        {
+            mediaController->activateA2dpProfile();
+        }
+        m_bleManager->stopScan();
+        emit airPodsStatusChanged();
     }
 
-    QString getEarStatus(char value)
+    void onMagicKeysReceived(const QByteArray &irk, const QByteArray &encKey)
     {
-        return (value == 0x00) ? "In Ear" : (value == 0x01) ? "Out of Ear"
-                                                            : "In case";
+        m_deviceInfo->setMagicAccIRK(irk);
+        m_deviceInfo->setMagicAccEncKey(encKey);
+        m_deviceInfo->saveToSettings(*m_settings);
     }
 
-    void connectToDevice(const QBluetoothDeviceInfo &device)
+    void onSessionEarDetectionChanged(EarDetection::EarDetectionStatus primary, EarDetection::EarDetectionStatus secondary)
     {
-        if (socket && socket->isOpen() && socket->peerAddress() == device.address())
-        {
-            LOG_INFO("Already connected to the device: " << device.name());
-            return;
-        }
-
-        LOG_INFO("Connecting to device: " << device.name());
-
-        // Clean up any existing socket
-        if (socket)
-        {
-            socket->close();
-            socket->deleteLater();
-            socket = nullptr;
-        }
-
-        QBluetoothSocket *localSocket = new QBluetoothSocket(QBluetoothServiceInfo::L2capProtocol);
-        socket = localSocket;
-
-        // Connection handler
-        auto handleConnection = [this, localSocket]()
-        {
-            connect(localSocket, &QBluetoothSocket::readyRead, this, [this, localSocket]()
-                    {
-            QByteArray data = localSocket->readAll();
-            QMetaObject::invokeMethod(this, "parseData", Qt::QueuedConnection, Q_ARG(QByteArray, data));
-            QMetaObject::invokeMethod(this, "relayPacketToPhone", Qt::QueuedConnection, Q_ARG(QByteArray, data)); });
-            sendHandshake();
-        };
-
-        // Error handler with retry
-        auto handleError = [this, device, localSocket](QBluetoothSocket::SocketError error)
-        {
-            LOG_ERROR("Socket error: " << error << ", " << localSocket->errorString());
-
-            static int retryCount = 0;
-            if (retryCount < m_retryAttempts)
-            {
-                retryCount++;
-                LOG_INFO("Retrying connection (attempt " << retryCount << ")");
-                QTimer::singleShot(1500, this, [this, device]()
-                                   { connectToDevice(device); });
-            }
-            else
-            {
-                LOG_ERROR("Failed to connect after 3 attempts");
-                retryCount = 0;
-            }
-        };
-
-        connect(localSocket, &QBluetoothSocket::connected, this, handleConnection);
-        connect(localSocket, QOverload<QBluetoothSocket::SocketError>::of(&QBluetoothSocket::errorOccurred),
-                this, handleError);
-
-        localSocket->connectToService(device.address(), QBluetoothUuid("74ec2172-0bad-4d01-8f77-997b2be0722a"));
-        m_deviceInfo->setBluetoothAddress(device.address().toString());
-        notifyAndroidDevice();
+        m_deviceInfo->getEarDetection()->setStatus(primary, secondary);
+        mediaController->handleEarDetection(m_deviceInfo->getEarDetection());
     }
 
-    void parseData(const QByteArray &data)
+    void onSessionStateChanged(const AacpSession::DeviceState &state)
     {
-        LOG_DEBUG("Received: " << data.toHex());
-
-        if (data.startsWith(AirPodsPackets::Parse::HANDSHAKE_ACK))
-        {
-            writePacketToSocket(AirPodsPackets::Connection::SET_SPECIFIC_FEATURES, "Set specific features packet written: ");
-        }
-        else if (data.startsWith(AirPodsPackets::Parse::FEATURES_ACK))
+        m_deviceInfo->setStale(false);
+        if (state.changed & AacpSession::DeviceState::BatteryField)
         {
-            writePacketToSocket(AirPodsPackets::Connection::REQUEST_NOTIFICATIONS, "Request notifications packet written: ");
-            
-            QTimer::singleShot(2000, this, [this]() {
-                if (m_deviceInfo->batteryStatus().isEmpty()) {
-                    writePacketToSocket(AirPodsPackets::Connection::REQUEST_NOTIFICATIONS, "Request notifications packet written: ");
-                }
-            });
+            m_deviceInfo->getBattery()->applySnapshot(state.battery);
         }
-        // Magic Cloud Keys Response
-        else if (data.startsWith(AirPodsPackets::MagicPairing::MAGIC_CLOUD_KEYS_HEADER))
+        if (state.changed & AacpSession::DeviceState::EarDetectionField)
         {
-            auto keys = AirPodsPackets::MagicPairing::parseMagicCloudKeysPacket(data);
-            LOG_INFO("Received Magic Cloud Keys:");
-            LOG_INFO("MagicAccIRK: " << keys.magicAccIRK.toHex());
-            LOG_INFO("MagicAccEncKey: " << keys.magicAccEncKey.toHex());
-
-            // Store the keys
-            m_deviceInfo->setMagicAccIRK(keys.magicAccIRK);
-            m_deviceInfo->setMagicAccEncKey(keys.magicAccEncKey);
-            m_deviceInfo->saveToSettings(*m_settings);
-        }
-        // Get CA state
-        else if (data.startsWith(AirPodsPackets::ConversationalAwareness::HEADER)) {
-            if (auto result = AirPodsPackets::ConversationalAwareness::parseState(data))
-            {
-                m_deviceInfo->setConversationalAwareness(result.value());
-                LOG_INFO("Conversational awareness state received: " << m_deviceInfo->conversationalAwareness());
-            }
+            m_deviceInfo->getEarDetection()->setStatus(state.primaryEar, state.secondaryEar);
         }
-        // Noise Control Mode
-        else if (data.size() == 11 && data.startsWith(AirPodsPackets::NoiseControl::HEADER))
+        if (state.changed & AacpSession::DeviceState::NoiseControlField)
         {
-            if (auto value = AirPodsPackets::NoiseControl::parseMode(data))
-            {
-                m_deviceInfo->setNoiseControlMode(value.value());
-                LOG_INFO("Noise control mode received: " << m_deviceInfo->noiseControlMode());
-            }
-        }
-        // Ear Detection
-        else if (data.size() == 8 && data.startsWith(AirPodsPackets::Parse::EAR_DETECTION))
-        {
-            m_deviceInfo->getEarDetection()->parseData(data);
-            mediaController->handleEarDetection(m_deviceInfo->getEarDetection());
+            m_deviceInfo->setNoiseControlMode(state.noiseControlMode);
         }
-        // Battery Status
-        else if (data.size() == 22 && data.startsWith(AirPodsPackets::Parse::BATTERY_STATUS))
+        if (state.changed & AacpSession::DeviceState::ConversationalAwarenessField)
         {
-            m_deviceInfo->getBattery()->parsePacket(data);
-            m_deviceInfo->updateBatteryStatus();
-            LOG_INFO("Battery status: " << m_deviceInfo->batteryStatus());
-        }
-        // Conversational Awareness Data
-        else if (data.size() == 10 && data.startsWith(AirPodsPackets::ConversationalAwareness::DATA_HEADER))
-        {
-            LOG_INFO("Received conversational awareness data");
-            mediaController->handleConversationalAwareness(data);
-        }
-        else if (data.startsWith(AirPodsPackets::Parse::METADATA))
-        {
-            parseMetadata(data);
-            initiateMagicPairing();
-            mediaController->setConnectedDeviceMacAddress(m_deviceInfo->bluetoothAddress().replace(":", "_"));
-            if (m_deviceInfo->getEarDetection()->oneOrMorePodsInEar()) // AirPods get added as output device only after this
-            {
-                mediaController->activateA2dpProfile();
-            }
-            m_bleManager->stopScan();
-            emit airPodsStatusChanged();
-        }
-        else if (data.startsWith(AirPodsPackets::OneBudANCMode::HEADER)) {
-            if (auto value = AirPodsPackets::OneBudANCMode::parseState(data))
-            {
-                m_deviceInfo->setOneBudANCMode(value.value());
-                LOG_INFO("One Bud ANC mode received: " << m_deviceInfo->oneBudANCMode());
-            }
+            m_deviceInfo->setConversationalAwareness(state.conversationalAwareness);
         }
-        else
+        if (state.changed & AacpSession::DeviceState::OneBudANCField)
         {
-            LOG_DEBUG("Unrecognized packet format: " << data.toHex());
-        }
-    }
-
-    void connectToPhone() {
-        if (!CrossDevice.isEnabled) {
-            return;
-        }
-
-        if (phoneSocket && phoneSocket->isOpen()) {
-            LOG_INFO("Already connected to the phone");
-            return;
+            m_deviceInfo->setOneBudANCMode(state.oneBudANCMode);
         }
-        QBluetoothAddress phoneAddress("00:00:00:00:00:00"); // Default address, will be overwritten if PHONE_MAC_ADDRESS is set
-        QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
-        
-        if (!env.value("PHONE_MAC_ADDRESS").isEmpty())
-        {
-            phoneAddress = QBluetoothAddress(env.value("PHONE_MAC_ADDRESS"));
-        }
-        phoneSocket = new QBluetoothSocket(QBluetoothServiceInfo::L2capProtocol);
-        connect(phoneSocket, &QBluetoothSocket::connected, this, [this]() {
-            LOG_INFO("Connected to phone");
-            if (!lastBatteryStatus.isEmpty()) {
-                phoneSocket->write(lastBatteryStatus);
-                LOG_DEBUG("Sent last battery status to phone: " << lastBatteryStatus.toHex());
-            }
-            if (!lastEarDetectionStatus.isEmpty()) {
-                phoneSocket->write(lastEarDetectionStatus);
-                LOG_DEBUG("Sent last ear detection status to phone: " << lastEarDetectionStatus.toHex());
-            }
-        });
-
-        connect(phoneSocket, QOverload<QBluetoothSocket::SocketError>::of(&QBluetoothSocket::errorOccurred), this, [this](QBluetoothSocket::SocketError error) {
-            LOG_ERROR("Phone socket error: " << error << ", " << phoneSocket->errorString());
-        });
-
-        phoneSocket->connectToService(phoneAddress, QBluetoothUuid("1abbb9a4-10e4-4000-a75c-8953c5471342"));
     }
 
-    void relayPacketToPhone(const QByteArray &packet)
+    QString getEarStatus(char value)
     {
-        if (!CrossDevice.isEnabled) {
-            return;
-        }
-        if (phoneSocket && phoneSocket->isOpen())
-        {
-            phoneSocket->write(AirPodsPackets::Phone::NOTIFICATION + packet);
-        }
-        else
-        {
-            connectToPhone();
-            LOG_WARN("Phone socket is not open, cannot relay packet");
-        }
+        return (value == 0x00) ? "In Ear" : (value == 0x01) ? "Out of Ear"
+                                                            : "In case";
     }
 
-    void handlePhonePacket(const QByteArray &packet) {
-        if (packet.startsWith(AirPodsPackets::Phone::NOTIFICATION))
-        {
-            QByteArray airpodsPacket = packet.mid(4);
-            if (socket && socket->isOpen()) {
-                socket->write(airpodsPacket);
-                LOG_DEBUG("Relayed packet to AirPods: " << airpodsPacket.toHex());
-            } else {
-                LOG_ERROR("Socket is not open, cannot relay packet to AirPods");
-            }
-        }
-        else if (packet.startsWith(AirPodsPackets::Phone::CONNECTED))
-        {
-            LOG_INFO("AirPods connected");
-            isConnectedLocally = true;
-            CrossDevice.isAvailable = false;
-        }
-        else if (packet.startsWith(AirPodsPackets::Phone::DISCONNECTED))
-        {
-            LOG_INFO("AirPods disconnected");
-            isConnectedLocally = false;
-            CrossDevice.isAvailable = true;
-        }
-        else if (packet.startsWith(AirPodsPackets::Phone::STATUS_REQUEST))
-        {
-            LOG_INFO("Connection status request received");
-            QByteArray response = (socket && socket->isOpen()) ? AirPodsPackets::Phone::CONNECTED
-                                                               : AirPodsPackets::Phone::DISCONNECTED;
-            phoneSocket->write(response);
-            LOG_DEBUG("Sent connection status response: " << response.toHex());
-        }
-        else if (packet.startsWith(AirPodsPackets::Phone::DISCONNECT_REQUEST))
-        {
-            LOG_INFO("Disconnect request received");
-            if (socket && socket->isOpen()) {
-                socket->close();
-                LOG_INFO("Disconnected from AirPods");
-                QProcess process;
-                process.start("bluetoothctl", QStringList() << "disconnect" << m_deviceInfo->bluetoothAddress());
-                process.waitForFinished();
-                QString output = process.readAllStandardOutput().trimmed();
-                LOG_INFO("Bluetoothctl output: " << output);
-                isConnectedLocally = false;
-                CrossDevice.isAvailable = true;
-            }
-        }
-        else
-        {
-            if (socket && socket->isOpen()) {
-                socket->write(packet);
-                LOG_DEBUG("Relayed packet to AirPods: " << packet.toHex());
-            } else {
-                LOG_ERROR("Socket is not open, cannot relay packet to AirPods");
-            }
-        }
+    void connectToDevice(const QBluetoothDeviceInfo &device)
+    {
+        LOG_INFO("Connecting to device: " << device.name());
+        m_session->connectToDevice(device.address().toString());
+        m_deviceInfo->setBluetoothAddress(device.address().toString());
+        notifyAndroidDevice();
     }
 
-    void onPhoneDataReceived() {
-        QByteArray data = phoneSocket->readAll();
-        LOG_DEBUG("Data received from phone: " << data.toHex());
-        QMetaObject::invokeMethod(this, "handlePhonePacket", Qt::QueuedConnection, Q_ARG(QByteArray, data));
-    }
+    void connectToPhone() { m_session->connectToPhone(); }
 
     void bleDeviceFound(const BleInfo &device)
     {
         if (BLEUtils::isValidIrkRpa(m_deviceInfo->magicAccIRK(), device.address)) {
+            static Metrics::Counter &resolved = Metrics::counter("librepods_ble_adverts_resolved_total",
+                                                                 "Adverts whose address resolved with the AirPods' IRK");
+            resolved.inc();
+            m_deviceInfo->setStale(false);
             m_deviceInfo->setModel(device.modelName);
             auto decryptet = BLEUtils::decryptLastBytes(device.encryptedPayload, m_deviceInfo->magicAccEncKey());
             m_deviceInfo->getBattery()->parseEncryptedPacket(decryptet, device.primaryLeft, device.isThisPodInTheCase);
@@ -864,6 +729,9 @@ public:
     void handleMediaStateChange(MediaController::MediaState state) {
         if (state == MediaController::MediaState::Playing) {
             LOG_INFO("Media started playing, sending disconnect request to Android and taking over audio");
+            if (!areAirpodsConnected()) {
+                m_handoffClock.start();
+            }
             sendDisconnectRequestToAndroid();
             connectToAirPods(true);
         }
@@ -873,10 +741,9 @@ public:
     {
         if (!CrossDevice.isEnabled) return;
 
-        if (phoneSocket && phoneSocket->isOpen())
+        if (m_session->isPhoneConnected())
         {
-            phoneSocket->write(AirPodsPackets::Phone::DISCONNECT_REQUEST);
-            LOG_DEBUG("Sent disconnect request to Android: " << AirPodsPackets::Phone::DISCONNECT_REQUEST.toHex());
+            m_session->sendDisconnectRequestToPhone();
         }
         else
         {
@@ -885,22 +752,20 @@ public:
     }
 
     bool isPhoneConnected() {
-        return phoneSocket && phoneSocket->isOpen();
+        return m_session->isPhoneConnected();
     }
 
     void connectToAirPods(bool force) {
-        if (socket && socket->isOpen()) {
+        if (areAirpodsConnected()) {
             LOG_INFO("Already connected to AirPods");
             return;
         }
 
         if (force) {
+            // Continues in onBluezConnectFinished once BlueZ has the link up
             LOG_INFO("Forcing connection to AirPods");
-            QProcess process;
-            process.start("bluetoothctl", QStringList() << "connect" << m_deviceInfo->bluetoothAddress());
-            process.waitForFinished();
-            QString output = process.readAllStandardOutput().trimmed();
-            LOG_INFO("Bluetoothctl output: " << output);
+            monitor->connectDevice(m_deviceInfo->bluetoothAddress());
+            return;
         }
         QBluetoothLocalDevice localDevice;
         const QList<QBluetoothAddress> connectedDevices = localDevice.connectedDevices();
@@ -924,8 +789,98 @@ public:
         }
     }
 
+    void openWindow(const QString &page)
+    {
+        if (isHeadless())
+        {
+            return;
+        }
+
+        loadMainModule();
+        QObject *rootObject = m_engine->rootObjects().value(0);
+        if (rootObject)
+        {
+            QMetaObject::invokeMethod(rootObject, "reopen", Q_ARG(QVariant, page));
+        }
+    }
+
+    // The QML engine and window only exist while they are needed. They are
+    // created on the first open and, when ui/unloadAfterCloseMs is set, torn
+    // down again once the window has been closed for that long.
     void loadMainModule() {
-        parent->load(QUrl(QStringLiteral("qrc:/linux/Main.qml")));
+        if (m_engine && !m_engine->rootObjects().isEmpty())
+        {
+            return;
+        }
+
+        if (!m_engine)
+        {
+            static bool typesRegistered = false;
+            if (!typesRegistered)
+            {
+                qmlRegisterType<Battery>("me.kavishdevar.Battery", 1, 0, "Battery");
+                qmlRegisterType<DeviceInfo>("me.kavishdevar.DeviceInfo", 1, 0, "DeviceInfo");
+                typesRegistered = true;
+            }
+
+            m_engine = new QQmlApplicationEngine(this);
+            m_engine->rootContext()->setContextProperty("airPodsTrayApp", this);
+            // Expose PHONE_MAC_ADDRESS to QML for the placeholder in settings
+            m_engine->rootContext()->setContextProperty("PHONE_MAC_ADDRESS", qEnvironmentVariable("PHONE_MAC_ADDRESS"));
+            m_engine->addImageProvider("qrcode", new QRCodeImageProvider());
+        }
+
+        m_engine->load(QUrl(QStringLiteral("qrc:/linux/Main.qml")));
+
+        if (m_unloadedClock.isValid())
+        {
+            LOG_INFO("Loading window after " << m_unloadedClock.elapsed() / 1000 << " s unloaded, CPU used meanwhile: "
+                     << cpuTimeMs() - m_unloadedCpuMs << " ms, RSS before load: " << residentSetSizeKb() << " kB");
+            m_unloadedClock.invalidate();
+        }
+
+        auto *window = qobject_cast<QQuickWindow *>(m_engine->rootObjects().value(0));
+        int unloadAfterMs = m_settings->value("ui/unloadAfterCloseMs", -1).toInt();
+        if (window && unloadAfterMs >= 0)
+        {
+            if (!m_unloadTimer)
+            {
+                m_unloadTimer = new QTimer(this);
+                m_unloadTimer->setSingleShot(true);
+                connect(m_unloadTimer, &QTimer::timeout, this, &AirPodsTrayApp::unloadMainModule);
+            }
+            m_unloadTimer->setInterval(unloadAfterMs);
+            connect(window, &QWindow::visibleChanged, this, [this](bool visible)
+            {
+                if (visible)
+                    m_unloadTimer->stop();
+                else
+                    m_unloadTimer->start();
+            });
+            if (!window->isVisible())
+            {
+                m_unloadTimer->start();
+            }
+        }
+    }
+
+    void unloadMainModule()
+    {
+        if (!m_engine)
+        {
+            return;
+        }
+
+        LOG_INFO("Window closed for a while, unloading QML (RSS " << residentSetSizeKb() << " kB)");
+        QQmlApplicationEngine *engine = m_engine;
+        m_engine = nullptr;
+        connect(engine, &QObject::destroyed, this, [this]()
+        {
+            m_unloadedClock.start();
+            m_unloadedCpuMs = cpuTimeMs();
+            LOG_INFO("QML unloaded, RSS " << residentSetSizeKb() << " kB");
+        });
+        engine->deleteLater();
     }
 
 signals:
@@ -946,25 +901,55 @@ signals:
     void phoneMacStatusChanged();
 
 private:
-    QBluetoothSocket *socket = nullptr;
-    QBluetoothSocket *phoneSocket = nullptr;
-    QByteArray lastBatteryStatus;
-    QByteArray lastEarDetectionStatus;
+    QThread *m_ioThread = nullptr;
+    AacpSession *m_session = nullptr;
     MediaController* mediaController;
-    TrayIconManager *trayManager;
+    TrayIconManager *trayManager = nullptr;
     BluetoothMonitor *monitor;
-    QSettings *m_settings;
+    SettingsStore *m_settings;
     AutoStartManager *m_autoStartManager;
     int m_retryAttempts = 3;
     bool m_hideOnStart = false;
     DeviceInfo *m_deviceInfo;
+    StateSnapshot *m_stateSnapshot = nullptr;
+    QElapsedTimer m_handoffClock; // Valid while taking the audio over from the phone
     BleManager *m_bleManager;
     SystemSleepMonitor *m_systemSleepMonitor = nullptr;
     QString m_phoneMacStatus;
 };
 
 int main(int argc, char *argv[]) {
-    QApplication app(argc, argv);
+    QElapsedTimer startupClock;
+    startupClock.start();
+
+    bool debugMode = false;
+    bool hideOnStart = false;
+    bool headless = false;
+    QString traceFile;
+    for (int i = 1; i < argc; ++i) {
+        if (qstrcmp(argv[i], "--debug") == 0)
+            debugMode = true;
+
+        if (qstrcmp(argv[i], "--hide") == 0)
+            hideOnStart = true;
+
+        if (qstrcmp(argv[i], "--headless") == 0)
+            headless = true;
+
+        if (qstrcmp(argv[i], "--trace-file") == 0 && i + 1 < argc)
+            traceFile = QString::fromLocal8Bit(argv[++i]);
+    }
+
+    // Headless runs the Bluetooth, BLE and media logic only, without widgets or Qt Quick
+    std::unique_ptr<QCoreApplication> app;
+    if (headless)
+        app = std::make_unique<QCoreApplication>(argc, argv);
+    else
+        app = std::make_unique<QApplication>(argc, argv);
+
+    // Per-packet events are only recorded while tracing, see trace.h
+    if (debugMode || !traceFile.isEmpty())
+        Trace::start(traceFile);
 
     QSharedMemory sharedMemory;
     sharedMemory.setKey("TcpServer-Key");
@@ -977,12 +962,44 @@ int main(int argc, char *argv[]) {
         // Connect to the original app, then trigger the reopen signal
         socket.connectToServer("app_server");
         if (socket.waitForConnected(500)) {
+            if (headless) {
+                LOG_INFO("Not starting a second headless instance");
+                return 0;
+            }
             socket.write("reopen");
             socket.flush();
             socket.waitForBytesWritten(500);
-            socket.disconnectFromServer();
-            app.exit(); // exit; process already running
-            return 0;
+
+            // A headless instance has no window to show, it hands the device over to us instead
+            bool handoff = socket.waitForReadyRead(500) && socket.readAll() == "handoff";
+            if (!handoff) {
+                socket.disconnectFromServer();
+                return 0; // exit; process already running
+            }
+
+            LOG_INFO("Headless instance is handing over, starting the UI");
+            // The lock is free once the headless instance has quit, which shows as it
+            // leaving the session bus and closing our socket. Without a session bus
+            // only the retry timer notices, the deadline bounds the wait.
+            QEventLoop waitForExit;
+            auto tryLock = [&sharedMemory, &waitForExit]() {
+                if (sharedMemory.isAttached() || sharedMemory.create(1))
+                    waitForExit.exit(0);
+            };
+            QDBusServiceWatcher watcher(DBusService::ServiceName, QDBusConnection::sessionBus(),
+                                        QDBusServiceWatcher::WatchForUnregistration);
+            QObject::connect(&watcher, &QDBusServiceWatcher::serviceUnregistered, &waitForExit, tryLock);
+            QObject::connect(&socket, &QLocalSocket::disconnected, &waitForExit, tryLock);
+            QTimer retry;
+            retry.setInterval(100);
+            QObject::connect(&retry, &QTimer::timeout, &waitForExit, tryLock);
+            QTimer::singleShot(10000, &waitForExit, [&waitForExit]() { waitForExit.exit(1); });
+            retry.start();
+            tryLock();
+            if (!sharedMemory.isAttached() && waitForExit.exec() != 0) {
+                LOG_ERROR("Headless instance did not exit, giving up");
+                return 1;
+            }
         }
         else
         {
@@ -991,41 +1008,63 @@ int main(int argc, char *argv[]) {
             LOG_DEBUG("Socket error: " << socket.errorString());
         }
     }
-    app.setDesktopFileName("me.kavishdevar.librepods");
-    app.setQuitOnLastWindowClosed(false);
 
-    bool debugMode = false;
-    bool hideOnStart = false;
-    for (int i = 1; i < argc; ++i) {
-        if (QString(argv[i]) == "--debug")
-            debugMode = true;
-
-        if (QString(argv[i]) == "--hide")
-            hideOnStart = true;
+    if (!headless)
+    {
+        QGuiApplication::setDesktopFileName("me.kavishdevar.librepods");
+        QGuiApplication::setQuitOnLastWindowClosed(false);
     }
 
-    QQmlApplicationEngine engine;
-    qmlRegisterType<Battery>("me.kavishdevar.Battery", 1, 0, "Battery");
-    qmlRegisterType<DeviceInfo>("me.kavishdevar.DeviceInfo", 1, 0, "DeviceInfo");
-    AirPodsTrayApp *trayApp = new AirPodsTrayApp(debugMode, hideOnStart, &engine);
-    engine.rootContext()->setContextProperty("airPodsTrayApp", trayApp);
-
-    // Expose PHONE_MAC_ADDRESS environment variable to QML for placeholder in settings
+    auto trayApp = std::make_unique<AirPodsTrayApp>(debugMode, hideOnStart, headless);
     {
-        QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
-        QString phoneMacEnv = env.value("PHONE_MAC_ADDRESS", "");
-        engine.rootContext()->setContextProperty("PHONE_MAC_ADDRESS", phoneMacEnv);
         // Initialize the visible status in the GUI
+        QString phoneMacEnv = qEnvironmentVariable("PHONE_MAC_ADDRESS");
         trayApp->updatePhoneMacStatus(phoneMacEnv.isEmpty() ? QStringLiteral("No phone MAC set") : phoneMacEnv);
     }
 
-    engine.addImageProvider("qrcode", new QRCodeImageProvider());
-    trayApp->loadMainModule();
+    // With --hide the QML engine is only created once the window is first opened
+    if (!headless && !hideOnStart)
+    {
+        trayApp->loadMainModule();
+    }
+
+    IpcServer server(trayApp->deviceInfo());
+    server.setReopenHandler([&trayApp, &app]() -> QByteArray {
+        if (trayApp->isHeadless()) {
+            LOG_INFO("UI instance starting, handing the device over");
+            QTimer::singleShot(0, app.get(), &QCoreApplication::quit);
+            return "handoff";
+        }
+        LOG_INFO("Reopening app window");
+        trayApp->openWindow("app");
+        return "ok";
+    });
+    server.setOpenWindowHandler([&trayApp]() {
+        if (trayApp->isHeadless()) {
+            return false;
+        }
+        LOG_INFO("Reopening app window");
+        trayApp->openWindow("app");
+        return true;
+    });
+    server.setConnected(trayApp->areAirpodsConnected());
+    QObject::connect(trayApp.get(), &AirPodsTrayApp::airPodsStatusChanged, &server, [&server, &trayApp]() {
+        server.setConnected(trayApp->areAirpodsConnected());
+    });
+    QObject::connect(&server, &IpcServer::noiseControlModeRequested, trayApp.get(), &AirPodsTrayApp::setNoiseControlMode);
+    QObject::connect(&server, &IpcServer::conversationalAwarenessRequested, trayApp.get(), &AirPodsTrayApp::setConversationalAwareness);
 
-    QLocalServer server;
-    QLocalServer::removeServer("app_server");
+    DBusService dbusService(trayApp->deviceInfo());
+    dbusService.setConnected(trayApp->areAirpodsConnected());
+    QObject::connect(trayApp.get(), &AirPodsTrayApp::airPodsStatusChanged, &dbusService, [&dbusService, &trayApp]() {
+        dbusService.setConnected(trayApp->areAirpodsConnected());
+    });
+    QObject::connect(&dbusService, &DBusService::noiseControlModeRequested, trayApp.get(), &AirPodsTrayApp::setNoiseControlMode);
+    QObject::connect(&dbusService, &DBusService::conversationalAwarenessRequested, trayApp.get(), &AirPodsTrayApp::setConversationalAwareness);
+    QObject::connect(&dbusService, &DBusService::adaptiveNoiseLevelRequested, trayApp.get(), &AirPodsTrayApp::setAdaptiveNoiseLevel);
+    dbusService.registerService();
 
-    if (!server.listen("app_server"))
+    if (!server.listen())
     {
         LOG_ERROR("Unable to start the listening server");
         LOG_DEBUG("Server error: " << server.errorString());
@@ -1034,47 +1073,19 @@ int main(int argc, char *argv[]) {
     {
         LOG_DEBUG("Server started, waiting for connections...");
     }
-    QObject::connect(&server, &QLocalServer::newConnection, [&]() {
-        QLocalSocket* socket = server.nextPendingConnection();
-        // Handles Proper Connection
-        QObject::connect(socket, &QLocalSocket::readyRead, [socket, &engine, &trayApp]() {
-            QString msg = socket->readAll();
-            // Check if the message is "reopen", if so, trigger onOpenApp function
-            if (msg == "reopen") {
-                LOG_INFO("Reopening app window");
-                QObject *rootObject = engine.rootObjects().first();
-                if (rootObject) {
-                    QMetaObject::invokeMethod(rootObject, "reopen", Q_ARG(QVariant, "app"));
-                }
-                else
-                {
-                    trayApp->loadMainModule();
-                }
-            }
-            else
-            {
-                LOG_ERROR("Unknown message received: " << msg);
-            }
-            socket->disconnectFromServer();
-        });
-        // Handles connection errors
-        QObject::connect(socket, &QLocalSocket::errorOccurred, [socket]() {
-            LOG_ERROR("Failed to connect to the duplicate app instance");
-            LOG_DEBUG("Connection error: " << socket->errorString());
-        });
-        
-        // Handle server-level errors
-        QObject::connect(&server, &QLocalServer::serverError, [&]() {
-            LOG_ERROR("Server failed to accept a new connection");
-            LOG_DEBUG("Server error: " << server.errorString());
-        });
-    });
 
-    QObject::connect(&app, &QCoreApplication::aboutToQuit, [&]() {
+    QObject::connect(app.get(), &QCoreApplication::aboutToQuit, [&]() {
         LOG_DEBUG("Application is about to quit. Cleaning up...");
         sharedMemory.detach();
+        Trace::stop();
+    });
+
+    // Reported once the event loop runs, to compare the footprint of both modes
+    QTimer::singleShot(0, app.get(), [&startupClock, headless]() {
+        LOG_INFO("Startup took " << startupClock.elapsed() << " ms, RSS " << residentSetSizeKb() << " kB"
+                 << (headless ? " (headless)" : ""));
     });
-    return app.exec();
+    return app->exec();
 }
 
 #include "main.moc"
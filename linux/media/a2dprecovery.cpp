@@ -0,0 +1,131 @@
+#include "a2dprecovery.h"
+#include "profilemanager.h"
+#include "pulseaudioclient.h"
+#include "logger.h"
+#include "metrics.h"
+
+A2dpRecovery::A2dpRecovery(PulseAudioClient *audio, QObject *parent)
+    : QObject(parent), m_audio(audio), m_process(new QProcess(this))
+{
+    m_cardTimeout.setSingleShot(true);
+    m_cardTimeout.setInterval(5000);
+
+    connect(m_process, &QProcess::finished, this, &A2dpRecovery::onRestartFinished);
+    connect(&m_cardTimeout, &QTimer::timeout, this, [this]()
+    {
+        LOG_WARN("AirPods card did not come back with A2DP within " << m_cardTimeout.interval() << "ms");
+        nextAttempt();
+    });
+    connect(m_audio, &PulseAudioClient::cardAdded, this, &A2dpRecovery::onCardEvent);
+    connect(m_audio, &PulseAudioClient::cardChanged, this, &A2dpRecovery::onCardEvent);
+}
+
+void A2dpRecovery::start(const QString &macAddress)
+{
+    if (isRunning())
+    {
+        LOG_DEBUG("A2DP recovery already in progress");
+        return;
+    }
+
+    m_macAddress = macAddress;
+    m_attempt = 0;
+    m_waitingForProcess = false;
+    m_elapsed.start();
+    nextAttempt();
+}
+
+void A2dpRecovery::cancel()
+{
+    if (!isRunning())
+    {
+        return;
+    }
+
+    // A running systemctl is left to finish, its result is ignored once idle
+    m_cardTimeout.stop();
+    m_state = State::Idle;
+    LOG_INFO("A2DP recovery cancelled after " << m_elapsed.elapsed() << "ms");
+}
+
+void A2dpRecovery::nextAttempt()
+{
+    if (m_attempt >= m_maxAttempts)
+    {
+        fail(QString("giving up after %1 attempts").arg(m_attempt));
+        return;
+    }
+    ++m_attempt;
+    if (m_process->state() != QProcess::NotRunning)
+    {
+        // A restart from a cancelled run is still in flight. Waiting for it
+        // uses up an attempt, and one that is still stuck a timeout later is killed.
+        if (m_waitingForProcess)
+        {
+            LOG_WARN("systemctl is still running after " << m_cardTimeout.interval() << "ms, killing it");
+            m_process->kill();
+        }
+        m_waitingForProcess = true;
+        m_state = State::WaitingForCard;
+        m_cardTimeout.start();
+        return;
+    }
+    m_waitingForProcess = false;
+    m_state = State::RestartingWirePlumber;
+    LOG_INFO("Restarting WirePlumber to rediscover A2DP profiles (attempt " << m_attempt << ")");
+    Metrics::counter("librepods_process_spawns_total", "External programs started", {{"program", "systemctl"}}).inc();
+    m_process->start("systemctl", QStringList() << "--user" << "restart" << "wireplumber");
+    // Also bounds a systemctl that never returns
+    m_cardTimeout.start();
+}
+
+void A2dpRecovery::onRestartFinished(int exitCode, QProcess::ExitStatus exitStatus)
+{
+    if (m_state != State::RestartingWirePlumber)
+    {
+        return;
+    }
+
+    if (exitStatus != QProcess::NormalExit || exitCode != 0)
+    {
+        fail("failed to restart WirePlumber");
+        return;
+    }
+
+    LOG_INFO("WirePlumber restarted successfully, waiting for the AirPods card");
+    m_state = State::WaitingForCard;
+    m_cardTimeout.start();
+    // The card may already be back by the time systemctl returns
+    checkCard(m_audio->findBluetoothCard(m_macAddress));
+}
+
+void A2dpRecovery::onCardEvent(const QString &name)
+{
+    if (m_state == State::WaitingForCard && name.contains(m_macAddress))
+    {
+        checkCard(name);
+    }
+}
+
+void A2dpRecovery::checkCard(const QString &name)
+{
+    if (name.isEmpty() || ProfileManager::bestA2dpProfile(m_audio->card(name).profiles).isEmpty())
+    {
+        return;
+    }
+
+    m_cardTimeout.stop();
+    m_state = State::Idle;
+    qint64 elapsed = m_elapsed.elapsed();
+    LOG_INFO("A2DP profile recovered on " << name << " after " << elapsed << "ms (" << m_attempt << " attempts)");
+    emit recovered(name, elapsed);
+}
+
+void A2dpRecovery::fail(const QString &reason)
+{
+    m_cardTimeout.stop();
+    m_state = State::Idle;
+    qint64 elapsed = m_elapsed.elapsed();
+    LOG_ERROR("A2DP recovery failed after " << elapsed << "ms: " << reason);
+    emit failed(elapsed);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QProcess>
+#include <QTimer>
+
+class PulseAudioClient;
+
+// Brings a missing A2DP profile back by restarting WirePlumber and waiting for
+// the AirPods card to reappear on the audio server. Runs entirely on the event
+// loop: no step sleeps or waits for a process to finish.
+class A2dpRecovery : public QObject
+{
+    Q_OBJECT
+public:
+    enum class State
+    {
+        Idle,
+        RestartingWirePlumber,
+        WaitingForCard,
+    };
+    Q_ENUM(State)
+
+    explicit A2dpRecovery(PulseAudioClient *audio, QObject *parent = nullptr);
+
+    void start(const QString &macAddress);
+    void cancel();
+
+    bool isRunning() const { return m_state != State::Idle; }
+    State state() const { return m_state; }
+
+    void setMaxAttempts(int attempts) { m_maxAttempts = attempts; }
+    void setCardTimeout(int msec) { m_cardTimeout.setInterval(msec); }
+
+signals:
+    void recovered(const QString &cardName, qint64 elapsedMs);
+    void failed(qint64 elapsedMs);
+
+private:
+    void nextAttempt();
+    void onRestartFinished(int exitCode, QProcess::ExitStatus exitStatus);
+    void onCardEvent(const QString &name);
+    void checkCard(const QString &name);
+    void fail(const QString &reason);
+
+    PulseAudioClient *m_audio;
+    QProcess *m_process;
+    QTimer m_cardTimeout;
+    QElapsedTimer m_elapsed;
+    State m_state = State::Idle;
+    QString m_macAddress;
+    int m_attempt = 0;
+    int m_maxAttempts = 3;
+    bool m_waitingForProcess = false; // The last attempt found systemctl still running
+};
@@ -0,0 +1,168 @@
+#include "duckingengine.h"
+#include "pulseaudioclient.h"
+#include "logger.h"
+
+#include <cmath>
+
+DuckingEngine::DuckingEngine(PulseAudioClient *audio, QObject *parent)
+    : QObject(parent), m_audio(audio)
+{
+    m_rampTimer.setInterval(15);
+    connect(&m_rampTimer, &QTimer::timeout, this, &DuckingEngine::onRampTick);
+    connect(m_audio, &PulseAudioClient::sinkVolumeChanged, this, &DuckingEngine::onSinkVolumeChanged);
+    connect(m_audio, &PulseAudioClient::sinkRemoved, this, [this](const QString &sink)
+    {
+        if (sink == m_sink)
+        {
+            reset();
+        }
+    });
+    connect(m_audio, &PulseAudioClient::disconnected, this, &DuckingEngine::reset);
+}
+
+void DuckingEngine::handleLevel(quint8 level, const QString &sink)
+{
+    switch (level)
+    {
+    case 0x01:
+    case 0x02:
+        duck(sink);
+        break;
+    case 0x08:
+    case 0x09:
+        release();
+        break;
+    default:
+        LOG_DEBUG("Conversational awareness level " << static_cast<int>(level) << ", keeping volume");
+        break;
+    }
+}
+
+void DuckingEngine::reset()
+{
+    m_rampTimer.stop();
+    m_state = State::Idle;
+    m_sink.clear();
+    m_originalVolume = -1;
+    m_currentVolume = -1;
+}
+
+void DuckingEngine::duck(const QString &sink)
+{
+    switch (m_state)
+    {
+    case State::Idle:
+    {
+        if (sink.isEmpty())
+        {
+            return; // AirPods are not the active output
+        }
+        int volume = m_audio->sinkVolume(sink);
+        if (volume < 0)
+        {
+            LOG_ERROR("No cached volume for " << sink << ", cannot lower it");
+            return;
+        }
+        m_sink = sink;
+        m_originalVolume = volume;
+        m_currentVolume = volume;
+        break;
+    }
+    case State::Releasing:
+        break; // Turn around from wherever the release ramp got to
+    case State::Attacking:
+    case State::Ducked:
+        return;
+    }
+
+    int target = qRound(m_originalVolume * m_duckFactor);
+    LOG_INFO("Lowering volume from " << m_currentVolume << "% to " << target << "%");
+    startRamp(target, m_attackMs, State::Attacking);
+}
+
+void DuckingEngine::release()
+{
+    if (m_state == State::Idle || m_state == State::Releasing)
+    {
+        return;
+    }
+
+    LOG_INFO("Restoring volume from " << m_currentVolume << "% to " << m_originalVolume << "%");
+    startRamp(m_originalVolume, m_releaseMs, State::Releasing);
+}
+
+void DuckingEngine::startRamp(int target, int durationMs, State state)
+{
+    // A ramp that starts part way, after an overlapping event, takes a
+    // proportional share of the configured time so the slope stays the same
+    int fullDistance = m_originalVolume - qRound(m_originalVolume * m_duckFactor);
+    int distance = std::abs(target - m_currentVolume);
+    if (fullDistance > 0)
+    {
+        durationMs = durationMs * qMin(distance, fullDistance) / fullDistance;
+    }
+
+    m_rampFrom = m_currentVolume;
+    m_rampTo = target;
+    m_rampDurationMs = durationMs;
+    m_state = state;
+    m_rampClock.start();
+
+    if (durationMs <= 0)
+    {
+        onRampTick();
+    }
+    else
+    {
+        m_rampTimer.start();
+    }
+}
+
+void DuckingEngine::onRampTick()
+{
+    double progress = m_rampDurationMs > 0
+                          ? qMin(1.0, static_cast<double>(m_rampClock.elapsed()) / m_rampDurationMs)
+                          : 1.0;
+    setVolume(qRound(m_rampFrom + (m_rampTo - m_rampFrom) * progress));
+
+    if (progress < 1.0)
+    {
+        return;
+    }
+
+    m_rampTimer.stop();
+    if (m_state == State::Attacking)
+    {
+        m_state = State::Ducked;
+    }
+    else
+    {
+        LOG_DEBUG("Volume restored to " << m_currentVolume << "%");
+        reset();
+    }
+}
+
+void DuckingEngine::setVolume(int percent)
+{
+    if (percent == m_currentVolume)
+    {
+        return;
+    }
+    m_currentVolume = percent;
+    m_audio->setSinkVolume(m_sink, percent);
+}
+
+void DuckingEngine::onSinkVolumeChanged(const QString &sink, int percent)
+{
+    // Events from our own ramp steps trail behind, so only a settled duck is checked
+    if (m_state != State::Ducked || sink != m_sink || m_rampClock.elapsed() < m_rampDurationMs + 300)
+    {
+        return;
+    }
+
+    if (std::abs(percent - m_currentVolume) > 1)
+    {
+        LOG_INFO("Volume changed to " << percent << "% while lowered, leaving it to the user");
+        reset();
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QTimer>
+
+class PulseAudioClient;
+
+// Lowers the sink volume while conversational awareness reports that the user
+// is speaking and brings it back afterwards. Volume changes are ramped over the
+// persistent audio server connection, and the starting volume comes from the
+// client's sink cache instead of being queried.
+class DuckingEngine : public QObject
+{
+    Q_OBJECT
+public:
+    enum class State
+    {
+        Idle,
+        Attacking, // Ramping down towards the ducked volume
+        Ducked,
+        Releasing, // Ramping back up towards the original volume
+    };
+    Q_ENUM(State)
+
+    explicit DuckingEngine(PulseAudioClient *audio, QObject *parent = nullptr);
+
+    // Level byte of the conversational awareness notification (index 9)
+    void handleLevel(quint8 level, const QString &sink);
+    // Forgets the ducked state without restoring, e.g. when the device went away
+    void reset();
+
+    State state() const { return m_state; }
+
+    void setDuckFactor(double factor) { m_duckFactor = qBound(0.0, factor, 1.0); }
+    void setAttackTime(int msec) { m_attackMs = qMax(0, msec); }
+    void setReleaseTime(int msec) { m_releaseMs = qMax(0, msec); }
+
+private:
+    void duck(const QString &sink);
+    void release();
+    void startRamp(int target, int durationMs, State state);
+    void onRampTick();
+    void onSinkVolumeChanged(const QString &sink, int percent);
+    void setVolume(int percent);
+
+    PulseAudioClient *m_audio;
+    QTimer m_rampTimer;
+    QElapsedTimer m_rampClock;
+    State m_state = State::Idle;
+    QString m_sink;
+
+    int m_originalVolume = -1;
+    int m_currentVolume = -1; // Last volume we wrote
+    int m_rampFrom = 0;
+    int m_rampTo = 0;
+    int m_rampDurationMs = 0;
+
+    double m_duckFactor = 0.2;
+    int m_attackMs = 150;
+    int m_releaseMs = 600;
+};
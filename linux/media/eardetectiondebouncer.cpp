@@ -0,0 +1,120 @@
+#include "eardetectiondebouncer.h"
+#include "logger.h"
+#include "metrics.h"
+
+namespace
+{
+    int podsInEar(int wear) { return (wear & 0x01) + ((wear >> 1) & 0x01); }
+
+    Metrics::Counter &transitions(const char *layer, const char *result)
+    {
+        return Metrics::counter("librepods_ear_detection_transitions_total",
+                                "Debounced ear detection changes, by layer and whether they lasted long enough to act on",
+                                {{"layer", layer}, {"result", result}});
+    }
+}
+
+EarDetectionDebouncer::EarDetectionDebouncer(QObject *parent)
+    : QObject(parent),
+      m_received(Metrics::counter("librepods_ear_detection_updates_total", "Raw ear detection status updates")),
+      m_committed(transitions("playback", "committed")),
+      m_suppressed(transitions("playback", "suppressed")),
+      m_profileCommitted(transitions("profile", "committed")),
+      m_profileSuppressed(transitions("profile", "suppressed"))
+{
+    m_wearTimer.setSingleShot(true);
+    m_profileTimer.setSingleShot(true);
+    connect(&m_wearTimer, &QTimer::timeout, this, &EarDetectionDebouncer::commitWearState);
+    connect(&m_profileTimer, &QTimer::timeout, this, &EarDetectionDebouncer::commitProfileState);
+}
+
+void EarDetectionDebouncer::update(bool primaryInEar, bool secondaryInEar)
+{
+    m_received.inc();
+    int wear = (primaryInEar ? 0x01 : 0x00) | (secondaryInEar ? 0x02 : 0x00);
+    int anyInEar = wear != 0 ? 1 : 0;
+
+    // Playback layer
+    if (wear == m_committedWear)
+    {
+        if (m_wearTimer.isActive())
+        {
+            m_wearTimer.stop();
+            m_suppressed.inc();
+            LOG_DEBUG("Ear detection bounced back, suppressed " << m_suppressed.value() << " transitions so far");
+        }
+        m_pendingWear = wear;
+    }
+    else if (wear != m_pendingWear || !m_wearTimer.isActive())
+    {
+        if (m_wearTimer.isActive())
+        {
+            m_suppressed.inc(); // Superseded before it was committed
+        }
+        m_pendingWear = wear;
+        int delay = m_committedWear < 0                              ? 0
+                    : podsInEar(wear) > podsInEar(m_committedWear) ? m_config.insertDelayMs
+                                                                   : m_config.removeDelayMs;
+        if (delay <= 0)
+        {
+            m_wearTimer.stop();
+            commitWearState();
+        }
+        else
+        {
+            m_wearTimer.start(delay);
+        }
+    }
+
+    // Profile layer, with a much longer hold before the output is torn down
+    if (anyInEar == m_committedAnyInEar)
+    {
+        if (m_profileTimer.isActive())
+        {
+            m_profileTimer.stop();
+            m_profileSuppressed.inc();
+            LOG_DEBUG("Profile switch suppressed, " << m_profileSuppressed.value() << " so far");
+        }
+        m_pendingAnyInEar = anyInEar;
+    }
+    else if (anyInEar != m_pendingAnyInEar || !m_profileTimer.isActive())
+    {
+        m_pendingAnyInEar = anyInEar;
+        int delay = m_committedAnyInEar < 0 ? 0
+                    : anyInEar              ? m_config.profileOnDelayMs
+                                            : m_config.profileOffDelayMs;
+        if (delay <= 0)
+        {
+            m_profileTimer.stop();
+            commitProfileState();
+        }
+        else
+        {
+            m_profileTimer.start(delay);
+        }
+    }
+}
+
+void EarDetectionDebouncer::reset()
+{
+    m_wearTimer.stop();
+    m_profileTimer.stop();
+    m_committedWear = -1;
+    m_pendingWear = -1;
+    m_committedAnyInEar = -1;
+    m_pendingAnyInEar = -1;
+}
+
+void EarDetectionDebouncer::commitWearState()
+{
+    m_committedWear = m_pendingWear;
+    m_committed.inc();
+    emit wearStateChanged(m_committedWear & 0x01, m_committedWear & 0x02);
+}
+
+void EarDetectionDebouncer::commitProfileState()
+{
+    m_committedAnyInEar = m_pendingAnyInEar;
+    m_profileCommitted.inc();
+    emit anyInEarChanged(m_committedAnyInEar != 0);
+}
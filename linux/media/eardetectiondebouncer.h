@@ -0,0 +1,60 @@
+#pragma once
+
+#include <QObject>
+#include <QTimer>
+
+namespace Metrics
+{
+    class Counter;
+}
+
+// Sits between the raw ear detection packets and the media/profile actions
+// they trigger. A new state has to hold for a debounce window before it is
+// committed, and the windows differ per direction (hysteresis), so adjusting
+// a bud does not cause pause/play or profile flapping.
+class EarDetectionDebouncer : public QObject
+{
+    Q_OBJECT
+public:
+    struct Config
+    {
+        int insertDelayMs = 200;      // More pods in ear before playback may resume
+        int removeDelayMs = 500;      // Fewer pods in ear before playback is paused
+        int profileOnDelayMs = 0;     // Any pod in ear before A2DP is activated
+        int profileOffDelayMs = 3000; // No pod in ear before the output is removed
+    };
+
+    explicit EarDetectionDebouncer(QObject *parent = nullptr);
+
+    void update(bool primaryInEar, bool secondaryInEar);
+    // Forgets committed state, the next update is applied right away
+    void reset();
+
+    void setConfig(const Config &config) { m_config = config; }
+    const Config &config() const { return m_config; }
+
+signals:
+    void wearStateChanged(bool primaryInEar, bool secondaryInEar);
+    void anyInEarChanged(bool anyInEar);
+
+private:
+    void commitWearState();
+    void commitProfileState();
+
+    Config m_config;
+
+    Metrics::Counter &m_received;          // Raw status updates
+    Metrics::Counter &m_committed;         // Wear state changes acted upon
+    Metrics::Counter &m_suppressed;        // Wear state changes that did not last
+    Metrics::Counter &m_profileCommitted;  // In/out changes acted upon
+    Metrics::Counter &m_profileSuppressed; // In/out changes that did not last
+
+    // Bit 0: primary in ear, bit 1: secondary in ear, -1: nothing committed yet
+    int m_committedWear = -1;
+    int m_pendingWear = -1;
+    QTimer m_wearTimer;
+
+    int m_committedAnyInEar = -1;
+    int m_pendingAnyInEar = -1;
+    QTimer m_profileTimer;
+};
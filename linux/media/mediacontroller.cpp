@@ -1,15 +1,75 @@
 #include "mediacontroller.h"
 #include "logger.h"
+#include "metrics.h"
 #include "eardetection.hpp"
 #include "playerstatuswatcher.h"
+#include "pulseaudioclient.h"
+#include "a2dprecovery.h"
+#include "duckingengine.h"
+#include "profilemanager.h"
 
 #include <QDebug>
-#include <QProcess>
-#include <QRegularExpression>
-#include <QDBusConnection>
-#include <QDBusConnectionInterface>
 
-MediaController::MediaController(QObject *parent) : QObject(parent) {
+MediaController::MediaController(QObject *parent)
+    : QObject(parent), playerStatusWatcher(new PlayerStatusWatcher(this)),
+      m_audio(new PulseAudioClient(this)),
+      m_a2dpRecovery(new A2dpRecovery(m_audio, this)),
+      m_ducking(new DuckingEngine(m_audio, this)),
+      m_earDebouncer(new EarDetectionDebouncer(this)),
+      m_profiles(new ProfileManager(m_audio, this)),
+      m_earToPauseLatency(Metrics::histogram("librepods_ear_to_pause_latency_ms",
+                                             "Time from an ear detection change to the player confirming the pause")) {
+  connect(m_earDebouncer, &EarDetectionDebouncer::wearStateChanged, this, &MediaController::onWearStateChanged);
+  connect(m_earDebouncer, &EarDetectionDebouncer::anyInEarChanged, this, &MediaController::onAnyInEarChanged);
+  connect(playerStatusWatcher, &PlayerStatusWatcher::commandFinished, this,
+          [this](const QString &method, bool success) {
+            if (method == "Pause" && m_earPausePending) {
+              m_earPausePending = false;
+              if (success) {
+                m_earToPauseLatency.observe(m_earEventClock.nsecsElapsed() / 1e6);
+              }
+            }
+          });
+  connect(m_audio, &PulseAudioClient::ready, this, [this]() {
+    if (m_deviceOutputName.isEmpty() || m_audio->card(m_deviceOutputName).name.isEmpty()) {
+      m_deviceOutputName = getAudioDeviceName();
+    }
+    if (!connectedDeviceMacAddress.isEmpty()) {
+      m_profiles->setDevice(connectedDeviceMacAddress);
+    }
+    if (pendingA2dpActivation) {
+      pendingA2dpActivation = false;
+      activateA2dpProfile();
+    }
+  });
+  connect(m_audio, &PulseAudioClient::cardProfileSet, this,
+          [this](const QString &card, const QString &profile, bool success) {
+            if (!success) {
+              LOG_ERROR("Failed to set profile " << profile << " on " << card);
+            } else if (card == m_deviceOutputName && profile == a2dpProfileName()) {
+              emit a2dpProfileActivated();
+            }
+          });
+  connect(m_audio, &PulseAudioClient::cardAdded, this, &MediaController::onCardEvent);
+  connect(m_audio, &PulseAudioClient::cardChanged, this, &MediaController::onCardEvent);
+  m_a2dpGraceTimer.setSingleShot(true);
+  m_a2dpGraceTimer.setInterval(5000);
+  connect(&m_a2dpGraceTimer, &QTimer::timeout, this, [this]() {
+    if (!pendingA2dpActivation || connectedDeviceMacAddress.isEmpty()) {
+      return;
+    }
+    pendingA2dpActivation = false;
+    LOG_WARN("No A2DP profile appeared within " << m_a2dpGraceTimer.interval()
+             << "ms, attempting to restart WirePlumber");
+    m_a2dpRecovery->start(connectedDeviceMacAddress);
+  });
+  connect(m_a2dpRecovery, &A2dpRecovery::recovered, this,
+          [this](const QString &cardName, qint64) {
+            m_deviceOutputName = cardName;
+            m_profiles->setDevice(connectedDeviceMacAddress);
+            LOG_INFO("Activating A2DP profile for AirPods");
+            m_audio->setCardProfile(m_deviceOutputName, a2dpProfileName());
+          });
 }
 
 void MediaController::handleEarDetection(EarDetection *earDetection)
@@ -22,12 +82,24 @@ void MediaController::handleEarDetection(EarDetection *earDetection)
 
   bool primaryInEar = earDetection->isPrimaryInEar();
   bool secondaryInEar = earDetection->isSecondaryInEar();
+  if (primaryInEar != m_lastPrimaryInEar || secondaryInEar != m_lastSecondaryInEar)
+  {
+    m_lastPrimaryInEar = primaryInEar;
+    m_lastSecondaryInEar = secondaryInEar;
+    m_earEventClock.start();
+  }
+
+  // Actions only follow once the new state has settled, see onWearStateChanged
+  // and onAnyInEarChanged
+  m_earDebouncer->update(primaryInEar, secondaryInEar);
+}
 
+void MediaController::onWearStateChanged(bool primaryInEar, bool secondaryInEar)
+{
   LOG_DEBUG("Ear detection status: primaryInEar="
             << primaryInEar << ", secondaryInEar=" << secondaryInEar
             << ", isAirPodsActive=" << isActiveOutputDeviceAirPods());
 
-  // First handle playback pausing based on selected behavior
   bool shouldPause = false;
   bool shouldResume = false;
 
@@ -46,21 +118,23 @@ void MediaController::handleEarDetection(EarDetection *earDetection)
   {
     if (getCurrentMediaState() == Playing)
     {
+      m_earPausePending = true;
       pause();
     }
   }
+  // Resume if conditions are met and we previously paused
+  else if (shouldResume && wasPausedByApp && isActiveOutputDeviceAirPods())
+  {
+    play();
+  }
+}
 
-  // Then handle device profile switching
-  if (primaryInEar || secondaryInEar)
+void MediaController::onAnyInEarChanged(bool anyInEar)
+{
+  if (anyInEar)
   {
     LOG_INFO("At least one AirPod is in ear");
     activateA2dpProfile();
-
-    // Resume if conditions are met and we previously paused
-    if (shouldResume && wasPausedByApp && isActiveOutputDeviceAirPods())
-    {
-      play();
-    }
   }
   else
   {
@@ -69,6 +143,11 @@ void MediaController::handleEarDetection(EarDetection *earDetection)
   }
 }
 
+void MediaController::setEarDetectionDebounce(const EarDetectionDebouncer::Config &config)
+{
+  m_earDebouncer->setConfig(config);
+}
+
 void MediaController::setEarDetectionBehavior(EarDetectionBehavior behavior)
 {
   earDetectionBehavior = behavior;
@@ -76,7 +155,6 @@ void MediaController::setEarDetectionBehavior(EarDetectionBehavior behavior)
 }
 
 void MediaController::followMediaChanges() {
-  playerStatusWatcher = new PlayerStatusWatcher("", this);
   connect(playerStatusWatcher, &PlayerStatusWatcher::playbackStatusChanged,
           this, [this](const QString &status)
           {
@@ -87,50 +165,26 @@ void MediaController::followMediaChanges() {
 }
 
 bool MediaController::isActiveOutputDeviceAirPods() {
-  QProcess process;
-  process.start("pactl", QStringList() << "get-default-sink");
-  process.waitForFinished();
-  QString output = process.readAllStandardOutput().trimmed();
-  LOG_DEBUG("Default sink: " << output);
-  return output.contains(connectedDeviceMacAddress);
+  QString defaultSink = m_audio->defaultSinkName();
+  return !connectedDeviceMacAddress.isEmpty() && defaultSink.contains(connectedDeviceMacAddress);
 }
 
 void MediaController::handleConversationalAwareness(const QByteArray &data) {
   LOG_DEBUG("Handling conversational awareness data: " << data.toHex());
-  bool lowered = data[9] == 0x01;
-  LOG_INFO("Conversational awareness: " << (lowered ? "enabled" : "disabled"));
-
-  if (lowered) {
-    if (initialVolume == -1 && isActiveOutputDeviceAirPods()) {
-      QProcess process;
-      process.start("pactl", QStringList()
-                                 << "get-sink-volume" << "@DEFAULT_SINK@");
-      process.waitForFinished();
-      QString output = process.readAllStandardOutput();
-      QRegularExpression re("front-left: \\d+ /\\s*(\\d+)%");
-      QRegularExpressionMatch match = re.match(output);
-      if (match.hasMatch()) {
-        LOG_DEBUG("Matched: " << match.captured(1));
-        initialVolume = match.captured(1).toInt();
-      } else {
-        LOG_ERROR("Failed to parse initial volume from output: " << output);
-        return;
-      }
-    }
-    QProcess::execute(
-        "pactl", QStringList() << "set-sink-volume" << "@DEFAULT_SINK@"
-                               << QString::number(initialVolume * 0.20) + "%");
-    LOG_INFO("Volume lowered to 0.20 of initial which is "
-             << initialVolume * 0.20 << "%");
-  } else {
-    if (initialVolume != -1 && isActiveOutputDeviceAirPods()) {
-      QProcess::execute("pactl", QStringList()
-                                     << "set-sink-volume" << "@DEFAULT_SINK@"
-                                     << QString::number(initialVolume) + "%");
-      LOG_INFO("Volume restored to " << initialVolume << "%");
-      initialVolume = -1;
-    }
-  }
+  quint8 level = static_cast<quint8>(data[9]);
+  LOG_INFO("Conversational awareness level: " << static_cast<int>(level));
+
+  // Only a new duck needs the AirPods to be the output, a release always goes
+  // back to the sink that was lowered
+  m_ducking->handleLevel(level, isActiveOutputDeviceAirPods() ? m_audio->defaultSinkName() : QString());
+}
+
+void MediaController::setConversationalAwarenessDucking(double factor, int attackMs, int releaseMs) {
+  m_ducking->setDuckFactor(factor);
+  m_ducking->setAttackTime(attackMs);
+  m_ducking->setReleaseTime(releaseMs);
+  LOG_INFO("Conversational awareness ducking: factor=" << factor << ", attack=" << attackMs
+           << "ms, release=" << releaseMs << "ms");
 }
 
 bool MediaController::isA2dpProfileAvailable() {
@@ -138,96 +192,110 @@ bool MediaController::isA2dpProfileAvailable() {
     return false;
   }
 
-  QProcess process;
-  process.start("pactl", QStringList() << "list" << "cards");
-  if (!process.waitForFinished(3000)) {
-    LOG_ERROR("pactl command timed out while checking A2DP availability");
-    return false;
+  return !ProfileManager::bestA2dpProfile(m_audio->card(m_deviceOutputName).profiles).isEmpty();
+}
+
+void MediaController::activateA2dpProfile() {
+  if (connectedDeviceMacAddress.isEmpty()) {
+    LOG_WARN("Connected device MAC address is empty, cannot activate A2DP profile");
+    return;
   }
 
-  QString output = process.readAllStandardOutput();
+  if (!m_audio->isReady()) {
+    pendingA2dpActivation = true; // Retried once the audio server is connected
+    return;
+  }
 
-  // Check if the card section contains our device
-  int cardStart = output.indexOf(m_deviceOutputName);
-  if (cardStart == -1) {
-    return false;
+  if (m_deviceOutputName.isEmpty() || m_audio->card(m_deviceOutputName).name.isEmpty()) {
+    m_deviceOutputName = m_audio->findBluetoothCard(connectedDeviceMacAddress);
+  }
+  // Right after the link comes up BlueZ may not have created the card yet, or
+  // created it without A2DP. Wait for the card events and only restart
+  // WirePlumber if A2DP does not show up in time.
+  if (!isA2dpProfileAvailable()) {
+    if (m_a2dpRecovery->isRunning()) {
+      return;
+    }
+    pendingA2dpActivation = true;
+    if (!m_a2dpGraceTimer.isActive()) {
+      LOG_INFO("Waiting for the AirPods card to offer A2DP");
+      m_a2dpGraceTimer.start();
+    }
+    return;
   }
+  pendingA2dpActivation = false;
+  m_a2dpGraceTimer.stop();
 
-  // Look for a2dp-sink profile in the card's section
-  int nextCard = output.indexOf("Name: ", cardStart + m_deviceOutputName.length());
-  QString cardSection = (nextCard == -1) ? output.mid(cardStart) : output.mid(cardStart, nextCard - cardStart);
+  if (m_profiles->isHeadsetActiveForCapture()) {
+    LOG_INFO("Headset profile in use for recording, keeping it");
+    return;
+  }
 
-  return cardSection.contains("a2dp-sink");
+  LOG_INFO("Activating A2DP profile for AirPods");
+  m_audio->setCardProfile(m_deviceOutputName, a2dpProfileName());
 }
 
-bool MediaController::restartWirePlumber() {
-  LOG_INFO("Restarting WirePlumber to rediscover A2DP profiles");
-  int result = QProcess::execute("systemctl", QStringList() << "--user" << "restart" << "wireplumber");
-  if (result == 0) {
-    LOG_INFO("WirePlumber restarted successfully");
-    // Wait a bit for WirePlumber to rediscover profiles
-    QProcess::execute("sleep", QStringList() << "2");
-    return true;
-  } else {
-    LOG_ERROR("Failed to restart WirePlumber");
-    return false;
+QString MediaController::a2dpProfileName() const {
+  QString profile = m_profiles->profiles().a2dp;
+  if (profile.isEmpty() && !m_deviceOutputName.isEmpty()) {
+    profile = ProfileManager::bestA2dpProfile(m_audio->card(m_deviceOutputName).profiles);
   }
+  return profile.isEmpty() ? QStringLiteral("a2dp-sink") : profile;
 }
 
-void MediaController::activateA2dpProfile() {
-  if (connectedDeviceMacAddress.isEmpty() || m_deviceOutputName.isEmpty()) {
-    LOG_WARN("Connected device MAC address or output name is empty, cannot activate A2DP profile");
+void MediaController::onCardEvent(const QString &name) {
+  if (!pendingA2dpActivation || !m_audio->isReady() || connectedDeviceMacAddress.isEmpty() ||
+      m_audio->findBluetoothCard(connectedDeviceMacAddress) != name) {
     return;
   }
-
-  // Check if A2DP profile is available
-  if (!isA2dpProfileAvailable()) {
-    LOG_WARN("A2DP profile not available, attempting to restart WirePlumber");
-    if (restartWirePlumber()) {
-      // Update device output name after restart
-      m_deviceOutputName = getAudioDeviceName();
-      if (!isA2dpProfileAvailable()) {
-        LOG_ERROR("A2DP profile still not available after WirePlumber restart");
-        return;
-      }
-    } else {
-      LOG_ERROR("Could not restart WirePlumber, A2DP profile unavailable");
-      return;
-    }
+  if (ProfileManager::bestA2dpProfile(m_audio->card(name).profiles).isEmpty()) {
+    return; // Still coming up, the grace timer covers the case where A2DP never appears
   }
+  LOG_INFO("AirPods card " << name << " now offers A2DP");
+  m_deviceOutputName = name;
+  activateA2dpProfile();
+}
 
-  LOG_INFO("Activating A2DP profile for AirPods");
-  int result = QProcess::execute(
-      "pactl", QStringList()
-                   << "set-card-profile"
-                   << m_deviceOutputName << "a2dp-sink");
-  if (result != 0) {
-    LOG_ERROR("Failed to activate A2DP profile");
-  }
+void MediaController::setAutomaticHeadsetProfile(bool enabled, int returnDelayMs) {
+  m_profiles->setEnabled(enabled);
+  m_profiles->setReturnDelay(returnDelayMs);
+  LOG_INFO("Automatic headset profile while recording: " << enabled << ", return delay " << returnDelayMs << "ms");
 }
 
 void MediaController::removeAudioOutputDevice() {
+  pendingA2dpActivation = false;
+  m_a2dpGraceTimer.stop();
   if (connectedDeviceMacAddress.isEmpty() || m_deviceOutputName.isEmpty()) {
     LOG_WARN("Connected device MAC address or output name is empty, cannot remove audio output device");
     return;
   }
   
   LOG_INFO("Removing AirPods as audio output device");
-  int result = QProcess::execute(
-      "pactl", QStringList()
-                   << "set-card-profile"
-                   << m_deviceOutputName << "off");
-  if (result != 0) {
-    LOG_ERROR("Failed to remove AirPods as audio output device");
-  }
+  m_a2dpRecovery->cancel();
+  m_audio->setCardProfile(m_deviceOutputName, "off");
+}
+
+void MediaController::handleDeviceDisconnected() {
+  pendingA2dpActivation = false;
+  m_a2dpGraceTimer.stop();
+  m_a2dpRecovery->cancel();
+  m_ducking->reset();
+  m_earDebouncer->reset();
+  m_profiles->clear();
 }
 
 void MediaController::setConnectedDeviceMacAddress(const QString &macAddress) {
   connectedDeviceMacAddress = macAddress;
   m_deviceOutputName = getAudioDeviceName();
+  m_profiles->setDevice(macAddress);
   LOG_INFO("Device output name set to: " << m_deviceOutputName);
 }
 
+void MediaController::setKnownAudioCard(const QString &macAddress, const QString &cardName) {
+  m_knownCardMacAddress = macAddress;
+  m_knownCardName = cardName;
+}
+
 MediaController::MediaState MediaController::mediaStateFromPlayerctlOutput(
     const QString &output) const {
   if (output == "Playing") {
@@ -241,75 +309,13 @@ MediaController::MediaState MediaController::mediaStateFromPlayerctlOutput(
 
 MediaController::MediaState MediaController::getCurrentMediaState() const
 {
-  return mediaStateFromPlayerctlOutput(PlayerStatusWatcher::getCurrentPlaybackStatus(""));
+  return mediaStateFromPlayerctlOutput(playerStatusWatcher->currentPlaybackStatus());
 }
 
 bool MediaController::sendMediaPlayerCommand(const QString &method)
 {
-  // Connect to the session bus
-  QDBusConnection bus = QDBusConnection::sessionBus();
-
-  // Find available MPRIS-compatible media players
-  QStringList services = bus.interface()->registeredServiceNames().value();
-  QStringList mprisServices;
-  for (const QString &service : services)
-  {
-    if (service.startsWith("org.mpris.MediaPlayer2."))
-    {
-      mprisServices << service;
-    }
-  }
-
-  if (mprisServices.isEmpty())
-  {
-    LOG_ERROR("No MPRIS-compatible media players found on DBus");
-    return false;
-  }
-
-  bool success = false;
-  // Try each MPRIS service until one succeeds
-  for (const QString &service : mprisServices)
-  {
-    QDBusInterface playerInterface(
-        service,
-        "/org/mpris/MediaPlayer2",
-        "org.mpris.MediaPlayer2.Player",
-        bus);
-
-    if (!playerInterface.isValid())
-    {
-      LOG_ERROR("Invalid DBus interface for service: " << service);
-      continue;
-    }
-
-    // Send the Play or Pause command
-    if (method == "Play" || method == "Pause")
-    {
-      QDBusReply<void> reply = playerInterface.call(method);
-      if (reply.isValid())
-      {
-        LOG_INFO("Successfully sent " << method << " to " << service);
-        success = true;
-        break; // Exit after the first successful command
-      }
-      else
-      {
-        LOG_ERROR("Failed to send " << method << " to " << service
-                                    << ": " << reply.error().message());
-      }
-    }
-    else
-    {
-      LOG_ERROR("Unsupported method: " << method);
-      return false;
-    }
-  }
-
-  if (!success)
-  {
-    LOG_ERROR("No media player responded successfully to " << method);
-  }
-  return success;
+  // The registry already knows which player is active, no bus enumeration needed
+  return playerStatusWatcher->sendCommand(method);
 }
 
 void MediaController::play()
@@ -334,6 +340,7 @@ void MediaController::pause()
   }
   else
   {
+    m_earPausePending = false;
     LOG_ERROR("Failed to pause playback via DBus");
   }
 }
@@ -345,40 +352,14 @@ QString MediaController::getAudioDeviceName()
 {
   if (connectedDeviceMacAddress.isEmpty()) { return QString(); }
 
-  // Set up QProcess to run pactl directly
-  QProcess process;
-  process.start("pactl", QStringList() << "list" << "cards" << "short");
-  if (!process.waitForFinished(3000)) // Timeout after 3 seconds
-  {
-    LOG_ERROR("pactl command failed or timed out: " << process.errorString());
-    return QString();
-  }
-
-  // Check for execution errors
-  if (process.exitCode() != 0)
+  QString cardName = m_audio->findBluetoothCard(connectedDeviceMacAddress);
+  if (cardName.isEmpty() && !m_audio->isReady() && connectedDeviceMacAddress == m_knownCardMacAddress)
   {
-    LOG_ERROR("pactl exited with error code: " << process.exitCode());
-    return QString();
+    return m_knownCardName; // Audio server not connected yet, skip the cold lookup
   }
-
-  // Read and parse the command output
-  QString output = process.readAllStandardOutput();
-  QStringList lines = output.split("\n", Qt::SkipEmptyParts);
-
-  // Iterate through each line to find a matching Bluetooth sink
-  for (const QString &line : lines)
+  if (cardName.isEmpty())
   {
-    QStringList fields = line.split("\t", Qt::SkipEmptyParts);
-    if (fields.size() < 2) { continue; }
-
-    QString sinkName = fields[1].trimmed();
-    if (sinkName.startsWith("bluez") && sinkName.contains(connectedDeviceMacAddress))
-    {
-      return sinkName;
-    }
+    LOG_ERROR("No matching Bluetooth sink found for MAC address: " << connectedDeviceMacAddress);
   }
-
-  // No matching sink found
-  LOG_ERROR("No matching Bluetooth sink found for MAC address: " << connectedDeviceMacAddress);
-  return QString();
-}
\ No newline at end of file
+  return cardName;
+}
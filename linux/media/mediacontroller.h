@@ -2,11 +2,23 @@
 #define MEDIACONTROLLER_H
 
 #include <QObject>
+#include <QElapsedTimer>
+#include <QTimer>
+
+#include "eardetectiondebouncer.h"
 
-class QProcess;
 class EarDetection;
 class PlayerStatusWatcher;
 class QDBusInterface;
+class PulseAudioClient;
+class A2dpRecovery;
+class DuckingEngine;
+class ProfileManager;
+
+namespace Metrics
+{
+    class Histogram;
+}
 
 class MediaController : public QObject
 {
@@ -31,14 +43,20 @@ public:
   ~MediaController();
 
   void handleEarDetection(EarDetection*);
+  void setEarDetectionDebounce(const EarDetectionDebouncer::Config &config);
   void followMediaChanges();
   bool isActiveOutputDeviceAirPods();
   void handleConversationalAwareness(const QByteArray &data);
+  void setConversationalAwarenessDucking(double factor, int attackMs, int releaseMs);
   void activateA2dpProfile();
   void removeAudioOutputDevice();
   void setConnectedDeviceMacAddress(const QString &macAddress);
+  // Card name from a previous run, used until the audio server lists its cards
+  void setKnownAudioCard(const QString &macAddress, const QString &cardName);
+  QString audioCardName() const { return m_deviceOutputName; }
   bool isA2dpProfileAvailable();
-  bool restartWirePlumber();
+  void handleDeviceDisconnected();
+  void setAutomaticHeadsetProfile(bool enabled, int returnDelayMs);
 
   void setEarDetectionBehavior(EarDetectionBehavior behavior);
   inline EarDetectionBehavior getEarDetectionBehavior() const { return earDetectionBehavior; }
@@ -49,18 +67,40 @@ public:
 
 Q_SIGNALS:
   void mediaStateChanged(MediaState state);
+  // Audio is routed to the AirPods
+  void a2dpProfileActivated();
 
 private:
+  void onWearStateChanged(bool primaryInEar, bool secondaryInEar);
+  void onAnyInEarChanged(bool anyInEar);
   MediaState mediaStateFromPlayerctlOutput(const QString &output) const;
   QString getAudioDeviceName();
+  QString a2dpProfileName() const;
+  void onCardEvent(const QString &name);
   bool sendMediaPlayerCommand(const QString &method);
 
   bool wasPausedByApp = false;
-  int initialVolume = -1;
   QString connectedDeviceMacAddress;
   EarDetectionBehavior earDetectionBehavior = PauseWhenOneRemoved;
   QString m_deviceOutputName;
+  QString m_knownCardMacAddress;
+  QString m_knownCardName;
   PlayerStatusWatcher *playerStatusWatcher = nullptr;
+  PulseAudioClient *m_audio = nullptr;
+  A2dpRecovery *m_a2dpRecovery = nullptr;
+  DuckingEngine *m_ducking = nullptr;
+  EarDetectionDebouncer *m_earDebouncer = nullptr;
+  ProfileManager *m_profiles = nullptr;
+  bool pendingA2dpActivation = false;
+  // How long a connected card may take to offer A2DP before WirePlumber is restarted
+  QTimer m_a2dpGraceTimer;
+
+  // From the ear detection change to the player acknowledging Pause
+  QElapsedTimer m_earEventClock;
+  bool m_lastPrimaryInEar = false;
+  bool m_lastSecondaryInEar = false;
+  bool m_earPausePending = false;
+  Metrics::Histogram &m_earToPauseLatency;
 };
 
 #endif // MEDIACONTROLLER_H
\ No newline at end of file
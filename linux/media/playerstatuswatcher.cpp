@@ -1,70 +1,307 @@
 #include "playerstatuswatcher.h"
+#include "logger.h"
+#include "metrics.h"
+
 #include <QDBusConnection>
+#include <QDBusMessage>
+#include <QDBusPendingCallWatcher>
 #include <QDBusPendingReply>
+#include <QDBusVariant>
+#include <QDateTime>
+#include <QElapsedTimer>
 #include <QVariantMap>
-#include <QDBusReply>
-#include <QDBusConnectionInterface>
-
-PlayerStatusWatcher::PlayerStatusWatcher(const QString &playerService, QObject *parent)
-    : QObject(parent),
-      m_playerService(playerService),
-      m_iface(new QDBusInterface(playerService, "/org/mpris/MediaPlayer2",
-                                 "org.mpris.MediaPlayer2.Player", QDBusConnection::sessionBus(), this)),
-      m_serviceWatcher(new QDBusServiceWatcher(playerService, QDBusConnection::sessionBus(),
-                                               QDBusServiceWatcher::WatchForOwnerChange, this))
+
+namespace
 {
-    QDBusConnection::sessionBus().connect(
-        playerService, "/org/mpris/MediaPlayer2", "org.freedesktop.DBus.Properties",
-        "PropertiesChanged", this, SLOT(onPropertiesChanged(QString,QVariantMap,QStringList))
-    );
-    connect(m_serviceWatcher, &QDBusServiceWatcher::serviceOwnerChanged,
-            this, &PlayerStatusWatcher::onServiceOwnerChanged);
-    updateStatus();
+    const QString MprisPrefix = QStringLiteral("org.mpris.MediaPlayer2.");
+    const QString MprisPath = QStringLiteral("/org/mpris/MediaPlayer2");
+    const QString PlayerInterface = QStringLiteral("org.mpris.MediaPlayer2.Player");
+    const QString DBusService = QStringLiteral("org.freedesktop.DBus");
+    const QString DBusPath = QStringLiteral("/org/freedesktop/DBus");
 }
 
-void PlayerStatusWatcher::onPropertiesChanged(const QString &interface,
-                                              const QVariantMap &changed,
-                                              const QStringList &)
+PlayerStatusWatcher::PlayerStatusWatcher(QObject *parent)
+    : QObject(parent)
+{
+    QDBusConnection bus = QDBusConnection::sessionBus();
+    bus.connect(DBusService, DBusPath, DBusService, "NameOwnerChanged",
+                this, SLOT(onNameOwnerChanged(QString,QString,QString)));
+    // An empty service matches every sender, the owner map resolves who sent it
+    bus.connect(QString(), MprisPath, "org.freedesktop.DBus.Properties", "PropertiesChanged",
+                this, SLOT(onPropertiesChanged(QString,QVariantMap,QStringList)));
+    listPlayers();
+}
+
+QDBusPendingCallWatcher *PlayerStatusWatcher::asyncCall(const QDBusMessage &msg)
+{
+    QElapsedTimer clock;
+    clock.start();
+    auto *watcher = new QDBusPendingCallWatcher(QDBusConnection::sessionBus().asyncCall(msg), this);
+    Metrics::Histogram &latency = Metrics::histogram("librepods_dbus_call_latency_ms", "Time until a D-Bus method call is answered",
+                                                     {{"method", msg.member()}});
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [clock, &latency]()
+    {
+        latency.observe(clock.nsecsElapsed() / 1e6);
+    });
+    return watcher;
+}
+
+void PlayerStatusWatcher::listPlayers()
+{
+    QDBusMessage msg = QDBusMessage::createMethodCall(DBusService, DBusPath, DBusService, "ListNames");
+    auto *watcher = asyncCall(msg);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [this](QDBusPendingCallWatcher *call)
+    {
+        QDBusPendingReply<QStringList> reply = *call;
+        call->deleteLater();
+        if (reply.isError())
+        {
+            LOG_ERROR("Failed to list session bus names: " << reply.error().message());
+            return;
+        }
+        for (const QString &name : reply.value())
+        {
+            if (name.startsWith(MprisPrefix))
+            {
+                queryOwner(name);
+            }
+        }
+    });
+}
+
+void PlayerStatusWatcher::queryOwner(const QString &service)
+{
+    QDBusMessage msg = QDBusMessage::createMethodCall(DBusService, DBusPath, DBusService, "GetNameOwner");
+    msg << service;
+    auto *watcher = asyncCall(msg);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [this, service](QDBusPendingCallWatcher *call)
+    {
+        QDBusPendingReply<QString> reply = *call;
+        call->deleteLater();
+        if (!reply.isError())
+        {
+            addPlayer(service, reply.value());
+        }
+    });
+}
+
+void PlayerStatusWatcher::queryPlaybackStatus(const QString &service)
+{
+    QDBusMessage msg = QDBusMessage::createMethodCall(service, MprisPath, "org.freedesktop.DBus.Properties", "Get");
+    msg << PlayerInterface << QStringLiteral("PlaybackStatus");
+    auto *watcher = asyncCall(msg);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [this, service](QDBusPendingCallWatcher *call)
+    {
+        QDBusPendingReply<QDBusVariant> reply = *call;
+        call->deleteLater();
+        if (reply.isError())
+        {
+            LOG_DEBUG("Failed to get PlaybackStatus of " << service << ": " << reply.error().message());
+            return;
+        }
+        updatePlaybackStatus(service, reply.value().variant().toString());
+    });
+}
+
+void PlayerStatusWatcher::addPlayer(const QString &service, const QString &owner)
 {
-    if (interface == "org.mpris.MediaPlayer2.Player" && changed.contains("PlaybackStatus")) {
-        emit playbackStatusChanged(changed.value("PlaybackStatus").toString());
+    Player &player = m_players[service];
+    if (!player.owner.isEmpty())
+    {
+        m_ownerToService.remove(player.owner, service);
     }
+    player.service = service;
+    player.owner = owner;
+    m_ownerToService.insert(owner, service);
+    LOG_DEBUG("MPRIS player appeared: " << service << " (" << owner << ")");
+    queryPlaybackStatus(service);
 }
 
-void PlayerStatusWatcher::updateStatus() {
-    QVariant reply = m_iface->property("PlaybackStatus");
-    if (reply.isValid()) {
-        emit playbackStatusChanged(reply.toString());
+void PlayerStatusWatcher::removePlayer(const QString &service)
+{
+    auto it = m_players.find(service);
+    if (it == m_players.end())
+    {
+        return;
+    }
+    m_ownerToService.remove(it->owner, service);
+    m_players.erase(it);
+    LOG_DEBUG("MPRIS player disappeared: " << service);
+
+    if (m_activePlayer == service || m_lastActivePlayer == service)
+    {
+        refreshActivePlayers();
     }
+    updateCurrentStatus();
 }
 
-void PlayerStatusWatcher::onServiceOwnerChanged(const QString &name, const QString &, const QString &newOwner)
+void PlayerStatusWatcher::updatePlaybackStatus(const QString &service, const QString &status)
 {
-    if (name == m_playerService && newOwner.isEmpty()) {
-        emit playbackStatusChanged(""); // player disappeared
-    } else if (name == m_playerService && !newOwner.isEmpty()) {
-        updateStatus(); // player appeared/reappeared
+    auto it = m_players.find(service);
+    if (it == m_players.end() || it->playbackStatus == status)
+    {
+        return;
     }
+
+    bool wasPlaying = it->playbackStatus == "Playing";
+    bool isPlaying = status == "Playing";
+    it->playbackStatus = status;
+
+    if (isPlaying)
+    {
+        // The player that started most recently becomes the active one
+        it->lastActive = QDateTime::currentMSecsSinceEpoch();
+        m_activePlayer = service;
+        m_lastActivePlayer = service;
+    }
+    else if (wasPlaying)
+    {
+        it->lastActive = QDateTime::currentMSecsSinceEpoch();
+        if (m_activePlayer == service)
+        {
+            refreshActivePlayers();
+        }
+    }
+    else if (m_lastActivePlayer.isEmpty())
+    {
+        // Paused since before we started, still the one to resume
+        refreshActivePlayers();
+    }
+    updateCurrentStatus();
 }
 
-QString PlayerStatusWatcher::getCurrentPlaybackStatus(const QString &playerService)
+void PlayerStatusWatcher::refreshActivePlayers()
 {
-    QDBusConnection bus = QDBusConnection::sessionBus();
-    QStringList services = bus.interface()->registeredServiceNames().value();
-
-    for (const QString &service : services) {
-        if (service.startsWith("org.mpris.MediaPlayer2.")) {
-            QDBusInterface iface(service, "/org/mpris/MediaPlayer2",
-                               "org.mpris.MediaPlayer2.Player", bus);
-            
-            if (iface.isValid()) {
-                QVariant status = iface.property("PlaybackStatus");
-                if (status.isValid() && status.toString() == "Playing") {
-                    return status.toString();
-                }
+    // Only runs when the active player stops or leaves, never on a query
+    m_activePlayer.clear();
+    m_lastActivePlayer.clear();
+    qint64 latestPlaying = 0;
+    qint64 latestActive = 0;
+    for (const Player &player : std::as_const(m_players))
+    {
+        if (player.playbackStatus == "Playing" && player.lastActive > latestPlaying)
+        {
+            latestPlaying = player.lastActive;
+            m_activePlayer = player.service;
+        }
+        if (player.lastActive > latestActive)
+        {
+            latestActive = player.lastActive;
+            m_lastActivePlayer = player.service;
+        }
+    }
+
+    // Nothing has played since we started, fall back to a paused player, then to any
+    if (m_lastActivePlayer.isEmpty())
+    {
+        for (const Player &player : std::as_const(m_players))
+        {
+            if (m_lastActivePlayer.isEmpty() || player.playbackStatus == "Paused")
+            {
+                m_lastActivePlayer = player.service;
+            }
+            if (player.playbackStatus == "Paused")
+            {
+                break;
             }
         }
     }
+}
+
+void PlayerStatusWatcher::updateCurrentStatus()
+{
+    QString status;
+    if (!m_activePlayer.isEmpty())
+    {
+        status = QStringLiteral("Playing");
+    }
+    else if (!m_lastActivePlayer.isEmpty())
+    {
+        status = m_players.value(m_lastActivePlayer).playbackStatus;
+    }
 
-    return QString();
-}
\ No newline at end of file
+    if (status != m_currentStatus)
+    {
+        m_currentStatus = status;
+        emit playbackStatusChanged(status);
+    }
+}
+
+bool PlayerStatusWatcher::sendCommand(const QString &method)
+{
+    if (method != "Play" && method != "Pause")
+    {
+        LOG_ERROR("Unsupported method: " << method);
+        return false;
+    }
+
+    const QString &service = (method == "Pause") ? m_activePlayer : m_lastActivePlayer;
+    if (service.isEmpty())
+    {
+        LOG_ERROR("No MPRIS player to send " << method << " to");
+        return false;
+    }
+
+    QDBusMessage msg = QDBusMessage::createMethodCall(service, MprisPath, PlayerInterface, method);
+    auto *watcher = asyncCall(msg);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [this, method, service](QDBusPendingCallWatcher *call)
+    {
+        QDBusPendingReply<> reply = *call;
+        call->deleteLater();
+        if (reply.isError())
+        {
+            LOG_ERROR("Failed to send " << method << " to " << service << ": " << reply.error().message());
+        }
+        else
+        {
+            LOG_INFO("Successfully sent " << method << " to " << service);
+        }
+        emit commandFinished(method, !reply.isError());
+    });
+    return true;
+}
+
+void PlayerStatusWatcher::onPropertiesChanged(const QString &interface,
+                                              const QVariantMap &changed,
+                                              const QStringList &)
+{
+    if (interface != PlayerInterface || !changed.contains("PlaybackStatus"))
+    {
+        return;
+    }
+
+    // The signal comes from the unique name, which may own several MPRIS names;
+    // none of them known means it is not a player (yet)
+    const QStringList services = m_ownerToService.values(message().service());
+    for (const QString &service : services)
+    {
+        updatePlaybackStatus(service, changed.value("PlaybackStatus").toString());
+    }
+}
+
+void PlayerStatusWatcher::onNameOwnerChanged(const QString &name, const QString &, const QString &newOwner)
+{
+    if (name.startsWith(':') && newOwner.isEmpty())
+    {
+        // The process left the bus, drop every name it still owned
+        const QStringList services = m_ownerToService.values(name);
+        for (const QString &service : services)
+        {
+            removePlayer(service);
+        }
+        return;
+    }
+    if (!name.startsWith(MprisPrefix))
+    {
+        return;
+    }
+
+    if (newOwner.isEmpty())
+    {
+        removePlayer(name);
+    }
+    else
+    {
+        addPlayer(name, newOwner);
+    }
+}
@@ -1,25 +1,63 @@
 #pragma once
 
 #include <QObject>
-#include <QDBusInterface>
-#include <QDBusServiceWatcher>
+#include <QHash>
+#include <QMultiHash>
+#include <QDBusContext>
 
-class PlayerStatusWatcher : public QObject {
+class QDBusMessage;
+class QDBusPendingCallWatcher;
+
+// Registry of all MPRIS players on the session bus. Players are tracked through
+// NameOwnerChanged and their PropertiesChanged signals, so every query below is
+// answered from memory without any bus traffic.
+class PlayerStatusWatcher : public QObject, protected QDBusContext {
     Q_OBJECT
 public:
-    explicit PlayerStatusWatcher(const QString &playerService, QObject *parent = nullptr);
-    static QString getCurrentPlaybackStatus(const QString &playerService);
+    struct Player {
+        QString service;        // Well-known name, e.g. org.mpris.MediaPlayer2.spotify
+        QString owner;          // Unique bus name currently owning the service
+        QString playbackStatus; // "Playing", "Paused", "Stopped" or empty if unknown
+        qint64 lastActive = 0;  // Msecs since epoch of the last Playing transition
+    };
+
+    explicit PlayerStatusWatcher(QObject *parent = nullptr);
+
+    // Service of the player that most recently started playing and still is, or empty
+    QString activePlayer() const { return m_activePlayer; }
+    // Service of the player that was playing most recently, even if it is paused now.
+    // Until any player has played, a paused (or failing that, any) known player.
+    QString lastActivePlayer() const { return m_lastActivePlayer; }
+    // "Playing" if any player plays, otherwise the status of the last active player
+    QString currentPlaybackStatus() const { return m_currentStatus; }
+
+    // Sends Play to the last active player or Pause to the active player, asynchronously
+    bool sendCommand(const QString &method);
 
 signals:
     void playbackStatusChanged(const QString &status);
+    // Reply to a sendCommand() arrived
+    void commandFinished(const QString &method, bool success);
 
 private slots:
     void onPropertiesChanged(const QString &interface, const QVariantMap &changed, const QStringList &);
-    void onServiceOwnerChanged(const QString &name, const QString &oldOwner, const QString &newOwner);
+    void onNameOwnerChanged(const QString &name, const QString &oldOwner, const QString &newOwner);
 
 private:
-    void updateStatus();
-    QString m_playerService;
-    QDBusInterface *m_iface;
-    QDBusServiceWatcher *m_serviceWatcher;
-};
\ No newline at end of file
+    // Sends msg on the session bus, the reply time goes into the D-Bus latency histogram
+    QDBusPendingCallWatcher *asyncCall(const QDBusMessage &msg);
+    void listPlayers();
+    void queryOwner(const QString &service);
+    void queryPlaybackStatus(const QString &service);
+    void addPlayer(const QString &service, const QString &owner);
+    void removePlayer(const QString &service);
+    void updatePlaybackStatus(const QString &service, const QString &status);
+    void refreshActivePlayers();
+    void updateCurrentStatus();
+
+    QHash<QString, Player> m_players;       // Keyed by well-known service name
+    QMultiHash<QString, QString> m_ownerToService; // One process may own several MPRIS names
+    QString m_activePlayer;
+    QString m_lastActivePlayer;
+    QString m_currentStatus;
+};
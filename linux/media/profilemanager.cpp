@@ -0,0 +1,252 @@
+#include "profilemanager.h"
+#include "pulseaudioclient.h"
+#include "logger.h"
+#include "metrics.h"
+
+namespace
+{
+    // Most preferred first, covering PipeWire and PulseAudio naming
+    const QStringList A2dpPreference = {"a2dp-sink", "a2dp-sink-aac", "a2dp-sink-sbc_xq", "a2dp-sink-sbc", "a2dp_sink"};
+    const QStringList HeadsetPreference = {"headset-head-unit-msbc", "headset-head-unit", "headset-head-unit-cvsd",
+                                           "handsfree_head_unit", "headset_head_unit"};
+
+    QString pickProfile(const QStringList &available, const QStringList &preference, const QStringList &prefixes)
+    {
+        for (const QString &profile : preference)
+        {
+            if (available.contains(profile))
+            {
+                return profile;
+            }
+        }
+        for (const QString &profile : available)
+        {
+            for (const QString &prefix : prefixes)
+            {
+                if (profile.startsWith(prefix))
+                {
+                    return profile;
+                }
+            }
+        }
+        return QString();
+    }
+}
+
+ProfileManager::ProfileManager(PulseAudioClient *audio, QObject *parent)
+    : QObject(parent), m_audio(audio)
+{
+    m_returnTimer.setSingleShot(true);
+    m_returnTimer.setInterval(1500);
+    connect(&m_returnTimer, &QTimer::timeout, this, [this]()
+    {
+        if (m_switchedForCapture && !isRecordingFromHeadset())
+        {
+            LOG_INFO("Recording stopped, switching back to " << m_table.a2dp);
+            m_switchedForCapture = false;
+            restoreDefaultSource();
+            requestProfile(m_table.a2dp);
+        }
+    });
+
+    connect(m_audio, &PulseAudioClient::captureStreamsChanged, this, &ProfileManager::onCaptureStreamsChanged);
+    connect(m_audio, &PulseAudioClient::cardChanged, this, &ProfileManager::onCardChanged);
+    connect(m_audio, &PulseAudioClient::cardAdded, this, [this](const QString &name)
+    {
+        // A card that (re)appears is a new connection, resolve its profiles again
+        if (!m_macAddress.isEmpty() && name.startsWith("bluez") && name.contains(m_macAddress))
+        {
+            resolveProfiles(name);
+        }
+    });
+    connect(m_audio, &PulseAudioClient::sourceAdded, this, [this]()
+    {
+        // The AirPods microphone only appears once the headset profile is active
+        if (m_switchedForCapture && !m_streamsToMove.isEmpty())
+        {
+            routeCaptureToHeadset();
+        }
+    });
+    connect(m_audio, &PulseAudioClient::cardRemoved, this, [this](const QString &name)
+    {
+        if (name == m_table.card)
+        {
+            m_table = ProfileTable();
+            m_switchedForCapture = false;
+            m_streamsToMove.clear();
+            restoreDefaultSource();
+            m_pendingProfile.clear();
+            m_returnTimer.stop();
+        }
+    });
+}
+
+QString ProfileManager::bestA2dpProfile(const QStringList &available)
+{
+    return pickProfile(available, A2dpPreference, {"a2dp"});
+}
+
+void ProfileManager::setDevice(const QString &macAddress)
+{
+    if (macAddress == m_macAddress && m_table.isValid())
+    {
+        return;
+    }
+
+    m_macAddress = macAddress;
+    m_table = ProfileTable();
+    QString cardName = m_audio->findBluetoothCard(macAddress);
+    if (!cardName.isEmpty())
+    {
+        resolveProfiles(cardName);
+    }
+}
+
+void ProfileManager::clear()
+{
+    m_returnTimer.stop();
+    m_macAddress.clear();
+    m_table = ProfileTable();
+    m_switchedForCapture = false;
+    m_streamsToMove.clear();
+    m_previousDefaultSource.clear();
+    m_pendingProfile.clear();
+}
+
+void ProfileManager::resolveProfiles(const QString &cardName)
+{
+    const QStringList available = m_audio->card(cardName).profiles;
+    m_table.card = cardName;
+    m_table.a2dp = bestA2dpProfile(available);
+    m_table.headset = pickProfile(available, HeadsetPreference, {"headset", "handsfree"});
+    LOG_INFO("Profiles for " << cardName << ": A2DP=" << m_table.a2dp << ", headset=" << m_table.headset);
+}
+
+void ProfileManager::onCaptureStreamsChanged(int count)
+{
+    if (!m_enabled || !m_table.isValid() || m_table.headset.isEmpty() || m_table.a2dp.isEmpty())
+    {
+        return;
+    }
+
+    if (m_switchedForCapture)
+    {
+        // Streams on other microphones do not keep the AirPods in the headset profile
+        if (isRecordingFromHeadset())
+        {
+            m_returnTimer.stop();
+        }
+        else if (!m_returnTimer.isActive())
+        {
+            m_returnTimer.start(); // Short gaps between streams keep the headset profile
+        }
+        return;
+    }
+    if (count == 0)
+    {
+        return;
+    }
+
+    // Only take over while the AirPods are playing A2DP and are the output in use,
+    // an "off" card or a profile picked by the user is left alone
+    if (m_audio->card(m_table.card).activeProfile != m_table.a2dp ||
+        !m_audio->defaultSinkName().contains(m_macAddress))
+    {
+        return;
+    }
+
+    // Only streams that follow the default source would end up on the AirPods microphone,
+    // one recording from a device of its choice keeps it and the AirPods keep A2DP
+    const QList<quint32> streams = m_audio->defaultCaptureStreams();
+    if (streams.isEmpty())
+    {
+        return;
+    }
+
+    LOG_INFO("Recording started, switching " << m_table.card << " to " << m_table.headset);
+    m_switchedForCapture = true;
+    m_streamsToMove = streams;
+    m_previousDefaultSource = m_audio->defaultSourceName();
+    requestProfile(m_table.headset);
+}
+
+void ProfileManager::onCardChanged(const QString &name)
+{
+    if (name != m_table.card)
+    {
+        return;
+    }
+
+    const PulseAudioClient::Card card = m_audio->card(name);
+    if (m_table.a2dp.isEmpty() || m_table.headset.isEmpty())
+    {
+        resolveProfiles(name); // Some profiles only show up once the link is fully up
+    }
+
+    if (!m_pendingProfile.isEmpty() && card.activeProfile == m_pendingProfile)
+    {
+        const qint64 elapsed = m_switchClock.elapsed();
+        // Labelled by kind, the concrete profile names differ between cards and codecs
+        Metrics::histogram("librepods_profile_switch_latency_ms",
+                           "Time from requesting an A2DP or headset profile until the card reported it active",
+                           {{"profile", m_pendingProfile == m_table.a2dp ? "a2dp" : "headset"}}).observe(elapsed);
+        LOG_INFO("Switched to " << m_pendingProfile << " in " << elapsed << "ms");
+        m_pendingProfile.clear();
+        if (m_switchedForCapture && !m_streamsToMove.isEmpty())
+        {
+            routeCaptureToHeadset();
+        }
+    }
+    else if (m_pendingProfile.isEmpty() && m_switchedForCapture && card.activeProfile != m_table.headset)
+    {
+        // Someone else changed the profile, do not switch it back later
+        m_switchedForCapture = false;
+        m_streamsToMove.clear();
+        m_previousDefaultSource.clear();
+        m_returnTimer.stop();
+    }
+}
+
+void ProfileManager::requestProfile(const QString &profile)
+{
+    m_pendingProfile = profile;
+    m_switchClock.start();
+    m_audio->setCardProfile(m_table.card, profile);
+}
+
+void ProfileManager::routeCaptureToHeadset()
+{
+    const QString source = m_audio->cardSource(m_table.card);
+    if (source.isEmpty())
+    {
+        return; // Not there yet, sourceAdded() tries again
+    }
+
+    LOG_INFO("Moving " << m_streamsToMove.size() << " recording streams to " << source);
+    m_audio->setDefaultSource(source);
+    for (quint32 stream : std::as_const(m_streamsToMove))
+    {
+        m_audio->moveSourceOutput(stream, source);
+    }
+    m_streamsToMove.clear();
+}
+
+bool ProfileManager::isRecordingFromHeadset() const
+{
+    // Streams still waiting to be moved count as recording from the AirPods
+    if (!m_streamsToMove.isEmpty())
+    {
+        return true;
+    }
+    const QString source = m_audio->cardSource(m_table.card);
+    return !source.isEmpty() && !m_audio->sourceCaptureStreams(source).isEmpty();
+}
+
+void ProfileManager::restoreDefaultSource()
+{
+    if (!m_previousDefaultSource.isEmpty())
+    {
+        m_audio->setDefaultSource(m_previousDefaultSource);
+        m_previousDefaultSource.clear();
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QTimer>
+
+class PulseAudioClient;
+
+// Switches the AirPods card to the headset (HFP/HSP) profile while something
+// records from the default source and back to A2DP once nothing records from
+// the AirPods microphone. The
+// recording streams are moved to the AirPods microphone, which stays the
+// default source until the switch back. Streams pinned to a device are left
+// alone. The concrete profile names are resolved once per connection from the
+// card's profile list.
+class ProfileManager : public QObject
+{
+    Q_OBJECT
+public:
+    struct ProfileTable
+    {
+        QString card;
+        QString a2dp;    // Best available A2DP sink profile
+        QString headset; // Best available headset profile with a microphone
+        bool isValid() const { return !card.isEmpty(); }
+    };
+
+    explicit ProfileManager(PulseAudioClient *audio, QObject *parent = nullptr);
+
+    // Best A2DP sink profile in a card's profile list, codec-specific names included, or empty
+    static QString bestA2dpProfile(const QStringList &available);
+
+    void setDevice(const QString &macAddress);
+    void clear();
+
+    const ProfileTable &profiles() const { return m_table; }
+    // True while the headset profile is active because of a capture stream
+    bool isHeadsetActiveForCapture() const { return m_switchedForCapture; }
+
+    void setEnabled(bool enabled) { m_enabled = enabled; }
+    void setReturnDelay(int msec) { m_returnTimer.setInterval(msec); }
+
+private:
+    void resolveProfiles(const QString &cardName);
+    void onCaptureStreamsChanged(int count);
+    void onCardChanged(const QString &name);
+    void requestProfile(const QString &profile);
+    void routeCaptureToHeadset();
+    void restoreDefaultSource();
+    // Something records from the AirPods microphone, or is about to
+    bool isRecordingFromHeadset() const;
+
+    PulseAudioClient *m_audio;
+    QString m_macAddress;
+    ProfileTable m_table;
+    bool m_enabled = false;
+    bool m_switchedForCapture = false;
+    QList<quint32> m_streamsToMove;   // Recording streams waiting for the AirPods source
+    QString m_previousDefaultSource;  // Restored when switching back to A2DP
+
+    QTimer m_returnTimer;
+    QString m_pendingProfile;
+    QElapsedTimer m_switchClock; // From requesting a profile until the card reports it active
+};
@@ -0,0 +1,616 @@
+#include "pulseaudioclient.h"
+#include "logger.h"
+
+#include <QTimer>
+#include <pulse/pulseaudio.h>
+
+namespace
+{
+    struct ProfileRequest
+    {
+        PulseAudioClient *client;
+        QString card;
+        QString profile;
+    };
+
+    void unrefOperation(pa_operation *operation)
+    {
+        if (operation)
+        {
+            pa_operation_unref(operation);
+        }
+    }
+}
+
+// Everything in here runs on the libpulse mainloop thread with the mainloop
+// lock held. Results are copied and posted to the client's thread.
+struct PulseAudioClient::Callbacks
+{
+    static void contextState(pa_context *context, void *userdata)
+    {
+        auto *client = static_cast<PulseAudioClient *>(userdata);
+        switch (pa_context_get_state(context))
+        {
+        case PA_CONTEXT_READY:
+            pa_context_set_subscribe_callback(context, &Callbacks::subscription, client);
+            unrefOperation(pa_context_subscribe(
+                context,
+                static_cast<pa_subscription_mask_t>(PA_SUBSCRIPTION_MASK_CARD | PA_SUBSCRIPTION_MASK_SINK |
+                                                    PA_SUBSCRIPTION_MASK_SOURCE | PA_SUBSCRIPTION_MASK_SOURCE_OUTPUT |
+                                                    PA_SUBSCRIPTION_MASK_SERVER),
+                nullptr, nullptr));
+            // Replies arrive in request order, so the card list finishes last
+            unrefOperation(pa_context_get_server_info(context, &Callbacks::serverInfo, client));
+            unrefOperation(pa_context_get_sink_info_list(context, &Callbacks::sinkInfo, client));
+            unrefOperation(pa_context_get_source_info_list(context, &Callbacks::sourceInfo, client));
+            unrefOperation(pa_context_get_source_output_info_list(context, &Callbacks::sourceOutputInfo, client));
+            unrefOperation(pa_context_get_card_info_list(context, &Callbacks::cardList, client));
+            break;
+        case PA_CONTEXT_FAILED:
+        case PA_CONTEXT_TERMINATED:
+            QMetaObject::invokeMethod(client, [client]() { client->onContextLost(); }, Qt::QueuedConnection);
+            break;
+        default:
+            break;
+        }
+    }
+
+    static void subscription(pa_context *context, pa_subscription_event_type_t type, uint32_t index, void *userdata)
+    {
+        auto *client = static_cast<PulseAudioClient *>(userdata);
+        int facility = type & PA_SUBSCRIPTION_EVENT_FACILITY_MASK;
+        int event = type & PA_SUBSCRIPTION_EVENT_TYPE_MASK;
+
+        if (facility == PA_SUBSCRIPTION_EVENT_CARD)
+        {
+            if (event == PA_SUBSCRIPTION_EVENT_REMOVE)
+            {
+                QMetaObject::invokeMethod(client, [client, index]() { client->removeCard(index); }, Qt::QueuedConnection);
+            }
+            else
+            {
+                unrefOperation(pa_context_get_card_info_by_index(context, index, &Callbacks::cardInfo, client));
+            }
+        }
+        else if (facility == PA_SUBSCRIPTION_EVENT_SINK)
+        {
+            if (event == PA_SUBSCRIPTION_EVENT_REMOVE)
+            {
+                QMetaObject::invokeMethod(client, [client, index]() { client->removeSink(index); }, Qt::QueuedConnection);
+            }
+            else
+            {
+                unrefOperation(pa_context_get_sink_info_by_index(context, index, &Callbacks::sinkInfo, client));
+            }
+        }
+        else if (facility == PA_SUBSCRIPTION_EVENT_SOURCE)
+        {
+            if (event == PA_SUBSCRIPTION_EVENT_REMOVE)
+            {
+                QMetaObject::invokeMethod(client, [client, index]() { client->removeSource(index); }, Qt::QueuedConnection);
+            }
+            else
+            {
+                unrefOperation(pa_context_get_source_info_by_index(context, index, &Callbacks::sourceInfo, client));
+            }
+        }
+        else if (facility == PA_SUBSCRIPTION_EVENT_SOURCE_OUTPUT)
+        {
+            if (event == PA_SUBSCRIPTION_EVENT_REMOVE)
+            {
+                QMetaObject::invokeMethod(client, [client, index]() { client->removeSourceOutput(index); },
+                                          Qt::QueuedConnection);
+            }
+            else
+            {
+                unrefOperation(pa_context_get_source_output_info(context, index, &Callbacks::sourceOutputInfo, client));
+            }
+        }
+        else if (facility == PA_SUBSCRIPTION_EVENT_SERVER)
+        {
+            unrefOperation(pa_context_get_server_info(context, &Callbacks::serverInfo, client));
+        }
+    }
+
+    static Card toCard(const pa_card_info *info)
+    {
+        Card card;
+        card.index = info->index;
+        card.name = QString::fromUtf8(info->name);
+        for (uint32_t i = 0; i < info->n_profiles; ++i)
+        {
+            const pa_card_profile_info2 *profile = info->profiles2[i];
+            if (profile->available)
+            {
+                card.profiles << QString::fromUtf8(profile->name);
+            }
+        }
+        if (info->active_profile2)
+        {
+            card.activeProfile = QString::fromUtf8(info->active_profile2->name);
+        }
+        return card;
+    }
+
+    static void cardInfo(pa_context *, const pa_card_info *info, int eol, void *userdata)
+    {
+        if (eol || !info)
+        {
+            return;
+        }
+        auto *client = static_cast<PulseAudioClient *>(userdata);
+        Card card = toCard(info);
+        QMetaObject::invokeMethod(client, [client, card]() { client->updateCard(card); }, Qt::QueuedConnection);
+    }
+
+    static void cardList(pa_context *context, const pa_card_info *info, int eol, void *userdata)
+    {
+        auto *client = static_cast<PulseAudioClient *>(userdata);
+        if (eol)
+        {
+            // The initial card list is complete, the caches are usable from now on
+            QMetaObject::invokeMethod(client, [client]() { client->onContextReady(); }, Qt::QueuedConnection);
+            return;
+        }
+        cardInfo(context, info, eol, userdata);
+    }
+
+    static void sinkInfo(pa_context *, const pa_sink_info *info, int eol, void *userdata)
+    {
+        if (eol || !info)
+        {
+            return;
+        }
+        auto *client = static_cast<PulseAudioClient *>(userdata);
+        Sink sink;
+        sink.index = info->index;
+        sink.name = QString::fromUtf8(info->name);
+        sink.card = info->card;
+        sink.channels = info->volume.channels;
+        sink.volume = qRound(pa_cvolume_avg(&info->volume) * 100.0 / PA_VOLUME_NORM);
+        QMetaObject::invokeMethod(client, [client, sink]() { client->updateSink(sink); }, Qt::QueuedConnection);
+    }
+
+    static void sourceInfo(pa_context *, const pa_source_info *info, int eol, void *userdata)
+    {
+        if (eol || !info)
+        {
+            return;
+        }
+        auto *client = static_cast<PulseAudioClient *>(userdata);
+        Source source;
+        source.index = info->index;
+        source.name = QString::fromUtf8(info->name);
+        source.card = info->card;
+        source.monitor = info->monitor_of_sink != PA_INVALID_INDEX;
+        QMetaObject::invokeMethod(client, [client, source]() { client->updateSource(source); }, Qt::QueuedConnection);
+    }
+
+    static void sourceOutputInfo(pa_context *, const pa_source_output_info *info, int eol, void *userdata)
+    {
+        if (eol || !info)
+        {
+            return;
+        }
+        auto *client = static_cast<PulseAudioClient *>(userdata);
+        SourceOutput output;
+        output.index = info->index;
+        output.source = info->source;
+        output.application = QString::fromUtf8(pa_proplist_gets(info->proplist, PA_PROP_APPLICATION_NAME));
+        // PipeWire records an explicit target in the stream's properties
+        output.pinned = pa_proplist_contains(info->proplist, "target.object") == 1 ||
+                        pa_proplist_contains(info->proplist, "node.target") == 1;
+        QMetaObject::invokeMethod(client, [client, output]() { client->updateSourceOutput(output); },
+                                  Qt::QueuedConnection);
+    }
+
+    static void serverInfo(pa_context *, const pa_server_info *info, void *userdata)
+    {
+        if (!info)
+        {
+            return;
+        }
+        auto *client = static_cast<PulseAudioClient *>(userdata);
+        QString defaultSink = QString::fromUtf8(info->default_sink_name);
+        QString defaultSource = QString::fromUtf8(info->default_source_name);
+        QMetaObject::invokeMethod(client, [client, defaultSink, defaultSource]()
+                                  {
+                                      client->updateDefaultSink(defaultSink);
+                                      client->updateDefaultSource(defaultSource);
+                                  },
+                                  Qt::QueuedConnection);
+    }
+
+    static void profileSet(pa_context *, int success, void *userdata)
+    {
+        auto *request = static_cast<ProfileRequest *>(userdata);
+        PulseAudioClient *client = request->client;
+        QString card = request->card;
+        QString profile = request->profile;
+        delete request;
+        QMetaObject::invokeMethod(client, [client, card, profile, success]()
+                                  { emit client->cardProfileSet(card, profile, success != 0); },
+                                  Qt::QueuedConnection);
+    }
+};
+
+PulseAudioClient::PulseAudioClient(QObject *parent) : QObject(parent)
+{
+    m_mainloop = pa_threaded_mainloop_new();
+    if (!m_mainloop || pa_threaded_mainloop_start(m_mainloop) < 0)
+    {
+        LOG_ERROR("Failed to start the audio server mainloop");
+        return;
+    }
+    connectToServer();
+}
+
+PulseAudioClient::~PulseAudioClient()
+{
+    if (!m_mainloop)
+    {
+        return;
+    }
+
+    pa_threaded_mainloop_lock(m_mainloop);
+    if (m_context)
+    {
+        pa_context_set_state_callback(m_context, nullptr, nullptr);
+        pa_context_disconnect(m_context);
+        pa_context_unref(m_context);
+        m_context = nullptr;
+    }
+    pa_threaded_mainloop_unlock(m_mainloop);
+    pa_threaded_mainloop_stop(m_mainloop);
+    pa_threaded_mainloop_free(m_mainloop);
+}
+
+void PulseAudioClient::connectToServer()
+{
+    if (!m_mainloop)
+    {
+        return;
+    }
+
+    pa_threaded_mainloop_lock(m_mainloop);
+    if (m_context)
+    {
+        pa_context_set_state_callback(m_context, nullptr, nullptr);
+        pa_context_disconnect(m_context);
+        pa_context_unref(m_context);
+    }
+    m_context = pa_context_new(pa_threaded_mainloop_get_api(m_mainloop), "LibrePods");
+    pa_context_set_state_callback(m_context, &Callbacks::contextState, this);
+    // NOFAIL waits for the server to appear instead of failing right away
+    if (pa_context_connect(m_context, nullptr, PA_CONTEXT_NOFAIL, nullptr) < 0)
+    {
+        LOG_ERROR("Failed to connect to the audio server: " << pa_strerror(pa_context_errno(m_context)));
+    }
+    pa_threaded_mainloop_unlock(m_mainloop);
+}
+
+void PulseAudioClient::onContextReady()
+{
+    m_ready = true;
+    LOG_INFO("Connected to audio server, " << m_cards.size() << " cards known");
+    emit ready();
+}
+
+void PulseAudioClient::onContextLost()
+{
+    bool wasReady = m_ready;
+    m_ready = false;
+    m_cards.clear();
+    m_sinks.clear();
+    m_defaultSink.clear();
+    m_defaultSource.clear();
+    m_sources.clear();
+    m_sourceOutputs.clear();
+    updateCaptureStreamCount();
+    if (wasReady)
+    {
+        emit disconnected();
+    }
+    LOG_WARN("Lost connection to audio server, reconnecting");
+    QTimer::singleShot(1000, this, &PulseAudioClient::connectToServer);
+}
+
+void PulseAudioClient::updateCard(const Card &card)
+{
+    bool known = m_cards.contains(card.index);
+    m_cards.insert(card.index, card);
+    if (known)
+    {
+        emit cardChanged(card.name);
+    }
+    else
+    {
+        LOG_DEBUG("Audio card appeared: " << card.name);
+        emit cardAdded(card.name);
+    }
+}
+
+void PulseAudioClient::removeCard(quint32 index)
+{
+    auto it = m_cards.find(index);
+    if (it == m_cards.end())
+    {
+        return;
+    }
+    QString name = it->name;
+    m_cards.erase(it);
+    LOG_DEBUG("Audio card removed: " << name);
+    emit cardRemoved(name);
+}
+
+void PulseAudioClient::updateSink(const Sink &sink)
+{
+    int previousVolume = m_sinks.value(sink.index).volume;
+    m_sinks.insert(sink.index, sink);
+    if (sink.volume != previousVolume)
+    {
+        emit sinkVolumeChanged(sink.name, sink.volume);
+    }
+}
+
+void PulseAudioClient::removeSink(quint32 index)
+{
+    auto it = m_sinks.find(index);
+    if (it == m_sinks.end())
+    {
+        return;
+    }
+    QString name = it->name;
+    m_sinks.erase(it);
+    emit sinkRemoved(name);
+}
+
+void PulseAudioClient::updateDefaultSink(const QString &name)
+{
+    if (m_defaultSink != name)
+    {
+        m_defaultSink = name;
+        LOG_DEBUG("Default sink: " << name);
+        emit defaultSinkChanged(name);
+    }
+}
+
+void PulseAudioClient::updateDefaultSource(const QString &name)
+{
+    if (m_defaultSource != name)
+    {
+        m_defaultSource = name;
+        LOG_DEBUG("Default source: " << name);
+    }
+}
+
+void PulseAudioClient::updateSource(const Source &source)
+{
+    bool known = m_sources.contains(source.index);
+    m_sources.insert(source.index, source);
+    updateCaptureStreamCount();
+    if (!known)
+    {
+        emit sourceAdded(source.name);
+    }
+}
+
+void PulseAudioClient::removeSource(quint32 index)
+{
+    if (m_sources.remove(index))
+    {
+        updateCaptureStreamCount();
+    }
+}
+
+void PulseAudioClient::updateSourceOutput(const SourceOutput &output)
+{
+    if (!m_sourceOutputs.contains(output.index))
+    {
+        LOG_DEBUG("Capture stream started by " << output.application);
+    }
+    m_sourceOutputs.insert(output.index, output);
+    updateCaptureStreamCount();
+}
+
+void PulseAudioClient::removeSourceOutput(quint32 index)
+{
+    if (m_sourceOutputs.remove(index))
+    {
+        updateCaptureStreamCount();
+    }
+}
+
+void PulseAudioClient::updateCaptureStreamCount()
+{
+    int count = 0;
+    for (const SourceOutput &output : std::as_const(m_sourceOutputs))
+    {
+        auto source = m_sources.constFind(output.source);
+        if (source == m_sources.constEnd() || !source->monitor)
+        {
+            ++count;
+        }
+    }
+
+    if (count != m_captureStreams)
+    {
+        m_captureStreams = count;
+        emit captureStreamsChanged(count);
+    }
+}
+
+int PulseAudioClient::captureStreamCount() const
+{
+    return m_captureStreams;
+}
+
+QList<quint32> PulseAudioClient::defaultCaptureStreams() const
+{
+    QList<quint32> streams;
+    for (const SourceOutput &output : m_sourceOutputs)
+    {
+        auto source = m_sources.constFind(output.source);
+        if (!output.pinned && source != m_sources.constEnd() && !source->monitor && source->name == m_defaultSource)
+        {
+            streams << output.index;
+        }
+    }
+    return streams;
+}
+
+QList<quint32> PulseAudioClient::sourceCaptureStreams(const QString &source) const
+{
+    QList<quint32> streams;
+    for (const SourceOutput &output : m_sourceOutputs)
+    {
+        auto cached = m_sources.constFind(output.source);
+        if (cached != m_sources.constEnd() && cached->name == source)
+        {
+            streams << output.index;
+        }
+    }
+    return streams;
+}
+
+QString PulseAudioClient::cardSource(const QString &card) const
+{
+    for (const Card &cached : m_cards)
+    {
+        if (cached.name != card)
+        {
+            continue;
+        }
+        for (const Source &source : m_sources)
+        {
+            if (source.card == cached.index && !source.monitor)
+            {
+                return source.name;
+            }
+        }
+    }
+    return QString();
+}
+
+int PulseAudioClient::sinkVolume(const QString &name) const
+{
+    for (const Sink &sink : m_sinks)
+    {
+        if (sink.name == name)
+        {
+            return sink.volume;
+        }
+    }
+    return -1;
+}
+
+PulseAudioClient::Card PulseAudioClient::card(const QString &name) const
+{
+    for (const Card &card : m_cards)
+    {
+        if (card.name == name)
+        {
+            return card;
+        }
+    }
+    return Card();
+}
+
+QString PulseAudioClient::findBluetoothCard(const QString &macAddress) const
+{
+    if (macAddress.isEmpty())
+    {
+        return QString();
+    }
+    for (const Card &card : m_cards)
+    {
+        if (card.name.startsWith("bluez") && card.name.contains(macAddress))
+        {
+            return card.name;
+        }
+    }
+    return QString();
+}
+
+void PulseAudioClient::setCardProfile(const QString &card, const QString &profile)
+{
+    if (!m_ready)
+    {
+        LOG_WARN("Audio server not connected, cannot set profile " << profile << " on " << card);
+        emit cardProfileSet(card, profile, false);
+        return;
+    }
+
+    auto *request = new ProfileRequest{this, card, profile};
+    pa_threaded_mainloop_lock(m_mainloop);
+    pa_operation *operation = pa_context_set_card_profile_by_name(
+        m_context, card.toUtf8().constData(), profile.toUtf8().constData(), &Callbacks::profileSet, request);
+    unrefOperation(operation);
+    pa_threaded_mainloop_unlock(m_mainloop);
+
+    if (!operation)
+    {
+        delete request;
+        LOG_ERROR("Failed to request profile " << profile << " on " << card);
+        emit cardProfileSet(card, profile, false);
+    }
+}
+
+void PulseAudioClient::setSinkVolume(const QString &sink, int percent)
+{
+    if (!m_ready)
+    {
+        LOG_WARN("Audio server not connected, cannot set volume of " << sink);
+        return;
+    }
+
+    quint8 channels = 0;
+    for (const Sink &cached : std::as_const(m_sinks))
+    {
+        if (cached.name == sink)
+        {
+            channels = cached.channels;
+            break;
+        }
+    }
+    if (channels == 0)
+    {
+        LOG_WARN("Unknown sink " << sink << ", cannot set volume");
+        return;
+    }
+
+    // Up to the UI maximum (about 153%), so a boosted volume is restored as it was
+    const double fraction = qBound(0.0, percent / 100.0, double(PA_VOLUME_UI_MAX) / PA_VOLUME_NORM);
+    pa_cvolume volume;
+    pa_cvolume_set(&volume, channels, static_cast<pa_volume_t>(qRound(PA_VOLUME_NORM * fraction)));
+
+    pa_threaded_mainloop_lock(m_mainloop);
+    unrefOperation(pa_context_set_sink_volume_by_name(m_context, sink.toUtf8().constData(), &volume, nullptr, nullptr));
+    pa_threaded_mainloop_unlock(m_mainloop);
+}
+
+void PulseAudioClient::setDefaultSource(const QString &source)
+{
+    if (!m_ready)
+    {
+        LOG_WARN("Audio server not connected, cannot make " << source << " the default source");
+        return;
+    }
+
+    pa_threaded_mainloop_lock(m_mainloop);
+    unrefOperation(pa_context_set_default_source(m_context, source.toUtf8().constData(), nullptr, nullptr));
+    pa_threaded_mainloop_unlock(m_mainloop);
+}
+
+void PulseAudioClient::moveSourceOutput(quint32 index, const QString &source)
+{
+    if (!m_ready)
+    {
+        LOG_WARN("Audio server not connected, cannot move capture stream " << index);
+        return;
+    }
+
+    pa_threaded_mainloop_lock(m_mainloop);
+    unrefOperation(pa_context_move_source_output_by_name(m_context, index, source.toUtf8().constData(), nullptr, nullptr));
+    pa_threaded_mainloop_unlock(m_mainloop);
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <QObject>
+#include <QHash>
+#include <QStringList>
+
+struct pa_threaded_mainloop;
+struct pa_context;
+
+// Persistent connection to the PulseAudio (or pipewire-pulse) server.
+// Server state is mirrored into caches from subscription events, so lookups
+// never spawn pactl and commands never block the caller. All public methods
+// and signals live on the thread that created the client.
+class PulseAudioClient : public QObject
+{
+    Q_OBJECT
+public:
+    struct Card
+    {
+        quint32 index = 0;
+        QString name;
+        QStringList profiles; // Available profiles only
+        QString activeProfile;
+    };
+
+    struct Sink
+    {
+        quint32 index = 0;
+        QString name;
+        quint32 card = 0;
+        quint8 channels = 0;
+        int volume = -1; // Average volume in percent
+    };
+
+    struct Source
+    {
+        quint32 index = 0;
+        QString name;
+        quint32 card = 0;
+        bool monitor = false; // Monitor of a sink rather than a capture device
+    };
+
+    struct SourceOutput
+    {
+        quint32 index = 0;
+        quint32 source = 0;
+        QString application;
+        bool pinned = false; // Asked for a specific source instead of following the default
+    };
+
+    explicit PulseAudioClient(QObject *parent = nullptr);
+    ~PulseAudioClient() override;
+
+    bool isReady() const { return m_ready; }
+
+    QString defaultSinkName() const { return m_defaultSink; }
+    QString defaultSourceName() const { return m_defaultSource; }
+    // Cached volume of the sink in percent, or -1 if unknown
+    int sinkVolume(const QString &name) const;
+    // Streams recording from a capture device, monitor streams are not counted
+    int captureStreamCount() const;
+    // Capture streams that record from the default source and are not pinned to it,
+    // the ones that would follow a new default source
+    QList<quint32> defaultCaptureStreams() const;
+    // Capture streams recording from the named source, pinned or not
+    QList<quint32> sourceCaptureStreams(const QString &source) const;
+    // The capture (non-monitor) source of a card, or empty
+    QString cardSource(const QString &card) const;
+
+    Card card(const QString &name) const;
+    // Name of the bluez card belonging to the given address (XX_XX_XX_XX_XX_XX), or empty
+    QString findBluetoothCard(const QString &macAddress) const;
+
+    void setCardProfile(const QString &card, const QString &profile);
+    void setSinkVolume(const QString &sink, int percent);
+    void setDefaultSource(const QString &source);
+    void moveSourceOutput(quint32 index, const QString &source);
+
+signals:
+    void ready();
+    void disconnected();
+    void cardAdded(const QString &name);
+    void cardChanged(const QString &name);
+    void cardRemoved(const QString &name);
+    void defaultSinkChanged(const QString &name);
+    void sinkVolumeChanged(const QString &name, int percent);
+    void sinkRemoved(const QString &name);
+    void sourceAdded(const QString &name);
+    void captureStreamsChanged(int count);
+    void cardProfileSet(const QString &card, const QString &profile, bool success);
+
+private:
+    void connectToServer();
+    void onContextReady();
+    void onContextLost();
+    void updateCard(const Card &card);
+    void removeCard(quint32 index);
+    void updateSink(const Sink &sink);
+    void removeSink(quint32 index);
+    void updateDefaultSink(const QString &name);
+    void updateDefaultSource(const QString &name);
+    void updateSource(const Source &source);
+    void removeSource(quint32 index);
+    void updateSourceOutput(const SourceOutput &output);
+    void removeSourceOutput(quint32 index);
+    void updateCaptureStreamCount();
+
+    // libpulse callbacks, defined next to the implementation
+    struct Callbacks;
+
+    pa_threaded_mainloop *m_mainloop = nullptr;
+    pa_context *m_context = nullptr;
+    bool m_ready = false;
+
+    QHash<quint32, Card> m_cards;
+    QHash<quint32, Sink> m_sinks;
+    QString m_defaultSink;
+    QString m_defaultSource;
+    QHash<quint32, Source> m_sources;
+    QHash<quint32, SourceOutput> m_sourceOutputs;
+    int m_captureStreams = 0;
+};
@@ -0,0 +1,242 @@
+#include "metrics.h"
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutexLocker>
+#include <algorithm>
+
+namespace Metrics
+{
+    Histogram::Histogram(std::vector<double> bounds)
+        : m_bounds(std::move(bounds)), m_buckets(new std::atomic<quint64>[m_bounds.size() + 1])
+    {
+        for (size_t i = 0; i <= m_bounds.size(); ++i)
+        {
+            m_buckets[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void Histogram::observe(double value)
+    {
+        size_t bucket = std::lower_bound(m_bounds.begin(), m_bounds.end(), value) - m_bounds.begin();
+        m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        m_sumMicros.fetch_add(quint64(qMax(0.0, value) * 1000.0), std::memory_order_relaxed);
+    }
+
+    std::vector<quint64> Histogram::bucketCounts() const
+    {
+        std::vector<quint64> counts(m_bounds.size() + 1);
+        for (size_t i = 0; i < counts.size(); ++i)
+        {
+            counts[i] = m_buckets[i].load(std::memory_order_relaxed);
+        }
+        return counts;
+    }
+
+    const std::vector<double> &latencyBounds()
+    {
+        static const std::vector<double> bounds = {1, 2, 5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000};
+        return bounds;
+    }
+
+    Registry &Registry::instance()
+    {
+        static Registry registry;
+        return registry;
+    }
+
+    Registry::Entry &Registry::find(Type type, const QString &name, const QString &help, const Labels &labels)
+    {
+        for (Entry &entry : m_entries)
+        {
+            if (entry.type == type && entry.name == name && entry.labels == labels)
+            {
+                return entry;
+            }
+        }
+        m_entries.push_back(Entry{type, name, help, labels, nullptr, nullptr, nullptr});
+        return m_entries.back();
+    }
+
+    Counter &Registry::counter(const QString &name, const QString &help, const Labels &labels)
+    {
+        QMutexLocker locker(&m_mutex);
+        Entry &entry = find(Type::Counter, name, help, labels);
+        if (!entry.counter)
+        {
+            entry.counter = std::make_unique<Counter>();
+        }
+        return *entry.counter;
+    }
+
+    Gauge &Registry::gauge(const QString &name, const QString &help, const Labels &labels)
+    {
+        QMutexLocker locker(&m_mutex);
+        Entry &entry = find(Type::Gauge, name, help, labels);
+        if (!entry.gauge)
+        {
+            entry.gauge = std::make_unique<Gauge>();
+        }
+        return *entry.gauge;
+    }
+
+    Histogram &Registry::histogram(const QString &name, const QString &help, const Labels &labels,
+                                   const std::vector<double> &bounds)
+    {
+        QMutexLocker locker(&m_mutex);
+        Entry &entry = find(Type::Histogram, name, help, labels);
+        if (!entry.histogram)
+        {
+            entry.histogram = std::make_unique<Histogram>(bounds);
+        }
+        return *entry.histogram;
+    }
+
+    namespace
+    {
+        QByteArray labelText(const Labels &labels, const QString &extraName = QString(), const QString &extraValue = QString())
+        {
+            Labels all = labels;
+            if (!extraName.isEmpty())
+            {
+                all.append({extraName, extraValue});
+            }
+            if (all.isEmpty())
+            {
+                return QByteArray();
+            }
+
+            QByteArray text = "{";
+            for (int i = 0; i < all.size(); ++i)
+            {
+                if (i > 0)
+                {
+                    text += ',';
+                }
+                QString value = all[i].second;
+                value.replace('\\', "\\\\").replace('"', "\\\"");
+                text += all[i].first.toUtf8() + "=\"" + value.toUtf8() + '"';
+            }
+            return text + '}';
+        }
+
+        QJsonObject labelObject(const Labels &labels)
+        {
+            QJsonObject object;
+            for (const auto &label : labels)
+            {
+                object.insert(label.first, label.second);
+            }
+            return object;
+        }
+    }
+
+    QByteArray Registry::prometheusText() const
+    {
+        QMutexLocker locker(&m_mutex);
+
+        // Samples of one metric have to be listed together, labels may have been
+        // registered at any time
+        QList<QString> names;
+        for (const Entry &entry : m_entries)
+        {
+            if (!names.contains(entry.name))
+            {
+                names.append(entry.name);
+            }
+        }
+
+        QByteArray text;
+        for (const QString &metricName : names)
+        {
+            const QByteArray name = metricName.toUtf8();
+            bool described = false;
+            for (const Entry &entry : m_entries)
+            {
+                if (entry.name != metricName)
+                {
+                    continue;
+                }
+                if (!described)
+                {
+                    described = true;
+                    const char *type = entry.type == Type::Counter ? "counter" : entry.type == Type::Gauge ? "gauge" : "histogram";
+                    text += "# HELP " + name + ' ' + entry.help.toUtf8() + '\n';
+                    text += "# TYPE " + name + ' ' + type + '\n';
+                }
+
+                switch (entry.type)
+                {
+                case Type::Counter:
+                    text += name + labelText(entry.labels) + ' ' + QByteArray::number(entry.counter->value()) + '\n';
+                    break;
+                case Type::Gauge:
+                    text += name + labelText(entry.labels) + ' ' + QByteArray::number(entry.gauge->value()) + '\n';
+                    break;
+                case Type::Histogram:
+                {
+                    const Histogram &histogram = *entry.histogram;
+                    const std::vector<quint64> counts = histogram.bucketCounts();
+                    quint64 cumulative = 0;
+                    for (size_t i = 0; i < histogram.bounds().size(); ++i)
+                    {
+                        cumulative += counts[i];
+                        text += name + "_bucket" + labelText(entry.labels, "le", QString::number(histogram.bounds()[i])) +
+                                ' ' + QByteArray::number(cumulative) + '\n';
+                    }
+                    cumulative += counts.back();
+                    text += name + "_bucket" + labelText(entry.labels, "le", "+Inf") + ' ' + QByteArray::number(cumulative) + '\n';
+                    text += name + "_sum" + labelText(entry.labels) + ' ' + QByteArray::number(histogram.sum()) + '\n';
+                    text += name + "_count" + labelText(entry.labels) + ' ' + QByteArray::number(histogram.count()) + '\n';
+                    break;
+                }
+                }
+            }
+        }
+        return text;
+    }
+
+    QByteArray Registry::json() const
+    {
+        QMutexLocker locker(&m_mutex);
+        QJsonObject metrics;
+        for (const Entry &entry : m_entries)
+        {
+            QJsonObject sample;
+            sample.insert("labels", labelObject(entry.labels));
+            switch (entry.type)
+            {
+            case Type::Counter:
+                sample.insert("value", double(entry.counter->value()));
+                break;
+            case Type::Gauge:
+                sample.insert("value", double(entry.gauge->value()));
+                break;
+            case Type::Histogram:
+            {
+                const Histogram &histogram = *entry.histogram;
+                const std::vector<quint64> counts = histogram.bucketCounts();
+                QJsonArray buckets;
+                for (size_t i = 0; i < counts.size(); ++i)
+                {
+                    QJsonObject bucket;
+                    bucket.insert("le", i < histogram.bounds().size() ? QJsonValue(histogram.bounds()[i]) : QJsonValue("+Inf"));
+                    bucket.insert("count", double(counts[i]));
+                    buckets.append(bucket);
+                }
+                sample.insert("buckets", buckets);
+                sample.insert("count", double(histogram.count()));
+                sample.insert("sum", histogram.sum());
+                break;
+            }
+            }
+
+            QJsonArray samples = metrics.value(entry.name).toArray();
+            samples.append(sample);
+            metrics.insert(entry.name, samples);
+        }
+        return QJsonDocument(metrics).toJson(QJsonDocument::Compact);
+    }
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <QByteArray>
+#include <QList>
+#include <QMutex>
+#include <QPair>
+#include <QString>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
+
+// Process-wide counters, gauges and histograms, exported over the local
+// socket ("metrics" for Prometheus text, "metrics json" for JSON).
+//
+// Looking a metric up takes a lock, so callers look it up once and keep the
+// reference. Updating one is a relaxed atomic operation from any thread.
+namespace Metrics
+{
+    using Labels = QList<QPair<QString, QString>>;
+
+    class Counter
+    {
+    public:
+        void inc(quint64 amount = 1) { m_value.fetch_add(amount, std::memory_order_relaxed); }
+        quint64 value() const { return m_value.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<quint64> m_value{0};
+    };
+
+    class Gauge
+    {
+    public:
+        void set(qint64 value) { m_value.store(value, std::memory_order_relaxed); }
+        void add(qint64 amount) { m_value.fetch_add(amount, std::memory_order_relaxed); }
+        qint64 value() const { return m_value.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<qint64> m_value{0};
+    };
+
+    // Values are in milliseconds, bounds are the upper bucket limits
+    class Histogram
+    {
+    public:
+        explicit Histogram(std::vector<double> bounds);
+
+        void observe(double value);
+
+        const std::vector<double> &bounds() const { return m_bounds; }
+        // Not cumulative, the last entry counts values above every bound
+        std::vector<quint64> bucketCounts() const;
+        quint64 count() const { return m_count.load(std::memory_order_relaxed); }
+        double sum() const { return m_sumMicros.load(std::memory_order_relaxed) / 1000.0; }
+
+    private:
+        std::vector<double> m_bounds;
+        std::unique_ptr<std::atomic<quint64>[]> m_buckets;
+        std::atomic<quint64> m_count{0};
+        std::atomic<quint64> m_sumMicros{0};
+    };
+
+    // Bounds for latencies of a few milliseconds up to a few seconds
+    const std::vector<double> &latencyBounds();
+
+    class Registry
+    {
+    public:
+        static Registry &instance();
+
+        Counter &counter(const QString &name, const QString &help, const Labels &labels = {});
+        Gauge &gauge(const QString &name, const QString &help, const Labels &labels = {});
+        Histogram &histogram(const QString &name, const QString &help, const Labels &labels = {},
+                             const std::vector<double> &bounds = latencyBounds());
+
+        QByteArray prometheusText() const;
+        QByteArray json() const;
+
+    private:
+        enum class Type
+        {
+            Counter,
+            Gauge,
+            Histogram,
+        };
+
+        struct Entry
+        {
+            Type type;
+            QString name;
+            QString help;
+            Labels labels;
+            std::unique_ptr<Counter> counter;
+            std::unique_ptr<Gauge> gauge;
+            std::unique_ptr<Histogram> histogram;
+        };
+
+        Entry &find(Type type, const QString &name, const QString &help, const Labels &labels);
+
+        mutable QMutex m_mutex;
+        std::deque<Entry> m_entries; // Registration order, entries are never removed
+    };
+
+    inline Counter &counter(const QString &name, const QString &help, const Labels &labels = {})
+    {
+        return Registry::instance().counter(name, help, labels);
+    }
+
+    inline Gauge &gauge(const QString &name, const QString &help, const Labels &labels = {})
+    {
+        return Registry::instance().gauge(name, help, labels);
+    }
+
+    inline Histogram &histogram(const QString &name, const QString &help, const Labels &labels = {})
+    {
+        return Registry::instance().histogram(name, help, labels);
+    }
+}
@@ -0,0 +1,116 @@
+#include "settingsstore.h"
+#include "logger.h"
+#include "metrics.h"
+
+#include <QElapsedTimer>
+#include <QSettings>
+#include <QThread>
+
+SettingsStore::SettingsStore(const QString &organization, const QString &application, QObject *parent)
+    : QObject(parent), m_ioThread(new QThread(this)), m_writer(new QObject),
+      m_changes(Metrics::counter("librepods_settings_changes_total", "Settings values that changed")),
+      m_unchanged(Metrics::counter("librepods_settings_unchanged_total", "Settings writes skipped because the value was already stored")),
+      m_fileWrites(Metrics::counter("librepods_settings_file_writes_total", "Times the settings file was written")),
+      m_writeLatency(Metrics::histogram("librepods_settings_write_latency_ms", "Time to write the settings file"))
+{
+    QSettings settings(organization, application);
+    m_fileName = settings.fileName();
+    const QStringList keys = settings.allKeys();
+    for (const QString &key : keys)
+    {
+        m_values.insert(key, settings.value(key));
+    }
+
+    m_writeTimer.setSingleShot(true);
+    m_writeTimer.setInterval(WriteDelayMs);
+    connect(&m_writeTimer, &QTimer::timeout, this, &SettingsStore::writeSnapshot);
+
+    m_ioThread->setObjectName("settings-io");
+    m_writer->moveToThread(m_ioThread);
+    connect(m_ioThread, &QThread::finished, m_writer, &QObject::deleteLater);
+    m_ioThread->start(QThread::LowPriority);
+}
+
+SettingsStore::~SettingsStore()
+{
+    flush();
+    m_ioThread->quit();
+    m_ioThread->wait();
+}
+
+QVariant SettingsStore::value(const QString &key, const QVariant &defaultValue) const
+{
+    return m_values.value(key, defaultValue);
+}
+
+void SettingsStore::setValue(const QString &key, const QVariant &value)
+{
+    auto it = m_values.find(key);
+    if (it != m_values.end() && *it == value)
+    {
+        m_unchanged.inc();
+        return;
+    }
+    m_values.insert(key, value);
+    m_changes.inc();
+    ++m_generation;
+    scheduleWrite();
+}
+
+void SettingsStore::flush()
+{
+    writeSnapshot();
+    if (m_ioThread->isRunning())
+    {
+        // Returns once every write queued before it has finished
+        QMetaObject::invokeMethod(m_writer, []() {}, Qt::BlockingQueuedConnection);
+    }
+}
+
+void SettingsStore::scheduleWrite()
+{
+    if (!m_writeTimer.isActive())
+    {
+        m_writeTimer.start();
+    }
+}
+
+void SettingsStore::writeSnapshot()
+{
+    m_writeTimer.stop();
+    if (m_generation == m_writtenGeneration.load(std::memory_order_acquire))
+    {
+        return;
+    }
+
+    // The writer gets its own copy, later changes go into the next snapshot
+    const QHash<QString, QVariant> values = m_values;
+    const quint64 generation = m_generation;
+    QMetaObject::invokeMethod(m_writer, [this, values, generation]()
+    {
+        if (generation <= m_writtenGeneration.load(std::memory_order_acquire))
+        {
+            return;
+        }
+
+        QElapsedTimer clock;
+        clock.start();
+        // QSettings replaces the file atomically on sync()
+        QSettings settings(m_fileName, QSettings::IniFormat);
+        settings.clear();
+        for (auto it = values.constBegin(); it != values.constEnd(); ++it)
+        {
+            settings.setValue(it.key(), it.value());
+        }
+        settings.sync();
+        if (settings.status() != QSettings::NoError)
+        {
+            LOG_ERROR("Failed to write settings to " << m_fileName);
+            return;
+        }
+
+        m_writtenGeneration.store(generation, std::memory_order_release);
+        m_fileWrites.inc();
+        m_writeLatency.observe(clock.nsecsElapsed() / 1e6);
+    });
+}
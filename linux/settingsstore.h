@@ -0,0 +1,53 @@
+#pragma once
+
+#include <QObject>
+#include <QHash>
+#include <QString>
+#include <QTimer>
+#include <QVariant>
+#include <atomic>
+
+class QThread;
+
+namespace Metrics
+{
+    class Counter;
+    class Histogram;
+}
+
+// In-memory view of the QSettings file. Reads never touch the disk. Changed
+// values are batched for WriteDelayMs and then written on a background thread
+// as one atomic replace of the whole file, so a burst of setValue() calls on
+// the GUI thread costs one write instead of one per call.
+class SettingsStore : public QObject
+{
+    Q_OBJECT
+public:
+    explicit SettingsStore(const QString &organization, const QString &application, QObject *parent = nullptr);
+    ~SettingsStore() override;
+
+    QVariant value(const QString &key, const QVariant &defaultValue = QVariant()) const;
+    void setValue(const QString &key, const QVariant &value);
+
+    // Writes pending changes now and waits for them to reach the disk
+    void flush();
+
+private:
+    void scheduleWrite();
+    void writeSnapshot();
+
+    static constexpr int WriteDelayMs = 500;
+
+    QString m_fileName;
+    QHash<QString, QVariant> m_values;
+    QTimer m_writeTimer;
+    QThread *m_ioThread;
+    QObject *m_writer;
+    quint64 m_generation = 0;
+    std::atomic<quint64> m_writtenGeneration{0};
+
+    Metrics::Counter &m_changes;
+    Metrics::Counter &m_unchanged;
+    Metrics::Counter &m_fileWrites;
+    Metrics::Histogram &m_writeLatency;
+};
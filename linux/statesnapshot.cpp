@@ -0,0 +1,229 @@
+#include "statesnapshot.h"
+#include "deviceinfo.hpp"
+#include "logger.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+
+namespace
+{
+    template <size_t N>
+    void copyString(char (&target)[N], const QString &value)
+    {
+        const QByteArray utf8 = value.toUtf8();
+        std::memset(target, 0, N);
+        std::memcpy(target, utf8.constData(), std::min<size_t>(utf8.size(), N - 1));
+    }
+
+    template <size_t N>
+    QString readString(const char (&source)[N])
+    {
+        return QString::fromUtf8(source, qstrnlen(source, N));
+    }
+}
+
+StateSnapshot::StateSnapshot(DeviceInfo *deviceInfo, QObject *parent)
+    : QObject(parent), m_deviceInfo(deviceInfo)
+{
+    static_assert(std::is_trivially_copyable_v<Record>);
+    std::memset(&m_record, 0, sizeof(m_record));
+    m_fileName = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/last-state.bin";
+
+    m_saveTimer.setSingleShot(true);
+    m_saveTimer.setInterval(SaveDelayMs);
+    connect(&m_saveTimer, &QTimer::timeout, this, &StateSnapshot::save);
+
+    connect(m_deviceInfo->getBattery(), &Battery::batteryStatusChanged, this, &StateSnapshot::recordBattery);
+    connect(m_deviceInfo->getEarDetection(), &EarDetection::statusChanged, this, &StateSnapshot::recordEarDetection);
+    connect(m_deviceInfo, &DeviceInfo::noiseControlModeChanged, this, &StateSnapshot::recordControls);
+    connect(m_deviceInfo, &DeviceInfo::conversationalAwarenessChanged, this, &StateSnapshot::recordControls);
+    connect(m_deviceInfo, &DeviceInfo::adaptiveNoiseLevelChanged, this, &StateSnapshot::recordControls);
+    connect(m_deviceInfo, &DeviceInfo::oneBudANCModeChanged, this, &StateSnapshot::recordControls);
+}
+
+StateSnapshot::~StateSnapshot()
+{
+    if (m_saveTimer.isActive())
+    {
+        save();
+    }
+}
+
+bool StateSnapshot::restore()
+{
+    QFile file(m_fileName);
+    if (!file.open(QIODevice::ReadOnly) || file.size() < qint64(sizeof(Record)))
+    {
+        return false;
+    }
+    // The page is already in the page cache after the previous run, mapping it avoids a read copy
+    const uchar *data = file.map(0, sizeof(Record));
+    if (!data)
+    {
+        return false;
+    }
+    Record record;
+    std::memcpy(&record, data, sizeof(record));
+    file.unmap(const_cast<uchar *>(data));
+
+    if (record.magic != Record::Magic || record.version != Record::Version || record.size != sizeof(Record))
+    {
+        LOG_WARN("Ignoring incompatible state snapshot in " << m_fileName);
+        return false;
+    }
+    m_record = record;
+
+    const QString address = readString(record.address);
+    if (address.isEmpty())
+    {
+        return false;
+    }
+
+    // Stale first, so the restored values are not recorded again as live ones
+    m_deviceInfo->setStale(true);
+    if (m_deviceInfo->bluetoothAddress().isEmpty())
+    {
+        m_deviceInfo->setBluetoothAddress(address);
+    }
+    if (record.batteryUpdatedAt)
+    {
+        Battery::Snapshot battery;
+        for (int i = 0; i < Battery::ComponentCount; ++i)
+        {
+            battery.states[i].level = record.batteryLevel[i];
+            battery.states[i].status = static_cast<Battery::BatteryStatus>(record.batteryStatus[i]);
+        }
+        battery.primary = static_cast<Battery::Component>(record.primaryPod);
+        battery.secondary = static_cast<Battery::Component>(record.secondaryPod);
+        m_deviceInfo->getBattery()->applySnapshot(battery);
+    }
+    if (record.earUpdatedAt)
+    {
+        m_deviceInfo->getEarDetection()->setStatus(static_cast<EarDetection::EarDetectionStatus>(record.primaryEar),
+                                                   static_cast<EarDetection::EarDetectionStatus>(record.secondaryEar));
+    }
+    if (record.controlsUpdatedAt)
+    {
+        m_deviceInfo->setNoiseControlMode(static_cast<NoiseControlMode>(record.noiseControlMode));
+        m_deviceInfo->setConversationalAwareness(record.conversationalAwareness);
+        m_deviceInfo->setAdaptiveNoiseLevel(record.adaptiveNoiseLevel);
+        m_deviceInfo->setOneBudANCMode(record.oneBudANCMode);
+    }
+
+    const qint64 age = QDateTime::currentMSecsSinceEpoch() - record.savedAt;
+    LOG_INFO("Restored last known state of " << address << " from " << age / 1000 << " s ago");
+    return true;
+}
+
+void StateSnapshot::save()
+{
+    m_saveTimer.stop();
+    if (!m_record.address[0])
+    {
+        return; // Nothing recorded yet
+    }
+
+    m_record.magic = Record::Magic;
+    m_record.version = Record::Version;
+    m_record.size = sizeof(Record);
+    m_record.savedAt = QDateTime::currentMSecsSinceEpoch();
+
+    QDir().mkpath(QFileInfo(m_fileName).path());
+    QSaveFile file(m_fileName);
+    if (!file.open(QIODevice::WriteOnly)
+        || file.write(reinterpret_cast<const char *>(&m_record), sizeof(m_record)) != qint64(sizeof(m_record))
+        || !file.commit())
+    {
+        LOG_WARN("Cannot write state snapshot to " << m_fileName << ": " << file.errorString());
+    }
+}
+
+QString StateSnapshot::audioCard() const
+{
+    return readString(m_record.audioCard);
+}
+
+void StateSnapshot::setAudioCard(const QString &card)
+{
+    if (card.isEmpty() || card == audioCard() || !prepareRecord())
+    {
+        return;
+    }
+    copyString(m_record.audioCard, card);
+    scheduleSave();
+}
+
+bool StateSnapshot::prepareRecord()
+{
+    const QString address = m_deviceInfo->bluetoothAddress();
+    if (m_deviceInfo->isStale() || address.isEmpty())
+    {
+        return false;
+    }
+    if (address != readString(m_record.address))
+    {
+        // Another device, nothing of the previous one carries over
+        std::memset(&m_record, 0, sizeof(m_record));
+        copyString(m_record.address, address);
+    }
+    return true;
+}
+
+void StateSnapshot::recordBattery()
+{
+    if (!prepareRecord())
+    {
+        return;
+    }
+    const Battery::Snapshot battery = m_deviceInfo->getBattery()->snapshot();
+    for (int i = 0; i < Battery::ComponentCount; ++i)
+    {
+        m_record.batteryLevel[i] = battery.states[i].level;
+        m_record.batteryStatus[i] = static_cast<quint8>(battery.states[i].status);
+    }
+    m_record.primaryPod = static_cast<quint8>(battery.primary);
+    m_record.secondaryPod = static_cast<quint8>(battery.secondary);
+    m_record.batteryUpdatedAt = QDateTime::currentMSecsSinceEpoch();
+    scheduleSave();
+}
+
+void StateSnapshot::recordEarDetection()
+{
+    if (!prepareRecord())
+    {
+        return;
+    }
+    m_record.primaryEar = static_cast<quint8>(m_deviceInfo->getEarDetection()->getprimaryStatus());
+    m_record.secondaryEar = static_cast<quint8>(m_deviceInfo->getEarDetection()->getsecondaryStatus());
+    m_record.earUpdatedAt = QDateTime::currentMSecsSinceEpoch();
+    scheduleSave();
+}
+
+void StateSnapshot::recordControls()
+{
+    if (!prepareRecord())
+    {
+        return;
+    }
+    m_record.noiseControlMode = static_cast<quint8>(m_deviceInfo->noiseControlMode());
+    m_record.conversationalAwareness = m_deviceInfo->conversationalAwareness();
+    m_record.adaptiveNoiseLevel = static_cast<quint8>(m_deviceInfo->adaptiveNoiseLevel());
+    m_record.oneBudANCMode = m_deviceInfo->oneBudANCMode();
+    m_record.controlsUpdatedAt = QDateTime::currentMSecsSinceEpoch();
+    scheduleSave();
+}
+
+void StateSnapshot::scheduleSave()
+{
+    if (!m_saveTimer.isActive())
+    {
+        m_saveTimer.start();
+    }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <QObject>
+#include <QString>
+#include <QTimer>
+
+class DeviceInfo;
+
+// Last known device state, kept in a small binary file in the cache
+// directory. restore() maps the file and applies it to DeviceInfo at startup,
+// so the tray and window show the previous battery, ear and noise control
+// state (marked stale) before the AirPods answer. While the device is live,
+// every change is recorded with its time and the file is rewritten at most
+// once per SaveDelayMs.
+class StateSnapshot : public QObject
+{
+    Q_OBJECT
+public:
+    explicit StateSnapshot(DeviceInfo *deviceInfo, QObject *parent = nullptr);
+    ~StateSnapshot() override;
+
+    // False if there is no usable snapshot
+    bool restore();
+    // Writes pending changes now
+    void save();
+
+    QString audioCard() const;
+    void setAudioCard(const QString &card);
+
+private:
+    // Fixed layout, written and mapped as is. Bump Version when it changes.
+    struct Record
+    {
+        static constexpr quint32 Magic = 0x5350524c; // "LRPS"
+        static constexpr quint16 Version = 1;
+
+        quint32 magic;
+        quint16 version;
+        quint16 size;
+        // Milliseconds since the epoch, 0 if the section was never recorded
+        qint64 savedAt;
+        qint64 batteryUpdatedAt;
+        qint64 earUpdatedAt;
+        qint64 controlsUpdatedAt;
+        quint8 batteryLevel[3];
+        quint8 batteryStatus[3];
+        quint8 primaryPod;
+        quint8 secondaryPod;
+        quint8 primaryEar;
+        quint8 secondaryEar;
+        quint8 noiseControlMode;
+        quint8 conversationalAwareness;
+        quint8 adaptiveNoiseLevel;
+        quint8 oneBudANCMode;
+        char address[18];
+        char audioCard[96];
+    };
+
+    // False while nothing live is known, switches the record to the current device
+    bool prepareRecord();
+    void recordBattery();
+    void recordEarDetection();
+    void recordControls();
+    void scheduleSave();
+
+    static constexpr int SaveDelayMs = 1000;
+
+    DeviceInfo *m_deviceInfo;
+    QString m_fileName;
+    Record m_record;
+    QTimer m_saveTimer;
+};
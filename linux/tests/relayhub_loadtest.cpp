@@ -0,0 +1,202 @@
+// relayhub_loadtest: starts a RelayHub with local peers, one of which never
+// reads, and relays packets to all of them. Passes when every other peer
+// gets every packet in order and only the stalled peer has dropped packets.
+//
+//   relayhub_loadtest [readers] [packets]
+
+#include "aacp/relayhub.h"
+#include "airpods_packets.h"
+#include "logger.h"
+#include "metrics.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QLocalSocket>
+#include <QTextStream>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+Q_LOGGING_CATEGORY(librepods, "librepods")
+
+namespace
+{
+    constexpr int PayloadSize = 1024;
+    // RelayWriter's batch size, so every burst is written out right away
+    constexpr int BurstSize = 16;
+    constexpr int TimeoutMs = 5000;
+
+    struct Reader
+    {
+        std::unique_ptr<QLocalSocket> socket;
+        QByteArray buffer;
+        int received = 0;
+        bool inOrder = true;
+    };
+
+    bool waitFor(const std::function<bool()> &done)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        while (!done())
+        {
+            if (timer.elapsed() > TimeoutMs)
+            {
+                return false;
+            }
+            QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+        }
+        return true;
+    }
+
+    // Sequence number in the first four bytes, the rest is filler
+    QByteArray makePacket(int sequence)
+    {
+        QByteArray packet(PayloadSize, char(sequence));
+        for (int i = 0; i < 4; ++i)
+        {
+            packet[i] = char((sequence >> (24 - 8 * i)) & 0xff);
+        }
+        return packet;
+    }
+
+    void readFrames(Reader &reader)
+    {
+        reader.buffer += reader.socket->readAll();
+        const int header = AirPodsPackets::Phone::NOTIFICATION.size();
+        int offset = 0;
+        while (reader.buffer.size() - offset >= 2)
+        {
+            const int size = (quint8(reader.buffer[offset]) << 8) | quint8(reader.buffer[offset + 1]);
+            if (reader.buffer.size() - offset - 2 < size)
+            {
+                break;
+            }
+            const QByteArray packet = reader.buffer.mid(offset + 2 + header, size - header);
+            reader.inOrder = reader.inOrder && packet == makePacket(reader.received);
+            ++reader.received;
+            offset += 2 + size;
+        }
+        reader.buffer.remove(0, offset);
+    }
+
+    // Connects without a QLocalSocket, which would keep reading into its own buffer
+    int connectStalled(const QString &path)
+    {
+        const int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        const QByteArray encoded = QFile::encodeName(path);
+        qstrncpy(address.sun_path, encoded.constData(), sizeof(address.sun_path));
+        if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+        {
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
+            return -1;
+        }
+        return fd;
+    }
+
+    quint64 dropped(int peerId)
+    {
+        return Metrics::counter("librepods_relay_dropped_total",
+                                "AirPods packets not sent to a peer because its backlog was full",
+                                {{"peer", QStringLiteral("local-%1").arg(peerId)}}).value();
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QTextStream out(stdout);
+    const int readerCount = argc > 1 ? QByteArray(argv[1]).toInt() : 4;
+    const int packetCount = argc > 2 ? QByteArray(argv[2]).toInt() : 4096;
+    if (readerCount <= 0 || packetCount < BurstSize)
+    {
+        QTextStream(stderr) << "Usage: relayhub_loadtest [readers] [packets]" << Qt::endl;
+        return 1;
+    }
+
+    // The pause and resume lines would flood the output
+    QLoggingCategory::setFilterRules(QStringLiteral("librepods.info=false\nlibrepods.warning=false"));
+
+    RelayHub hub;
+    const QString path = QDir::temp().filePath(QStringLiteral("librepods_relay_loadtest_%1").arg(QCoreApplication::applicationPid()));
+    if (!hub.listenLocal(path))
+    {
+        return 1;
+    }
+
+    // One at a time, so peer ids follow the order below
+    std::vector<Reader> readers(readerCount);
+    for (int i = 0; i < readerCount; ++i)
+    {
+        Reader &reader = readers[i];
+        reader.socket = std::make_unique<QLocalSocket>();
+        QObject::connect(reader.socket.get(), &QLocalSocket::readyRead, [&reader]() { readFrames(reader); });
+        reader.socket->connectToServer(path);
+        if (!waitFor([&hub, i]() { return hub.connectedCount() == i + 1; }))
+        {
+            out << "FAIL: reader " << i << " did not connect" << Qt::endl;
+            return 1;
+        }
+    }
+    const int stalled = connectStalled(path);
+    if (stalled < 0 || !waitFor([&hub, readerCount]() { return hub.connectedCount() == readerCount + 1; }))
+    {
+        out << "FAIL: the stalled peer did not connect" << Qt::endl;
+        return 1;
+    }
+    const int stalledId = readerCount + 1;
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int sent = 0; sent < packetCount;)
+    {
+        for (int i = 0; i < BurstSize && sent < packetCount; ++i)
+        {
+            hub.relay(makePacket(sent++));
+        }
+        // Readers drain each burst, the stalled peer only fills up
+        const bool drained = waitFor([&readers, sent]()
+        {
+            for (const Reader &reader : readers)
+            {
+                if (reader.received < sent)
+                {
+                    return false;
+                }
+            }
+            return true;
+        });
+        if (!drained)
+        {
+            out << "FAIL: readers stopped receiving after " << sent << " packets" << Qt::endl;
+            return 1;
+        }
+    }
+    const qint64 elapsed = timer.elapsed();
+
+    bool passed = true;
+    for (int i = 0; i < readerCount; ++i)
+    {
+        const Reader &reader = readers[i];
+        out << "reader " << i << ": " << reader.received << " packets, " << dropped(i + 1) << " dropped"
+            << (reader.inOrder ? "" : ", out of order") << Qt::endl;
+        passed = passed && reader.received == packetCount && reader.inOrder && dropped(i + 1) == 0;
+    }
+    out << "stalled: " << dropped(stalledId) << " dropped" << Qt::endl;
+    passed = passed && dropped(stalledId) > 0;
+    out << packetCount << " packets to " << readerCount + 1 << " peers in " << elapsed << " ms" << Qt::endl;
+
+    ::close(stalled);
+    out << (passed ? "PASS" : "FAIL") << Qt::endl;
+    return passed ? 0 : 1;
+}
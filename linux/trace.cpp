@@ -0,0 +1,177 @@
+#include "trace.h"
+#include "logger.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+#include <QTimer>
+#include <memory>
+#include <vector>
+
+namespace Trace
+{
+    namespace Detail
+    {
+        std::atomic<bool> enabled{false};
+    }
+
+    namespace
+    {
+        constexpr int FlushIntervalMs = 200;
+
+        // Rings outlive their threads so events written just before a thread
+        // exits are still flushed. There are only a handful of threads.
+        QMutex registryMutex;
+        std::vector<std::unique_ptr<Detail::Ring>> rings;
+
+        QThread *flusherThread = nullptr;
+        QFile *traceFile = nullptr;
+
+        QByteArray formatEvent(const Detail::Ring &ring, const Event &event)
+        {
+            QByteArray line;
+            line.reserve(128);
+            line += QByteArray::number(double(event.timestampNs) / 1e9, 'f', 6);
+            line += " [";
+            line += ring.threadName;
+            line += "] ";
+
+            int arg = 0;
+            for (const char *c = event.format; *c; ++c)
+            {
+                if (c[0] == '{' && c[1] == '}' && arg < event.argCount)
+                {
+                    const quint64 value = event.values[arg];
+                    switch (event.kinds[arg])
+                    {
+                    case ArgKind::Signed:
+                        line += QByteArray::number(qint64(value));
+                        break;
+                    case ArgKind::Unsigned:
+                        line += QByteArray::number(value);
+                        break;
+                    case ArgKind::Bool:
+                        line += value ? "true" : "false";
+                        break;
+                    case ArgKind::Bytes:
+                        line += QByteArray::fromRawData(reinterpret_cast<const char *>(event.bytes.data()), event.bytesLength).toHex();
+                        if (value > event.bytesLength)
+                        {
+                            line += "... (" + QByteArray::number(value) + " bytes)";
+                        }
+                        break;
+                    }
+                    ++arg;
+                    ++c;
+                    continue;
+                }
+                line += *c;
+            }
+            return line;
+        }
+
+        void flush()
+        {
+            QMutexLocker locker(&registryMutex);
+            for (const auto &ring : rings)
+            {
+                const quint32 tail = ring->tail.load(std::memory_order_relaxed);
+                const quint32 head = ring->head.load(std::memory_order_acquire);
+                for (quint32 i = tail; i != head; ++i)
+                {
+                    QByteArray line = formatEvent(*ring, ring->events[i & (RingCapacity - 1)]);
+                    if (traceFile)
+                    {
+                        traceFile->write(line + '\n');
+                    }
+                    else
+                    {
+                        LOG_DEBUG(line.constData());
+                    }
+                }
+                ring->tail.store(head, std::memory_order_release);
+
+                if (quint64 dropped = ring->dropped.exchange(0, std::memory_order_relaxed))
+                {
+                    LOG_WARN("Trace ring of " << ring->threadName << " was full, dropped " << dropped << " events");
+                }
+            }
+            if (traceFile)
+            {
+                traceFile->flush();
+            }
+        }
+    }
+
+    Detail::Ring &Detail::localRing()
+    {
+        thread_local Ring *ring = nullptr;
+        if (!ring)
+        {
+            auto owned = std::make_unique<Ring>();
+            QThread *thread = QThread::currentThread();
+            QString name = thread->objectName();
+            if (name.isEmpty() && QCoreApplication::instance() && thread == QCoreApplication::instance()->thread())
+            {
+                name = "main";
+            }
+            owned->threadName = name.isEmpty() ? QByteArray::number(quintptr(QThread::currentThreadId()), 16) : name.toUtf8();
+            ring = owned.get();
+            QMutexLocker locker(&registryMutex);
+            rings.push_back(std::move(owned));
+        }
+        return *ring;
+    }
+
+    void start(const QString &filePath)
+    {
+        if (flusherThread)
+        {
+            return;
+        }
+
+        if (!filePath.isEmpty())
+        {
+            traceFile = new QFile(filePath);
+            if (!traceFile->open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text))
+            {
+                LOG_ERROR("Cannot open trace file " << filePath << ": " << traceFile->errorString());
+                delete traceFile;
+                traceFile = nullptr;
+            }
+        }
+
+        flusherThread = new QThread();
+        flusherThread->setObjectName("trace-flush");
+        auto *timer = new QTimer();
+        timer->setInterval(FlushIntervalMs);
+        timer->moveToThread(flusherThread);
+        QObject::connect(timer, &QTimer::timeout, timer, &flush);
+        QObject::connect(flusherThread, &QThread::started, timer, qOverload<>(&QTimer::start));
+        QObject::connect(flusherThread, &QThread::finished, timer, &QObject::deleteLater);
+        flusherThread->start();
+
+        Detail::enabled.store(true, std::memory_order_relaxed);
+        LOG_INFO("Tracing enabled" << (traceFile ? ", writing to " + filePath : QString()));
+    }
+
+    void stop()
+    {
+        if (!flusherThread)
+        {
+            return;
+        }
+
+        Detail::enabled.store(false, std::memory_order_relaxed);
+        flusherThread->quit();
+        flusherThread->wait();
+        delete flusherThread;
+        flusherThread = nullptr;
+
+        flush();
+        delete traceFile;
+        traceFile = nullptr;
+    }
+}
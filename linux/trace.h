@@ -0,0 +1,152 @@
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <type_traits>
+
+// Binary event tracing for hot paths. TRACE() copies its arguments into a
+// fixed-size event in a per-thread ring without locking or allocating, the
+// text is only produced later by a background flusher. When tracing is off a
+// TRACE() is a single relaxed atomic load.
+//
+//     TRACE("rx {} bytes: {}", data.size(), data);
+//
+// The format must be a string literal with one {} per argument. Integers,
+// enums and bools are stored as is, a QByteArray is copied (up to
+// Trace::MaxBytes) and printed as hex. At most one QByteArray per event.
+namespace Trace
+{
+    constexpr int MaxArgs = 4;
+    constexpr int MaxBytes = 64;
+    constexpr int RingCapacity = 1024; // Events per thread, must be a power of two
+
+    enum class ArgKind : quint8
+    {
+        Signed,
+        Unsigned,
+        Bool,
+        Bytes, // Value holds the original length, the data is in Event::bytes
+    };
+
+    struct Event
+    {
+        const char *format;
+        qint64 timestampNs;
+        quint8 argCount;
+        quint8 bytesLength;
+        std::array<ArgKind, MaxArgs> kinds;
+        std::array<quint64, MaxArgs> values;
+        std::array<uchar, MaxBytes> bytes;
+    };
+
+    constexpr int placeholderCount(const char *format)
+    {
+        int count = 0;
+        for (; *format; ++format)
+        {
+            if (format[0] == '{' && format[1] == '}')
+            {
+                ++count;
+            }
+        }
+        return count;
+    }
+
+    namespace Detail
+    {
+        extern std::atomic<bool> enabled;
+
+        // Single producer (the owning thread), single consumer (the flusher)
+        struct Ring
+        {
+            std::array<Event, RingCapacity> events;
+            std::atomic<quint32> head{0};
+            std::atomic<quint32> tail{0};
+            std::atomic<quint64> dropped{0};
+            QByteArray threadName;
+        };
+
+        Ring &localRing();
+
+        inline void store(Event &event, int index, const QByteArray &bytes)
+        {
+            event.kinds[index] = ArgKind::Bytes;
+            event.values[index] = quint64(bytes.size());
+            event.bytesLength = quint8(qMin<qsizetype>(bytes.size(), MaxBytes));
+            std::memcpy(event.bytes.data(), bytes.constData(), event.bytesLength);
+        }
+
+        template <typename T>
+        inline void store(Event &event, int index, const T &value)
+        {
+            static_assert(std::is_integral_v<T> || std::is_enum_v<T>, "TRACE() only takes integers, enums, bools and QByteArray");
+            if constexpr (std::is_same_v<T, bool>)
+            {
+                event.kinds[index] = ArgKind::Bool;
+                event.values[index] = value ? 1 : 0;
+            }
+            else if constexpr (std::is_enum_v<T>)
+            {
+                event.kinds[index] = ArgKind::Signed;
+                event.values[index] = quint64(qint64(static_cast<std::underlying_type_t<T>>(value)));
+            }
+            else if constexpr (std::is_signed_v<T>)
+            {
+                event.kinds[index] = ArgKind::Signed;
+                event.values[index] = quint64(qint64(value));
+            }
+            else
+            {
+                event.kinds[index] = ArgKind::Unsigned;
+                event.values[index] = quint64(value);
+            }
+        }
+    }
+
+    inline bool isEnabled() { return Detail::enabled.load(std::memory_order_relaxed); }
+
+    template <int Placeholders, typename... Args>
+    void record(const char *format, const Args &...args)
+    {
+        static_assert(Placeholders == sizeof...(Args), "TRACE() needs one argument per {} in the format");
+        static_assert(sizeof...(Args) <= MaxArgs, "TRACE() takes at most Trace::MaxArgs arguments");
+
+        Detail::Ring &ring = Detail::localRing();
+        const quint32 head = ring.head.load(std::memory_order_relaxed);
+        if (head - ring.tail.load(std::memory_order_acquire) >= quint32(RingCapacity))
+        {
+            ring.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        Event &event = ring.events[head & (RingCapacity - 1)];
+        event.format = format;
+        event.timestampNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                std::chrono::steady_clock::now().time_since_epoch()).count();
+        event.argCount = quint8(sizeof...(Args));
+        event.bytesLength = 0;
+        int index = 0;
+        (Detail::store(event, index++, args), ...);
+        Q_UNUSED(index);
+        ring.head.store(head + 1, std::memory_order_release);
+    }
+
+    // Starts the background flusher. Events go to the librepods debug output,
+    // or are appended to filePath when it is set.
+    void start(const QString &filePath = QString());
+    // Writes out what is still buffered and stops the flusher
+    void stop();
+}
+
+#define TRACE(format, ...)                                                                 \
+    do                                                                                     \
+    {                                                                                      \
+        if (Trace::isEnabled())                                                            \
+        {                                                                                  \
+            Trace::record<Trace::placeholderCount(format)>(format, ##__VA_ARGS__);         \
+        }                                                                                  \
+    } while (false)
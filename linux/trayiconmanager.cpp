@@ -8,10 +8,12 @@
 #include <QFont>
 #include <QColor>
 #include <QActionGroup>
+#include <QEvent>
+#include <QPolygonF>
 
 using namespace AirpodsTrayApp::Enums;
 
-TrayIconManager::TrayIconManager(QObject *parent) : QObject(parent)
+TrayIconManager::TrayIconManager(QObject *parent) : QObject(parent), m_iconFont("Arial", 12, QFont::Bold)
 {
     // Initialize tray icon
     trayIcon = new QSystemTrayIcon(QIcon(":/icons/assets/airpods.png"), this);
@@ -25,6 +27,10 @@ TrayIconManager::TrayIconManager(QObject *parent) : QObject(parent)
     connect(trayIcon, &QSystemTrayIcon::activated, this, &TrayIconManager::onTrayIconActivated);
 
     trayIcon->show();
+
+    // Icons are drawn in the palette's text color, pick the matching atlas
+    selectAtlas();
+    qApp->installEventFilter(this);
 }
 
 void TrayIconManager::showNotification(const QString &title, const QString &message)
@@ -34,10 +40,29 @@ void TrayIconManager::showNotification(const QString &title, const QString &mess
     trayIcon->showMessage(title, message, QSystemTrayIcon::Information, 3000);
 }
 
-void TrayIconManager::TrayIconManager::updateBatteryStatus(const QString &status)
+void TrayIconManager::updateBatteryStatus(const QString &status)
 {
     trayIcon->setToolTip("Battery Status: " + status);
-    updateIconFromBattery(status);
+}
+
+void TrayIconManager::updateBattery(const Battery::Snapshot &snapshot)
+{
+    const Battery::BatteryState left = snapshot.state(Battery::Component::Left);
+    const Battery::BatteryState right = snapshot.state(Battery::Component::Right);
+    const bool leftAvailable = left.status != Battery::BatteryStatus::Disconnected;
+    const bool rightAvailable = right.status != Battery::BatteryStatus::Disconnected;
+
+    if (!leftAvailable && !rightAvailable)
+    {
+        return; // Nothing to show yet, resetTrayIcon() covers disconnects
+    }
+
+    // Show the emptier pod, it is the one that runs out first
+    Battery::BatteryState shown = !leftAvailable ? right : !rightAvailable ? left
+                                                         : (left.level <= right.level ? left : right);
+    int level = qBound(0, int(shown.level), 100);
+    bool charging = shown.status == Battery::BatteryStatus::Charging;
+    setBatteryIcon(level * 2 + (charging ? 1 : 0));
 }
 
 void TrayIconManager::updateNoiseControlState(NoiseControlMode mode)
@@ -105,34 +130,64 @@ void TrayIconManager::setupMenuActions()
     connect(quitAction, &QAction::triggered, qApp, &QApplication::quit);
 }
 
-void TrayIconManager::updateIconFromBattery(const QString &status)
+bool TrayIconManager::eventFilter(QObject *watched, QEvent *event)
 {
-    int leftLevel = 0;
-    int rightLevel = 0;
-
-    if (!status.isEmpty())
+    if (watched == qApp && event->type() == QEvent::ApplicationPaletteChange)
     {
-        // Parse the battery status string
-        QStringList parts = status.split(", ");
-        if (parts.size() >= 2)
+        selectAtlas();
+        if (m_currentIcon >= 0)
         {
-            leftLevel = parts[0].split(": ")[1].replace("%", "").toInt();
-            rightLevel = parts[1].split(": ")[1].replace("%", "").toInt();
+            int index = m_currentIcon;
+            m_currentIcon = -1;
+            setBatteryIcon(index);
         }
     }
-    
-    int minLevel = (leftLevel == 0) ? rightLevel : (rightLevel == 0) ? leftLevel
-                                                                     : qMin(leftLevel, rightLevel);
+    return QObject::eventFilter(watched, event);
+}
+
+void TrayIconManager::selectAtlas()
+{
+    m_atlas = &m_atlases[QApplication::palette().color(QPalette::WindowText).rgba()];
+}
 
+const QIcon &TrayIconManager::batteryIcon(int level, bool charging)
+{
+    QIcon &icon = (*m_atlas)[level * 2 + (charging ? 1 : 0)];
+    if (!icon.isNull())
+    {
+        return icon;
+    }
+
+    const QColor color = QApplication::palette().color(QPalette::WindowText);
     QPixmap pixmap(32, 32);
     pixmap.fill(Qt::transparent);
     QPainter painter(&pixmap);
-    painter.setPen(QApplication::palette().color(QPalette::WindowText));
-    painter.setFont(QFont("Arial", 12, QFont::Bold));
-    painter.drawText(pixmap.rect(), Qt::AlignCenter, QString::number(minLevel) + "%");
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.setPen(color);
+    painter.setFont(m_iconFont);
+    painter.drawText(pixmap.rect(), Qt::AlignCenter, QString::number(level) + "%");
+    if (charging)
+    {
+        // Small bolt in the top right corner
+        static const QPolygonF bolt({{27, 0}, {23, 5}, {26, 5}, {24, 10}, {30, 3}, {27, 3}});
+        painter.setPen(Qt::NoPen);
+        painter.setBrush(color);
+        painter.drawPolygon(bolt);
+    }
     painter.end();
 
-    trayIcon->setIcon(QIcon(pixmap));
+    icon = QIcon(pixmap);
+    return icon;
+}
+
+void TrayIconManager::setBatteryIcon(int index)
+{
+    if (index == m_currentIcon)
+    {
+        return;
+    }
+    m_currentIcon = index;
+    trayIcon->setIcon(batteryIcon(index / 2, index % 2));
 }
 
 void TrayIconManager::onTrayIconActivated(QSystemTrayIcon::ActivationReason reason)
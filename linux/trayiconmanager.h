@@ -1,6 +1,11 @@
 #include <QObject>
 #include <QSystemTrayIcon>
+#include <QFont>
+#include <QHash>
+#include <QIcon>
+#include <array>
 
+#include "battery.hpp"
 #include "enums.h"
 
 class QMenu;
@@ -15,7 +20,9 @@ class TrayIconManager : public QObject
 public:
     explicit TrayIconManager(QObject *parent = nullptr);
 
+    // Tooltip text, the icon follows updateBattery()
     void updateBatteryStatus(const QString &status);
+    void updateBattery(const Battery::Snapshot &snapshot);
 
     void updateNoiseControlState(AirpodsTrayApp::Enums::NoiseControlMode);
 
@@ -37,6 +44,7 @@ public:
     {
         trayIcon->setIcon(QIcon(":/icons/assets/airpods.png"));
         trayIcon->setToolTip("");
+        m_currentIcon = -1;
     }
 
 signals:
@@ -52,9 +60,21 @@ private:
     QActionGroup *noiseControlGroup;
     bool m_notificationsEnabled = true;
 
+    // One slot per level (0-100), charging or not. Atlases are kept per text
+    // color so switching themes back and forth never repaints.
+    static constexpr int IconsPerAtlas = 101 * 2;
+    using IconAtlas = std::array<QIcon, IconsPerAtlas>;
+    QHash<QRgb, IconAtlas> m_atlases;
+    IconAtlas *m_atlas = nullptr;
+    QFont m_iconFont;
+    int m_currentIcon = -1;
+
     void setupMenuActions();
 
-    void updateIconFromBattery(const QString &status);
+    bool eventFilter(QObject *watched, QEvent *event) override;
+    void selectAtlas();
+    const QIcon &batteryIcon(int level, bool charging);
+    void setBatteryIcon(int index);
 
 signals:
     void trayClicked();